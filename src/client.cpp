@@ -22,7 +22,7 @@ CJellyfinPVRClient::CJellyfinPVRClient(const kodi::addon::IInstanceInfo& instanc
   
   if (LoadSettings())
   {
-    m_jellyfinClient = std::make_unique<JellyfinClient>(m_serverUrl, m_userId, m_apiKey);
+    m_jellyfinClient = std::make_unique<JellyfinClient>(this, m_serverUrl, m_userId, m_apiKey);
     
     // Try to initialize with existing credentials first
     if (m_jellyfinClient->Initialize())
@@ -333,6 +333,22 @@ PVR_ERROR CJellyfinPVRClient::DeleteTimer(const kodi::addon::PVRTimer& timer, bo
   return m_jellyfinClient->DeleteTimer(timer);
 }
 
+PVR_ERROR CJellyfinPVRClient::UpdateTimer(const kodi::addon::PVRTimer& timer)
+{
+  if (!m_jellyfinClient)
+    return PVR_ERROR_SERVER_ERROR;
+
+  return m_jellyfinClient->UpdateTimer(timer);
+}
+
+PVR_ERROR CJellyfinPVRClient::GetTimerTypes(std::vector<kodi::addon::PVRTimerType>& types)
+{
+  if (!m_jellyfinClient)
+    return PVR_ERROR_SERVER_ERROR;
+
+  return m_jellyfinClient->GetTimerTypes(types);
+}
+
 PVR_ERROR CJellyfinPVRClient::GetChannelStreamProperties(const kodi::addon::PVRChannel& channel,
                                                          std::vector<kodi::addon::PVRStreamProperty>& properties)
 {
@@ -50,6 +50,8 @@ public:
   PVR_ERROR GetTimers(kodi::addon::PVRTimersResultSet& results) override;
   PVR_ERROR AddTimer(const kodi::addon::PVRTimer& timer) override;
   PVR_ERROR DeleteTimer(const kodi::addon::PVRTimer& timer, bool forceDelete) override;
+  PVR_ERROR UpdateTimer(const kodi::addon::PVRTimer& timer) override;
+  PVR_ERROR GetTimerTypes(std::vector<kodi::addon::PVRTimerType>& types) override;
 
   // Stream URLs
   PVR_ERROR GetChannelStreamProperties(const kodi::addon::PVRChannel& channel,
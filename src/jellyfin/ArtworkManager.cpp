@@ -0,0 +1,412 @@
+#include "ArtworkManager.h"
+#include "Connection.h"
+#include "../utilities/Logger.h"
+#include <kodi/Filesystem.h>
+#include <json/json.h>
+#include <sstream>
+#include <iterator>
+
+namespace
+{
+
+const int ARTWORK_INDEX_VERSION = 1;
+const size_t MAX_QUEUED_DOWNLOADS = 2000;
+
+// Rough cost of one list or hash node, on top of its payload
+const size_t NODE_BYTES = 4 * sizeof(void*);
+
+} // namespace
+
+ArtworkManager::ArtworkManager(Connection* connection, bool cacheEnabled, uint64_t maxCacheBytes)
+  : m_connection(connection)
+  , m_cacheEnabled(cacheEnabled)
+  , m_maxCacheBytes(maxCacheBytes)
+  , m_cacheBytes(0)
+  , m_indexDirty(false)
+  , m_running(false)
+  , m_prefetchPaused(false)
+{
+  if (!m_cacheEnabled)
+    return;
+  
+  m_cacheDir = kodi::addon::GetUserPath("artwork/");
+  if (!kodi::vfs::DirectoryExists(m_cacheDir) && !kodi::vfs::CreateDirectory(m_cacheDir))
+  {
+    Logger::Log(ADDON_LOG_ERROR, "Failed to create artwork cache directory: %s", m_cacheDir.c_str());
+    m_cacheEnabled = false;
+    return;
+  }
+  
+  LoadIndex();
+  
+  m_running = true;
+  m_worker = std::thread(&ArtworkManager::WorkerLoop, this);
+}
+
+ArtworkManager::~ArtworkManager()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_running = false;
+  }
+  m_queueCondition.notify_all();
+  
+  if (m_worker.joinable())
+    m_worker.join();
+  
+  if (m_cacheEnabled)
+    SaveIndex();
+}
+
+int ArtworkManager::GetMaxWidth(ArtworkKind kind)
+{
+  switch (kind)
+  {
+    case ArtworkKind::ChannelLogo:
+      return 256;
+    case ArtworkKind::RecordingThumbnail:
+      return 640;
+    case ArtworkKind::ProgrammePoster:
+      return 400;
+  }
+  return 400;
+}
+
+std::string ArtworkManager::MakeKey(const std::string& itemId, const std::string& tag, ArtworkKind kind)
+{
+  std::ostringstream key;
+  key << itemId << '_' << tag << '_' << GetMaxWidth(kind);
+  return key.str();
+}
+
+std::string ArtworkManager::MakeFileName(const std::string& key)
+{
+  // Each key gets its own file: characters that are not safe in a file
+  // name are escaped rather than dropped, so no two keys share a name
+  static const char HEX[] = "0123456789abcdef";
+  std::string fileName;
+  fileName.reserve(key.size() + 4);
+  for (unsigned char c : key)
+  {
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_')
+    {
+      fileName += static_cast<char>(c);
+    }
+    else
+    {
+      fileName += '~';
+      fileName += HEX[c >> 4];
+      fileName += HEX[c & 0x0f];
+    }
+  }
+  fileName += ".img";
+  return fileName;
+}
+
+std::string ArtworkManager::BuildImageUrl(const std::string& itemId, const std::string& tag,
+                                          ArtworkKind kind) const
+{
+  // The tag changes whenever the image does, so Kodi's texture cache and
+  // ours can treat the URL as immutable
+  std::ostringstream url;
+  url << m_connection->GetServerUrl() << "/Items/" << itemId << "/Images/Primary"
+      << "?maxWidth=" << GetMaxWidth(kind);
+  if (!tag.empty())
+    url << "&tag=" << tag;
+  return url.str();
+}
+
+std::string ArtworkManager::GetImagePath(const std::string& itemId, const std::string& tag,
+                                         ArtworkKind kind)
+{
+  if (itemId.empty() || tag.empty())
+    return "";
+  
+  if (m_cacheEnabled)
+  {
+    std::string key = MakeKey(itemId, tag, kind);
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto it = m_entries.find(key);
+      if (it != m_entries.end())
+      {
+        it->second->lastUsed = std::time(nullptr);
+        m_lru.splice(m_lru.begin(), m_lru, it->second);
+        m_indexDirty = true;
+        return m_cacheDir + it->second->fileName;
+      }
+    }
+    
+    if (Enqueue({itemId, tag, kind}))
+      m_queueCondition.notify_one();
+  }
+  
+  return BuildImageUrl(itemId, tag, kind);
+}
+
+void ArtworkManager::Prefetch(const std::vector<ArtworkRequest>& requests)
+{
+  if (!m_cacheEnabled || m_prefetchPaused)
+    return;
+  
+  int queued = 0;
+  for (const auto& request : requests)
+  {
+    if (!request.itemId.empty() && !request.tag.empty() && Enqueue(request))
+      queued++;
+  }
+  
+  if (queued > 0)
+  {
+    Logger::Log(ADDON_LOG_DEBUG, "Queued %d artwork downloads", queued);
+    m_queueCondition.notify_one();
+  }
+}
+
+uint64_t ArtworkManager::GetCacheBytes() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_cacheBytes;
+}
+
+size_t ArtworkManager::GetCacheEntryCount() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_entries.size();
+}
+
+size_t ArtworkManager::GetMemoryUsage() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  
+  // Each cached image has a list entry and an index entry keyed the same
+  size_t bytes = 0;
+  for (const auto& entry : m_lru)
+    bytes += 2 * NODE_BYTES + sizeof(CacheEntry) + 2 * entry.key.capacity() + entry.fileName.capacity();
+  for (const auto& request : m_queue)
+    bytes += sizeof(ArtworkRequest) + request.itemId.capacity() + request.tag.capacity();
+  for (const auto& key : m_pending)
+    bytes += NODE_BYTES + sizeof(std::string) + key.capacity();
+  return bytes;
+}
+
+void ArtworkManager::SetPrefetchPaused(bool paused)
+{
+  m_prefetchPaused = paused;
+  if (!paused)
+    return;
+  
+  // A download in progress is not in the queue and finishes normally
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (const auto& request : m_queue)
+    m_pending.erase(MakeKey(request.itemId, request.tag, request.kind));
+  m_queue.clear();
+  m_queue.shrink_to_fit();
+}
+
+bool ArtworkManager::Enqueue(const ArtworkRequest& request)
+{
+  std::string key = MakeKey(request.itemId, request.tag, request.kind);
+  
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!m_running || m_entries.count(key) || m_pending.count(key) || m_queue.size() >= MAX_QUEUED_DOWNLOADS)
+    return false;
+  
+  m_pending.insert(key);
+  m_queue.push_back(request);
+  return true;
+}
+
+void ArtworkManager::WorkerLoop()
+{
+  while (true)
+  {
+    ArtworkRequest request;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_queueCondition.wait(lock, [this] { return !m_running || !m_queue.empty(); });
+      if (!m_running)
+        break;
+      
+      request = m_queue.front();
+      m_queue.pop_front();
+    }
+    
+    std::string key = MakeKey(request.itemId, request.tag, request.kind);
+    bool downloaded = Download(request, key);
+    
+    bool saveIndex = false;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_pending.erase(key);
+      saveIndex = downloaded && m_queue.empty();
+    }
+    
+    // Persist the index once a batch of downloads has drained
+    if (saveIndex)
+      SaveIndex();
+  }
+}
+
+bool ArtworkManager::Download(const ArtworkRequest& request, const std::string& key)
+{
+  std::string url = BuildImageUrl(request.itemId, request.tag, request.kind);
+  
+  kodi::vfs::CFile source;
+  if (!source.OpenFile(url, ADDON_READ_NO_CACHE))
+  {
+    Logger::Log(ADDON_LOG_DEBUG, "Failed to download artwork: %s", url.c_str());
+    return false;
+  }
+  
+  std::string fileName = MakeFileName(key);
+  std::string path = m_cacheDir + fileName;
+  std::string tempPath = path + ".tmp";
+  
+  kodi::vfs::CFile target;
+  if (!target.OpenFileForWrite(tempPath, true))
+  {
+    Logger::Log(ADDON_LOG_ERROR, "Failed to write artwork cache file: %s", tempPath.c_str());
+    source.Close();
+    return false;
+  }
+  
+  uint64_t size = 0;
+  char buffer[16384];
+  ssize_t bytesRead;
+  while ((bytesRead = source.Read(buffer, sizeof(buffer))) > 0)
+  {
+    if (target.Write(buffer, bytesRead) != bytesRead)
+    {
+      size = 0;
+      break;
+    }
+    size += bytesRead;
+  }
+  source.Close();
+  target.Close();
+  
+  if (size == 0 || !kodi::vfs::RenameFile(tempPath, path))
+  {
+    kodi::vfs::DeleteFile(tempPath);
+    return false;
+  }
+  
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_lru.push_front({key, fileName, size, std::time(nullptr)});
+  m_entries[key] = m_lru.begin();
+  m_cacheBytes += size;
+  m_indexDirty = true;
+  EvictLocked();
+  
+  return true;
+}
+
+void ArtworkManager::EvictLocked()
+{
+  while (m_cacheBytes > m_maxCacheBytes && !m_lru.empty())
+  {
+    const CacheEntry& oldest = m_lru.back();
+    kodi::vfs::DeleteFile(m_cacheDir + oldest.fileName);
+    m_cacheBytes -= oldest.size;
+    m_entries.erase(oldest.key);
+    m_lru.pop_back();
+  }
+}
+
+void ArtworkManager::LoadIndex()
+{
+  std::string indexPath = m_cacheDir + "index.json";
+  
+  kodi::vfs::CFile file;
+  if (!kodi::vfs::FileExists(indexPath) || !file.OpenFile(indexPath))
+    return;
+  
+  std::string content;
+  char buffer[16384];
+  ssize_t bytesRead;
+  while ((bytesRead = file.Read(buffer, sizeof(buffer))) > 0)
+    content.append(buffer, bytesRead);
+  file.Close();
+  
+  Json::Value index;
+  Json::CharReaderBuilder builder;
+  std::string errors;
+  std::istringstream stream(content);
+  if (!Json::parseFromStream(builder, stream, &index, &errors) ||
+      index.get("Version", 0).asInt() != ARTWORK_INDEX_VERSION)
+  {
+    Logger::Log(ADDON_LOG_WARNING, "Ignoring unreadable artwork cache index");
+    return;
+  }
+  
+  std::lock_guard<std::mutex> lock(m_mutex);
+  const Json::Value& entries = index["Entries"];
+  for (unsigned int i = 0; i < entries.size(); i++)
+  {
+    CacheEntry entry;
+    entry.key = entries[i]["Key"].asString();
+    entry.fileName = entries[i]["File"].asString();
+    entry.size = static_cast<uint64_t>(entries[i]["Size"].asInt64());
+    entry.lastUsed = static_cast<time_t>(entries[i]["LastUsed"].asInt64());
+    
+    if (entry.key.empty() || m_entries.count(entry.key) ||
+        !kodi::vfs::FileExists(m_cacheDir + entry.fileName))
+      continue;
+    
+    // Earlier versions named files by a hash of the key, which different
+    // keys could share
+    if (entry.fileName != MakeFileName(entry.key))
+    {
+      kodi::vfs::DeleteFile(m_cacheDir + entry.fileName);
+      continue;
+    }
+    
+    // Index is written most recent first
+    m_lru.push_back(entry);
+    m_entries[entry.key] = std::prev(m_lru.end());
+    m_cacheBytes += entry.size;
+  }
+  
+  EvictLocked();
+  
+  Logger::Log(ADDON_LOG_INFO, "Artwork cache: %d images, %d KB",
+              static_cast<int>(m_entries.size()), static_cast<int>(m_cacheBytes / 1024));
+}
+
+void ArtworkManager::SaveIndex()
+{
+  Json::Value index;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_indexDirty)
+      return;
+    
+    index["Version"] = ARTWORK_INDEX_VERSION;
+    Json::Value entries(Json::arrayValue);
+    for (const auto& entry : m_lru)
+    {
+      Json::Value item;
+      item["Key"] = entry.key;
+      item["File"] = entry.fileName;
+      item["Size"] = static_cast<Json::Int64>(entry.size);
+      item["LastUsed"] = static_cast<Json::Int64>(entry.lastUsed);
+      entries.append(item);
+    }
+    index["Entries"] = entries;
+    m_indexDirty = false;
+  }
+  
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "";
+  std::string content = Json::writeString(builder, index);
+  
+  kodi::vfs::CFile file;
+  if (!file.OpenFileForWrite(m_cacheDir + "index.json", true))
+  {
+    Logger::Log(ADDON_LOG_ERROR, "Failed to write artwork cache index");
+    return;
+  }
+  file.Write(content.data(), content.size());
+  file.Close();
+}
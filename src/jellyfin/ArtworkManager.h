@@ -0,0 +1,95 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+
+class Connection;
+
+enum class ArtworkKind
+{
+  ChannelLogo,
+  RecordingThumbnail,
+  ProgrammePoster
+};
+
+struct ArtworkRequest
+{
+  std::string itemId;
+  std::string tag;
+  ArtworkKind kind;
+};
+
+// Builds tag-versioned, size-constrained Jellyfin image URLs and keeps a
+// bounded LRU cache of downloaded images in addon userdata. Images are
+// fetched on a background thread; callers get the local path once an image
+// is cached and the remote URL until then.
+class ArtworkManager
+{
+public:
+  ArtworkManager(Connection* connection, bool cacheEnabled, uint64_t maxCacheBytes);
+  ~ArtworkManager();
+
+  std::string BuildImageUrl(const std::string& itemId, const std::string& tag, ArtworkKind kind) const;
+  
+  // Local path if cached, otherwise the remote URL (and queue a download)
+  std::string GetImagePath(const std::string& itemId, const std::string& tag, ArtworkKind kind);
+  
+  void Prefetch(const std::vector<ArtworkRequest>& requests);
+  
+  uint64_t GetCacheBytes() const;
+  size_t GetCacheEntryCount() const;
+  
+  // Images live on disk; in memory there is only the cache index and the
+  // download queue. Pausing prefetch drops the queue and ignores further
+  // Prefetch calls; images Kodi asks for are still queued.
+  size_t GetMemoryUsage() const;
+  void SetPrefetchPaused(bool paused);
+
+private:
+  struct CacheEntry
+  {
+    std::string key;
+    std::string fileName;
+    uint64_t size;
+    time_t lastUsed;
+  };
+
+  Connection* m_connection;
+  bool m_cacheEnabled;
+  uint64_t m_maxCacheBytes;
+  std::string m_cacheDir;
+  
+  mutable std::mutex m_mutex;
+  std::list<CacheEntry> m_lru;   // Most recently used at the front
+  std::unordered_map<std::string, std::list<CacheEntry>::iterator> m_entries;
+  uint64_t m_cacheBytes;
+  bool m_indexDirty;
+  
+  std::deque<ArtworkRequest> m_queue;
+  std::unordered_set<std::string> m_pending;
+  std::condition_variable m_queueCondition;
+  bool m_running;
+  std::atomic<bool> m_prefetchPaused;
+  std::thread m_worker;
+  
+  static int GetMaxWidth(ArtworkKind kind);
+  static std::string MakeKey(const std::string& itemId, const std::string& tag, ArtworkKind kind);
+  static std::string MakeFileName(const std::string& key);
+  
+  bool Enqueue(const ArtworkRequest& request);
+  void WorkerLoop();
+  bool Download(const ArtworkRequest& request, const std::string& key);
+  void EvictLocked();
+  void LoadIndex();
+  void SaveIndex();
+};
@@ -0,0 +1,626 @@
+#include "AutoRecorder.h"
+#include "../utilities/Logger.h"
+#include <kodi/Filesystem.h>
+#include <json/json.h>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <limits>
+#include <sstream>
+
+namespace
+{
+
+const int AUTO_RECORD_RULES_VERSION = 1;
+const char AUTO_RECORD_RULES_FILE[] = "autorecord.json";
+
+// Approximate size of one word's hash node: the key, its postings vector
+// and the node links
+const size_t INDEX_NODE_BYTES = sizeof(std::string) + sizeof(std::vector<uint32_t>) + 2 * sizeof(void*);
+
+// Matches whose timer could not be created are offered again this often
+const int AUTO_RECORD_RETRY_SECONDS = 300;
+
+std::string MatchKey(const AutoRecordMatch& match)
+{
+  return std::to_string(match.ruleId) + "/" + match.programme.itemId;
+}
+
+bool EqualsIgnoreCase(std::string_view a, std::string_view b)
+{
+  if (a.size() != b.size())
+    return false;
+  for (size_t i = 0; i < a.size(); i++)
+  {
+    if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i])))
+      return false;
+  }
+  return true;
+}
+
+} // namespace
+
+AutoRecorder::AutoRecorder()
+  : m_nextRuleId(1)
+  , m_memoryUsage(0)
+  , m_running(false)
+{
+}
+
+AutoRecorder::~AutoRecorder()
+{
+  Stop();
+}
+
+std::vector<std::string> AutoRecorder::Tokenize(std::string_view text)
+{
+  // ASCII letters and digits are folded to lower case; other UTF-8 bytes
+  // are kept as they are, so accented words still form one token
+  std::vector<std::string> words;
+  std::string word;
+  for (char c : text)
+  {
+    unsigned char byte = static_cast<unsigned char>(c);
+    if (std::isalnum(byte) || byte >= 0x80)
+    {
+      word += static_cast<char>(std::tolower(byte));
+    }
+    else if (!word.empty())
+    {
+      words.push_back(std::move(word));
+      word.clear();
+    }
+  }
+  if (!word.empty())
+    words.push_back(std::move(word));
+  return words;
+}
+
+bool AutoRecorder::IsValid(const AutoRecordRule& rule)
+{
+  // A rule without words or a channel would record the whole guide
+  return !Tokenize(rule.title).empty() || !Tokenize(rule.keywords).empty() || !rule.channelId.empty();
+}
+
+void AutoRecorder::Start(MatchCallback callback)
+{
+  Stop();
+
+  m_callback = std::move(callback);
+  m_running = true;
+  m_thread = std::thread(&AutoRecorder::RecorderLoop, this);
+}
+
+void AutoRecorder::Stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_pendingMutex);
+    m_running = false;
+  }
+  m_pendingCondition.notify_all();
+
+  if (m_thread.joinable())
+    m_thread.join();
+}
+
+std::vector<AutoRecordRule> AutoRecorder::GetRules() const
+{
+  std::lock_guard<std::mutex> lock(m_rulesMutex);
+  std::vector<AutoRecordRule> rules;
+  rules.reserve(m_rules.size());
+  for (const auto& rule : m_rules)
+    rules.push_back(rule.second);
+  return rules;
+}
+
+size_t AutoRecorder::GetRuleCount() const
+{
+  std::lock_guard<std::mutex> lock(m_rulesMutex);
+  return m_rules.size();
+}
+
+unsigned int AutoRecorder::AddRule(AutoRecordRule rule)
+{
+  if (!IsValid(rule))
+    return 0;
+
+  {
+    std::lock_guard<std::mutex> lock(m_rulesMutex);
+    rule.id = m_nextRuleId++;
+    m_rules[rule.id] = rule;
+    SaveRules();
+  }
+
+  Logger::Log(ADDON_LOG_INFO, "Added auto-record rule %u: %s", rule.id, rule.name.c_str());
+  {
+    std::lock_guard<std::mutex> lock(m_pendingMutex);
+    m_pendingRules.insert(rule.id);
+  }
+  m_pendingCondition.notify_all();
+  return rule.id;
+}
+
+bool AutoRecorder::UpdateRule(const AutoRecordRule& rule)
+{
+  if (!IsValid(rule))
+    return false;
+
+  {
+    std::lock_guard<std::mutex> lock(m_rulesMutex);
+    auto existing = m_rules.find(rule.id);
+    if (existing == m_rules.end())
+      return false;
+    existing->second = rule;
+    SaveRules();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_pendingMutex);
+    m_pendingRules.insert(rule.id);
+  }
+  m_pendingCondition.notify_all();
+  return true;
+}
+
+bool AutoRecorder::DeleteRule(unsigned int id)
+{
+  // Timers the rule already created stay on the server
+  {
+    std::lock_guard<std::mutex> lock(m_rulesMutex);
+    if (m_rules.erase(id) == 0)
+      return false;
+    for (auto it = m_scheduled.begin(); it != m_scheduled.end();)
+    {
+      if (it->second.ruleId == id)
+        it = m_scheduled.erase(it);
+      else
+        ++it;
+    }
+    SaveRules();
+  }
+  Logger::Log(ADDON_LOG_INFO, "Deleted auto-record rule %u", id);
+
+  // With the last rule gone the index is dropped
+  {
+    std::lock_guard<std::mutex> lock(m_pendingMutex);
+    m_pendingRules.insert(id);
+  }
+  m_pendingCondition.notify_all();
+  return true;
+}
+
+void AutoRecorder::SetScheduled(const std::string& programId, unsigned int ruleId)
+{
+  std::lock_guard<std::mutex> lock(m_rulesMutex);
+  if (m_rules.count(ruleId) == 0)
+    return;
+  m_scheduled[programId] = {ruleId, std::time(nullptr)};
+  SaveRules();
+}
+
+unsigned int AutoRecorder::GetScheduledRule(const std::string& programId) const
+{
+  std::lock_guard<std::mutex> lock(m_rulesMutex);
+  auto it = m_scheduled.find(programId);
+  return it != m_scheduled.end() ? it->second.ruleId : 0;
+}
+
+void AutoRecorder::PruneScheduled(const std::set<std::string>& programIds, time_t since)
+{
+  // A timer created while the list was being fetched may not be on it yet
+  std::lock_guard<std::mutex> lock(m_rulesMutex);
+  size_t before = m_scheduled.size();
+  for (auto it = m_scheduled.begin(); it != m_scheduled.end();)
+  {
+    if (it->second.at < since && programIds.count(it->first) == 0)
+      it = m_scheduled.erase(it);
+    else
+      ++it;
+  }
+  if (m_scheduled.size() != before)
+    SaveRules();
+}
+
+void AutoRecorder::Update(const ScheduleMap& channels)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_pendingMutex);
+    m_pendingGuide = std::make_shared<const ScheduleMap>(channels);
+  }
+  m_pendingCondition.notify_all();
+}
+
+void AutoRecorder::LoadRules()
+{
+  std::string path = kodi::addon::GetUserPath(AUTO_RECORD_RULES_FILE);
+
+  kodi::vfs::CFile file;
+  if (!kodi::vfs::FileExists(path) || !file.OpenFile(path))
+    return;
+
+  std::string content;
+  char buffer[16384];
+  ssize_t bytesRead;
+  while ((bytesRead = file.Read(buffer, sizeof(buffer))) > 0)
+    content.append(buffer, bytesRead);
+  file.Close();
+
+  Json::Value root;
+  Json::CharReaderBuilder builder;
+  std::string errors;
+  std::istringstream stream(content);
+  if (!Json::parseFromStream(builder, stream, &root, &errors) ||
+      root.get("Version", 0).asInt() != AUTO_RECORD_RULES_VERSION)
+  {
+    Logger::Log(ADDON_LOG_WARNING, "Ignoring unreadable auto-record rules");
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(m_rulesMutex);
+  const Json::Value& rules = root["Rules"];
+  for (unsigned int i = 0; i < rules.size(); i++)
+  {
+    AutoRecordRule rule;
+    rule.id = rules[i].get("Id", 0).asUInt();
+    rule.name = rules[i].get("Name", "").asString();
+    rule.title = rules[i].get("Title", "").asString();
+    rule.keywords = rules[i].get("Keywords", "").asString();
+    rule.channelId = rules[i].get("ChannelId", "").asString();
+    rule.startMinuteFrom = rules[i].get("StartMinuteFrom", -1).asInt();
+    rule.startMinuteTo = rules[i].get("StartMinuteTo", -1).asInt();
+    rule.weekdays = rules[i].get("Weekdays", 0).asUInt();
+    rule.enabled = rules[i].get("Enabled", true).asBool();
+
+    if (rule.id == 0 || !IsValid(rule))
+      continue;
+    m_rules[rule.id] = rule;
+    m_nextRuleId = std::max(m_nextRuleId, rule.id + 1);
+  }
+
+  const Json::Value& scheduled = root["Scheduled"];
+  for (unsigned int i = 0; i < scheduled.size(); i++)
+  {
+    std::string programId = scheduled[i].get("ProgramId", "").asString();
+    unsigned int ruleId = scheduled[i].get("RuleId", 0).asUInt();
+    if (programId.empty() || m_rules.count(ruleId) == 0)
+      continue;
+    m_scheduled[programId] = {ruleId, static_cast<time_t>(scheduled[i].get("At", 0).asInt64())};
+  }
+
+  Logger::Log(ADDON_LOG_INFO, "Loaded %d auto-record rules with %d scheduled programmes",
+              static_cast<int>(m_rules.size()), static_cast<int>(m_scheduled.size()));
+}
+
+void AutoRecorder::SaveRules() const
+{
+  // Called with m_rulesMutex held; rules change rarely and the file is small
+  Json::Value root;
+  root["Version"] = AUTO_RECORD_RULES_VERSION;
+  Json::Value rules(Json::arrayValue);
+  for (const auto& entry : m_rules)
+  {
+    const AutoRecordRule& rule = entry.second;
+    Json::Value item;
+    item["Id"] = rule.id;
+    item["Name"] = rule.name;
+    item["Title"] = rule.title;
+    item["Keywords"] = rule.keywords;
+    item["ChannelId"] = rule.channelId;
+    item["StartMinuteFrom"] = rule.startMinuteFrom;
+    item["StartMinuteTo"] = rule.startMinuteTo;
+    item["Weekdays"] = rule.weekdays;
+    item["Enabled"] = rule.enabled;
+    rules.append(item);
+  }
+  root["Rules"] = rules;
+
+  Json::Value scheduled(Json::arrayValue);
+  for (const auto& entry : m_scheduled)
+  {
+    Json::Value item;
+    item["ProgramId"] = entry.first;
+    item["RuleId"] = entry.second.ruleId;
+    item["At"] = static_cast<Json::Int64>(entry.second.at);
+    scheduled.append(item);
+  }
+  root["Scheduled"] = scheduled;
+
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "";
+  std::string content = Json::writeString(builder, root);
+
+  kodi::vfs::CFile file;
+  if (!file.OpenFileForWrite(kodi::addon::GetUserPath(AUTO_RECORD_RULES_FILE), true))
+  {
+    Logger::Log(ADDON_LOG_ERROR, "Failed to write auto-record rules");
+    return;
+  }
+  file.Write(content.data(), content.size());
+  file.Close();
+}
+
+void AutoRecorder::RecorderLoop()
+{
+  while (m_running)
+  {
+    std::shared_ptr<const ScheduleMap> guide;
+    std::set<unsigned int> changedRules;
+    {
+      std::unique_lock<std::mutex> lock(m_pendingMutex);
+      auto woken = [this] { return !m_running || m_pendingGuide || !m_pendingRules.empty(); };
+      if (m_retry.empty())
+        m_pendingCondition.wait(lock, woken);
+      else
+        m_pendingCondition.wait_for(lock, std::chrono::seconds(AUTO_RECORD_RETRY_SECONDS), woken);
+      if (!m_running)
+        break;
+
+      guide.swap(m_pendingGuide);
+      changedRules.swap(m_pendingRules);
+    }
+
+    if (guide)
+      m_guide = std::move(guide);
+
+    std::vector<PreparedRule> prepared;
+    for (auto& rule : GetRules())
+    {
+      if (!rule.enabled)
+        continue;
+
+      PreparedRule entry;
+      std::vector<std::string> keywords = Tokenize(rule.keywords);
+      entry.required = Tokenize(rule.title);
+      entry.required.insert(entry.required.end(), keywords.begin(), keywords.end());
+      entry.rule = std::move(rule);
+      prepared.push_back(std::move(entry));
+    }
+
+    // Without an enabled rule there is nothing to match, so the guide is
+    // not indexed; the first rule enabled indexes all of it
+    if (prepared.empty())
+    {
+      m_index.clear();
+      m_retry.clear();
+      m_memoryUsage = 0;
+      continue;
+    }
+
+    auto passStart = std::chrono::steady_clock::now();
+    std::vector<std::string> changedChannels;
+    size_t programmes = 0;
+    if (m_guide)
+      programmes = Reindex(*m_guide, changedChannels);
+    auto indexed = std::chrono::steady_clock::now();
+
+    // New or changed rules look at the whole guide, the others only at the
+    // channels that changed
+    time_t now = std::time(nullptr);
+    std::vector<AutoRecordMatch> matches;
+    for (const auto& rule : prepared)
+    {
+      if (changedRules.count(rule.rule.id) > 0)
+      {
+        for (const auto& channel : m_index)
+          Evaluate(rule, channel.first, channel.second, now, matches);
+      }
+      else
+      {
+        for (const auto& channelId : changedChannels)
+          Evaluate(rule, channelId, m_index[channelId], now, matches);
+      }
+    }
+
+    for (auto it = m_reported.begin(); it != m_reported.end();)
+    {
+      if (it->second <= now)
+        it = m_reported.erase(it);
+      else
+        ++it;
+    }
+
+    // Earlier failures go again while their rule is enabled and the
+    // programme has not started
+    for (auto& match : m_retry)
+    {
+      bool enabled = std::any_of(prepared.begin(), prepared.end(),
+                                 [&match](const PreparedRule& rule) { return rule.rule.id == match.ruleId; });
+      if (enabled && match.programme.startTime > now)
+        matches.push_back(std::move(match));
+    }
+    m_retry.clear();
+
+    std::vector<AutoRecordMatch> fresh;
+    std::set<std::string> offered;
+    for (auto& match : matches)
+    {
+      std::string key = MatchKey(match);
+      if (m_reported.count(key) == 0 && offered.insert(key).second)
+        fresh.push_back(std::move(match));
+    }
+
+    auto elapsed = [](std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+      return static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(to - from).count());
+    };
+    auto done = std::chrono::steady_clock::now();
+    Logger::Log(ADDON_LOG_DEBUG,
+                "Auto-record: %d rule(s) over %d changed of %d channels (%d programmes), index %d ms, match %d ms, %d new match(es)",
+                static_cast<int>(prepared.size()), static_cast<int>(changedChannels.size()),
+                static_cast<int>(m_index.size()), static_cast<int>(programmes),
+                elapsed(passStart, indexed), elapsed(indexed, done), static_cast<int>(fresh.size()));
+
+    if (fresh.empty() || !m_callback)
+      continue;
+
+    // Only what the callback handled is never reported again
+    std::vector<bool> handled(fresh.size(), false);
+    for (size_t position : m_callback(fresh))
+    {
+      if (position < handled.size())
+        handled[position] = true;
+    }
+    for (size_t i = 0; i < fresh.size(); i++)
+    {
+      if (handled[i])
+        m_reported.emplace(MatchKey(fresh[i]), fresh[i].programme.startTime);
+      else
+        m_retry.push_back(std::move(fresh[i]));
+    }
+    if (!m_retry.empty())
+      Logger::Log(ADDON_LOG_INFO, "Auto-record: %d match(es) not scheduled, retrying in %d s",
+                  static_cast<int>(m_retry.size()), AUTO_RECORD_RETRY_SECONDS);
+  }
+}
+
+size_t AutoRecorder::Reindex(const ScheduleMap& channels, std::vector<std::string>& changed)
+{
+  for (auto it = m_index.begin(); it != m_index.end();)
+  {
+    if (channels.count(it->first) == 0)
+      it = m_index.erase(it);
+    else
+      ++it;
+  }
+
+  // Schedules are immutable, so an unchanged pointer means nothing to redo
+  size_t programmes = 0;
+  size_t bytes = m_index.bucket_count() * sizeof(void*);
+  for (const auto& channel : channels)
+  {
+    ChannelIndex& index = m_index[channel.first];
+    programmes += channel.second->Size();
+    if (index.schedule != channel.second)
+    {
+      index.schedule = channel.second;
+      BuildIndex(index);
+      changed.push_back(channel.first);
+    }
+    bytes += sizeof(ChannelIndex) + channel.first.capacity() + index.bytes;
+  }
+  m_memoryUsage = bytes;
+  return programmes;
+}
+
+void AutoRecorder::BuildIndex(ChannelIndex& index)
+{
+  const ChannelSchedule& schedule = *index.schedule;
+  index.words.clear();
+
+  // Titles repeat through the week; each distinct one is split once
+  std::unordered_map<std::string_view, std::vector<uint32_t>> byText;
+  for (size_t i = 0; i < schedule.Size(); i++)
+  {
+    byText[schedule.GetTitle(i)].push_back(static_cast<uint32_t>(i));
+    std::string_view episodeTitle = schedule.GetEpisodeTitle(i);
+    if (!episodeTitle.empty())
+      byText[episodeTitle].push_back(static_cast<uint32_t>(i));
+  }
+
+  for (const auto& text : byText)
+  {
+    std::vector<std::string> words = Tokenize(text.first);
+    std::sort(words.begin(), words.end());
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+
+    for (const auto& word : words)
+    {
+      std::vector<uint32_t>& postings = index.words[word];
+      postings.insert(postings.end(), text.second.begin(), text.second.end());
+    }
+  }
+
+  // A word in both the title and episode title lists a programme twice
+  index.bytes = index.words.bucket_count() * sizeof(void*);
+  for (auto& word : index.words)
+  {
+    std::sort(word.second.begin(), word.second.end());
+    word.second.erase(std::unique(word.second.begin(), word.second.end()), word.second.end());
+    word.second.shrink_to_fit();
+    index.bytes += INDEX_NODE_BYTES + word.first.capacity() + word.second.capacity() * sizeof(uint32_t);
+  }
+}
+
+void AutoRecorder::Evaluate(const PreparedRule& prepared, const std::string& channelId, const ChannelIndex& index,
+                            time_t now, std::vector<AutoRecordMatch>& matches) const
+{
+  const AutoRecordRule& rule = prepared.rule;
+  if (!index.schedule || (!rule.channelId.empty() && rule.channelId != channelId))
+    return;
+
+  const ChannelSchedule& schedule = *index.schedule;
+
+  // The rarest required word gives the candidates and the other words'
+  // postings confirm them; a word missing from the channel rules it out
+  std::vector<const std::vector<uint32_t>*> postings;
+  for (const auto& word : prepared.required)
+  {
+    auto found = index.words.find(word);
+    if (found == index.words.end())
+      return;
+    postings.push_back(&found->second);
+  }
+  std::sort(postings.begin(), postings.end(),
+            [](const std::vector<uint32_t>* a, const std::vector<uint32_t>* b) { return a->size() < b->size(); });
+
+  auto check = [&](size_t i) {
+    time_t start = schedule.GetStartTime(i);
+    if (start <= now || !MatchesTime(rule, start))
+      return;
+
+    for (size_t p = 1; p < postings.size(); p++)
+    {
+      if (!std::binary_search(postings[p]->begin(), postings[p]->end(), static_cast<uint32_t>(i)))
+        return;
+    }
+
+    if (!rule.title.empty() && !EqualsIgnoreCase(schedule.GetTitle(i), rule.title))
+      return;
+
+    AutoRecordMatch match;
+    match.ruleId = rule.id;
+    match.channelId = channelId;
+    schedule.GetEntry(i, match.programme);
+    match.programme.channelId = channelId;
+    matches.push_back(std::move(match));
+  };
+
+  // Postings are in start time order, so what has aired is skipped at once
+  std::pair<size_t, size_t> range = schedule.FindRange(now, std::numeric_limits<time_t>::max());
+  if (!postings.empty())
+  {
+    const std::vector<uint32_t>& candidates = *postings.front();
+    auto first = std::lower_bound(candidates.begin(), candidates.end(), static_cast<uint32_t>(range.first));
+    for (auto it = first; it != candidates.end(); ++it)
+      check(*it);
+  }
+  else
+  {
+    // Channel-only rule: everything still to come on the channel
+    for (size_t i = range.first; i < range.second; i++)
+      check(i);
+  }
+}
+
+bool AutoRecorder::MatchesTime(const AutoRecordRule& rule, time_t start) const
+{
+  if (rule.startMinuteFrom < 0 && rule.startMinuteTo < 0 && rule.weekdays == 0)
+    return true;
+
+  struct tm local = {};
+#ifdef _WIN32
+  localtime_s(&local, &start);
+#else
+  localtime_r(&start, &local);
+#endif
+
+  // tm_wday counts from Sunday, the rule's bits from Monday
+  if (rule.weekdays != 0 && (rule.weekdays & (1u << ((local.tm_wday + 6) % 7))) == 0)
+    return false;
+
+  int minute = local.tm_hour * 60 + local.tm_min;
+  int from = rule.startMinuteFrom;
+  int to = rule.startMinuteTo;
+  if (from >= 0 && to >= 0 && from > to)
+    return minute >= from || minute <= to;   // Window across midnight
+  return (from < 0 || minute >= from) && (to < 0 || minute <= to);
+}
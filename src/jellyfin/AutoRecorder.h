@@ -0,0 +1,145 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <ctime>
+#include "ChannelSchedule.h"
+
+// A local auto-record rule. A programme matches when every constraint that
+// is set holds.
+struct AutoRecordRule
+{
+  unsigned int id = 0;
+  std::string name;
+  std::string title;          // Whole title, ignoring case
+  std::string keywords;       // Words that must all appear in the title or episode title
+  std::string channelId;      // Empty for any channel
+  int startMinuteFrom = -1;   // Local start time window, minutes after midnight; -1 leaves it open
+  int startMinuteTo = -1;
+  unsigned int weekdays = 0;  // Bit 0 Monday to bit 6 Sunday, local time; 0 for every day
+  bool enabled = true;
+};
+
+struct AutoRecordMatch
+{
+  unsigned int ruleId;
+  std::string channelId;
+  EPGEntry programme;
+};
+
+// Matches auto-record rules against the guide through a per-channel
+// inverted index from title and episode title words to programmes. The EPG
+// manager hands over every guide it publishes; only channels whose schedule
+// changed are re-indexed and checked again. A rule that is added or changed
+// is checked against the whole index. While no rule is enabled the guide
+// is not indexed at all.
+//
+// Indexing and matching run on the recorder's thread, which also calls the
+// match callback. Each programme is reported once per rule while it has
+// not started yet; matches the callback did not handle are offered again
+// after a delay.
+class AutoRecorder
+{
+public:
+  using ScheduleMap = std::map<std::string, std::shared_ptr<const ChannelSchedule>>;
+  // Returns the positions of the matches it handled
+  using MatchCallback = std::function<std::vector<size_t>(const std::vector<AutoRecordMatch>&)>;
+
+  AutoRecorder();
+  ~AutoRecorder();
+
+  // Rules are kept in addon userdata; load them before Start
+  void LoadRules();
+  void Start(MatchCallback callback);
+  void Stop();
+
+  std::vector<AutoRecordRule> GetRules() const;
+  size_t GetRuleCount() const;
+
+  // A rule needs a title, keywords or a channel. AddRule returns the new
+  // rule's ID, 0 if it was rejected.
+  unsigned int AddRule(AutoRecordRule rule);
+  bool UpdateRule(const AutoRecordRule& rule);
+  bool DeleteRule(unsigned int id);
+
+  // Programmes the rules got a timer for, kept with the rules so the
+  // timers still show under their rule after a restart. PruneScheduled
+  // drops those recorded before since whose programme has no timer any
+  // more; the caller passes the start of the fetch that listed them.
+  void SetScheduled(const std::string& programId, unsigned int ruleId);
+  unsigned int GetScheduledRule(const std::string& programId) const;
+  void PruneScheduled(const std::set<std::string>& programIds, time_t since);
+
+  // Only hands the guide over; cheap enough to call while publishing it
+  void Update(const ScheduleMap& channels);
+
+  // Approximate memory held by the index; safe to call from any thread
+  size_t GetMemoryUsage() const { return m_memoryUsage; }
+
+  // Lower-case words of a title, as the index stores them
+  static std::vector<std::string> Tokenize(std::string_view text);
+
+private:
+  // A rule with its words split once per pass rather than once per channel
+  struct PreparedRule
+  {
+    AutoRecordRule rule;
+    std::vector<std::string> required;   // Title words and keywords
+  };
+
+  struct ChannelIndex
+  {
+    std::shared_ptr<const ChannelSchedule> schedule;
+    std::unordered_map<std::string, std::vector<uint32_t>> words;   // Word -> programme indices
+    size_t bytes = 0;
+  };
+
+  struct Scheduled
+  {
+    unsigned int ruleId;
+    time_t at;   // When the timer was created
+  };
+
+  mutable std::mutex m_rulesMutex;
+  std::map<unsigned int, AutoRecordRule> m_rules;
+  unsigned int m_nextRuleId;
+  std::map<std::string, Scheduled> m_scheduled;   // Programme ID -> rule and time
+
+  // Handed to the recorder's thread
+  std::mutex m_pendingMutex;
+  std::condition_variable m_pendingCondition;
+  std::shared_ptr<const ScheduleMap> m_pendingGuide;
+  std::set<unsigned int> m_pendingRules;
+
+  // Owned by the recorder's thread; the latest guide is kept so the first
+  // rule enabled can index it
+  std::shared_ptr<const ScheduleMap> m_guide;
+  std::unordered_map<std::string, ChannelIndex> m_index;
+  std::atomic<size_t> m_memoryUsage;
+  std::unordered_map<std::string, time_t> m_reported;   // Rule and programme -> programme start
+  std::vector<AutoRecordMatch> m_retry;                  // Matches the callback did not handle
+
+  MatchCallback m_callback;
+  std::thread m_thread;
+  std::atomic<bool> m_running;
+
+  void RecorderLoop();
+  void SaveRules() const;
+  static bool IsValid(const AutoRecordRule& rule);
+
+  size_t Reindex(const ScheduleMap& channels, std::vector<std::string>& changed);
+  static void BuildIndex(ChannelIndex& index);
+  void Evaluate(const PreparedRule& prepared, const std::string& channelId, const ChannelIndex& index,
+                time_t now, std::vector<AutoRecordMatch>& matches) const;
+  bool MatchesTime(const AutoRecordRule& rule, time_t start) const;
+};
@@ -1,119 +1,472 @@
 #include "ChannelManager.h"
 #include "Connection.h"
+#include "ArtworkManager.h"
 #include "../utilities/Logger.h"
+#include "../utilities/BoundedQueue.h"
 #include <json/json.h>
 #include <sstream>
 #include <functional>
+#include <chrono>
+#include <cstdlib>
 
-ChannelManager::ChannelManager(Connection* connection, const std::string& userId)
+namespace
+{
+
+// Channels per /LiveTv/Channels page and pages buffered between stages
+const unsigned int CHANNEL_PAGE_SIZE = 500;
+const size_t CHANNEL_PIPELINE_DEPTH = 4;
+
+// Rough cost of one node in the lookup maps, on top of its key and value
+const size_t MAP_NODE_BYTES = 4 * sizeof(void*);
+
+size_t HashChannelContent(const JellyfinChannel& channel)
+{
+  std::hash<std::string> hasher;
+  size_t hash = hasher(channel.name);
+  hash ^= hasher(channel.imageTag) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+  hash ^= std::hash<int>()(channel.number) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+  hash ^= std::hash<bool>()(channel.isRadio) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+  return hash;
+}
+
+} // namespace
+
+ChannelManager::ChannelManager(Connection* connection, const std::string& userId,
+                               kodi::addon::CInstancePVRClient* instance, ArtworkManager* artwork)
   : m_connection(connection)
   , m_userId(userId)
+  , m_instance(instance)
+  , m_artwork(artwork)
+  , m_loading(false)
+  , m_loadSucceeded(false)
+  , m_firstChannelEmitted(false)
+  , m_loadCancelled(false)
+  , m_syncRunning(false)
+{
+  m_rules.Load(kodi::addon::GetUserPath("channel_rules.json"));
+}
+
+ChannelManager::~ChannelManager()
 {
+  StopBackgroundSync();
+  
+  m_loadCancelled = true;
+  if (m_loadThread.joinable())
+    m_loadThread.join();
 }
 
 bool ChannelManager::LoadChannels()
+{
+  StartChannelLoad();
+  return WaitForLoad();
+}
+
+void ChannelManager::StartChannelLoad()
+{
+  if (m_loadThread.joinable())
+    m_loadThread.join();
+  
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_loading = true;
+    m_loadSucceeded = false;
+  }
+  
+  m_loadThread = std::thread(&ChannelManager::PipelinedLoad, this);
+}
+
+bool ChannelManager::WaitForLoad()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_loadCondition.wait(lock, [this] { return !m_loading; });
+  return m_loadSucceeded;
+}
+
+void ChannelManager::PipelinedLoad()
 {
   Logger::Log(ADDON_LOG_INFO, "Loading channels from Jellyfin...");
   
-  std::ostringstream endpoint;
-  endpoint << "/LiveTv/Channels?userId=" << m_userId;
+  auto loadStart = std::chrono::steady_clock::now();
+  auto elapsedMs = [&loadStart]() {
+    return static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - loadStart).count());
+  };
   
-  Json::Value response;
-  if (!m_connection->SendRequest(endpoint.str(), response))
   {
-    Logger::Log(ADDON_LOG_ERROR, "Failed to load channels");
-    return false;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_channels.clear();
+    m_loadStart = loadStart;
+    m_firstChannelEmitted = false;
+    RebuildIndex();
   }
   
-  m_channels.clear();
-  m_uidToChannelId.clear();
+  std::vector<JellyfinChannelGroup> groups;
+  bool groupsLoaded = FetchChannelGroups(groups);
   
-  if (response.isMember("Items") && response["Items"].isArray())
+  ChannelRules::GroupMembers groupMembers;
+  bool ok = true;
+  
+  // Group-based rules can't be evaluated without the group list
+  if (!groupsLoaded && !m_rules.GetReferencedGroups().empty())
   {
-    const Json::Value& items = response["Items"];
-    Logger::Log(ADDON_LOG_INFO, "Processing %d channel items", items.size());
+    Logger::Log(ADDON_LOG_ERROR, "Channel groups unavailable, cannot apply channel rules");
+    ok = false;
+  }
+  else
+  {
+    ok = FetchRuleGroupMembers(groups, groupMembers);
+  }
+  
+  int pageCount = 0;
+  int excluded = 0;
+  int firstChannelMs = -1;
+  
+  if (ok)
+  {
+    m_rules.ResetStats();
     
-    for (unsigned int i = 0; i < items.size(); i++)
-    {
-      const Json::Value& item = items[i];
+    // Stage 1 (fetch) -> raw pages -> stage 2 (parse) -> channel batches ->
+    // stage 3 (catalog insert, this thread). GetChannels streams channels to
+    // Kodi as soon as they reach the catalog.
+    BoundedQueue<ChannelPage> rawPages(CHANNEL_PIPELINE_DEPTH);
+    BoundedQueue<std::vector<JellyfinChannel>> parsedPages(CHANNEL_PIPELINE_DEPTH);
+    std::atomic<bool> pagesOk(true);
+    
+    std::thread fetcher([&]() {
+      unsigned int startIndex = 0;
+      long long total = -1;
+      bool lastPage = false;
       
-      // Validate required fields
-      if (!item.isMember("Id") || !item.isMember("Name"))
+      while (!m_loadCancelled && !lastPage && (total <= 0 || startIndex < total))
       {
-        Logger::Log(ADDON_LOG_WARNING, "Channel item %d missing required fields, skipping", i);
-        continue;
+        std::ostringstream endpoint;
+        endpoint << "/LiveTv/Channels?userId=" << m_userId
+                 << "&StartIndex=" << startIndex << "&Limit=" << CHANNEL_PAGE_SIZE;
+        
+        ChannelPage page;
+        page.startIndex = startIndex;
+        if (!m_connection->SendRawRequest(endpoint.str(), page.body))
+        {
+          Logger::Log(ADDON_LOG_ERROR, "Failed to load channels (page at %u)", startIndex);
+          pagesOk = false;
+          break;
+        }
+        
+        // TotalRecordCount trails the Items array; peek at it without parsing
+        // so the parser stays on its own thread
+        if (total < 0)
+        {
+          static const std::string totalKey = "\"TotalRecordCount\":";
+          size_t pos = page.body.rfind(totalKey);
+          total = pos == std::string::npos ? 0 : std::atoll(page.body.c_str() + pos + totalKey.size());
+          if (total <= 0)
+            Logger::Log(ADDON_LOG_WARNING, "Channel count missing from the server's reply, paging until a short page");
+        }
+        
+        // Without a count the end is the first page that is not full, which
+        // takes counting its items here
+        if (total <= 0)
+        {
+          Json::Value response;
+          lastPage = !Connection::ParseJson(page.body, response) || !response.isMember("Items") ||
+                     !response["Items"].isArray() || response["Items"].size() < CHANNEL_PAGE_SIZE;
+        }
+        
+        if (!rawPages.Push(std::move(page)))
+          break;
+        
+        startIndex += CHANNEL_PAGE_SIZE;
       }
       
-      JellyfinChannel channel;
-      channel.id = item["Id"].asString();
-      channel.name = item["Name"].asString();
-      
-      // Use ChannelNumber if available, otherwise use position
-      // ChannelNumber can be a string like "1.1" or an integer
-      if (item.isMember("ChannelNumber"))
+      rawPages.Close();
+    });
+    
+    std::thread parser([&]() {
+      ChannelPage page;
+      while (rawPages.Pop(page))
       {
-        if (item["ChannelNumber"].isInt())
-        {
-          channel.number = item["ChannelNumber"].asInt();
-        }
-        else if (item["ChannelNumber"].isString())
+        Json::Value response;
+        std::vector<JellyfinChannel> channels;
+        
+        if (Connection::ParseJson(page.body, response) &&
+            response.isMember("Items") && response["Items"].isArray())
         {
-          // Try to parse string as integer (e.g., "502" -> 502)
-          try {
-            channel.number = std::stoi(item["ChannelNumber"].asString());
-          }
-          catch (...) {
-            // If parsing fails, use position
-            channel.number = i + 1;
+          const Json::Value& items = response["Items"];
+          channels.reserve(items.size());
+          
+          for (unsigned int i = 0; i < items.size(); i++)
+          {
+            JellyfinChannel channel;
+            if (ParseChannel(items[i], page.startIndex + i, groupMembers, channel, excluded))
+              channels.push_back(std::move(channel));
           }
         }
         else
         {
-          channel.number = i + 1;
+          pagesOk = false;
         }
+        
+        if (!parsedPages.Push(std::move(channels)))
+          break;
       }
-      else
-      {
-        channel.number = i + 1;
-      }
       
-      // Check channel type
-      if (item.isMember("Type"))
+      parsedPages.Close();
+    });
+    
+    std::vector<JellyfinChannel> batch;
+    while (parsedPages.Pop(batch))
+    {
+      pageCount++;
+      if (batch.empty())
+        continue;
+      
+      if (firstChannelMs < 0)
+        firstChannelMs = elapsedMs();
+      
       {
-        channel.isRadio = item["Type"].asString() == "RadioChannel";
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& channel : batch)
+        {
+          if (m_channelIdToIndex.count(channel.id))
+            continue;
+          
+          m_uidToChannelId[channel.uid] = channel.id;
+          m_uidToIndex[channel.uid] = m_channels.size();
+          m_channelIdToIndex[channel.id] = m_channels.size();
+          m_channels.push_back(std::move(channel));
+        }
       }
-      else
+      m_loadCondition.notify_all();
+    }
+    
+    fetcher.join();
+    parser.join();
+    ok = pagesOk;
+  }
+  
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    
+    if (groupsLoaded)
+      m_channelGroups = std::move(groups);
+    
+    for (auto& group : m_channelGroups)
+    {
+      group.members = ChannelBitset(m_channels.size());
+      group.membersLoaded = false;
+    }
+    
+    Logger::Log(ADDON_LOG_INFO, "Loaded %d channels in %d pages: first channel after %d ms, total %d ms",
+                static_cast<int>(m_channels.size()), pageCount, firstChannelMs, elapsedMs());
+    
+    m_loadSucceeded = ok;
+    m_loading = false;
+  }
+  m_loadCondition.notify_all();
+  
+  if (!m_rules.Empty())
+  {
+    Logger::Log(ADDON_LOG_INFO, "Channel rules excluded %d channels", excluded);
+    m_rules.LogStats();
+  }
+}
+
+bool ChannelManager::FetchGroupMemberIds(const std::string& groupId, std::unordered_set<std::string>& channelIds)
+{
+  std::ostringstream endpoint;
+  endpoint << "/LiveTv/Channels?userId=" << m_userId << "&groupId=" << groupId;
+  
+  Json::Value response;
+  if (!m_connection->SendRequest(endpoint.str(), response))
+    return false;
+  
+  if (response.isMember("Items") && response["Items"].isArray())
+  {
+    const Json::Value& items = response["Items"];
+    for (unsigned int i = 0; i < items.size(); i++)
+      channelIds.insert(items[i]["Id"].asString());
+  }
+  
+  return true;
+}
+
+bool ChannelManager::FetchRuleGroupMembers(const std::vector<JellyfinChannelGroup>& groups,
+                                           ChannelRules::GroupMembers& groupMembers)
+{
+  // Members of groups the channel rules refer to
+  for (const auto& groupName : m_rules.GetReferencedGroups())
+  {
+    auto& channelIds = groupMembers[groupName];
+    for (const auto& group : groups)
+    {
+      if (group.name == groupName && !FetchGroupMemberIds(group.id, channelIds))
       {
-        channel.isRadio = false;
+        Logger::Log(ADDON_LOG_ERROR, "Failed to load members of channel group %s for channel rules", groupName.c_str());
+        return false;
       }
+    }
+  }
+  
+  return true;
+}
+
+bool ChannelManager::ParseChannel(const Json::Value& item, unsigned int position,
+                                  const ChannelRules::GroupMembers& groupMembers,
+                                  JellyfinChannel& channel, int& excluded)
+{
+  // Validate required fields
+  if (!item.isMember("Id") || !item.isMember("Name"))
+  {
+    Logger::Log(ADDON_LOG_WARNING, "Channel item %d missing required fields, skipping", position);
+    return false;
+  }
+  
+  channel.id = item["Id"].asString();
+  channel.name = item["Name"].asString();
+  
+  if (!m_rules.Empty() && m_rules.IsExcluded(channel.id, channel.name, groupMembers))
+  {
+    excluded++;
+    return false;
+  }
+  
+  // Use ChannelNumber if available, otherwise use position
+  // ChannelNumber can be a string like "1.1" or an integer
+  if (item.isMember("ChannelNumber"))
+  {
+    if (item["ChannelNumber"].isInt())
+    {
+      channel.number = item["ChannelNumber"].asInt();
+    }
+    else if (item["ChannelNumber"].isString())
+    {
+      // Try to parse string as integer (e.g., "502" -> 502)
+      try {
+        channel.number = std::stoi(item["ChannelNumber"].asString());
+      }
+      catch (...) {
+        // If parsing fails, use position
+        channel.number = position + 1;
+      }
+    }
+    else
+    {
+      channel.number = position + 1;
+    }
+  }
+  else
+  {
+    channel.number = position + 1;
+  }
+  
+  // Check channel type
+  if (item.isMember("Type"))
+  {
+    channel.isRadio = item["Type"].asString() == "RadioChannel";
+  }
+  else
+  {
+    channel.isRadio = false;
+  }
+  
+  if (item.isMember("ImageTags") && item["ImageTags"].isMember("Primary"))
+  {
+    channel.imageTag = item["ImageTags"]["Primary"].asString();
+  }
+  
+  if (!m_rules.Empty())
+    m_rules.Remap(channel.id, channel.name, channel.number, groupMembers);
+  
+  // Create UID from hash of channel ID
+  std::hash<std::string> hasher;
+  channel.uid = static_cast<int>(hasher(channel.id) & 0x7FFFFFFF);
+  channel.contentHash = HashChannelContent(channel);
+  
+  Logger::Log(ADDON_LOG_DEBUG, "Loaded channel: %s (ID: %s, Number: %d, UID: %d)", 
+              channel.name.c_str(), channel.id.c_str(), channel.number, channel.uid);
+  return true;
+}
+
+bool ChannelManager::FetchChannels(std::vector<JellyfinChannel>& channels,
+                                   const std::vector<JellyfinChannelGroup>& groups)
+{
+  ChannelRules::GroupMembers groupMembers;
+  if (!FetchRuleGroupMembers(groups, groupMembers))
+    return false;
+  
+  m_rules.ResetStats();
+  int excluded = 0;
+  
+  // Paged like the initial load, so a large lineup is never one huge reply
+  unsigned int startIndex = 0;
+  long long total = -1;
+  bool lastPage = false;
+  int pageCount = 0;
+  
+  while (!m_loadCancelled && !lastPage && (total <= 0 || startIndex < total))
+  {
+    std::ostringstream endpoint;
+    endpoint << "/LiveTv/Channels?userId=" << m_userId
+             << "&StartIndex=" << startIndex << "&Limit=" << CHANNEL_PAGE_SIZE;
+    
+    Json::Value response;
+    if (!m_connection->SendRequest(endpoint.str(), response))
+    {
+      Logger::Log(ADDON_LOG_ERROR, "Failed to load channels (page at %u)", startIndex);
+      return false;
+    }
+    
+    if (total < 0)
+    {
+      total = response.get("TotalRecordCount", 0).asInt64();
+      if (total <= 0)
+        Logger::Log(ADDON_LOG_WARNING, "Channel count missing from the server's reply, paging until a short page");
+    }
+    
+    unsigned int itemCount = 0;
+    if (response.isMember("Items") && response["Items"].isArray())
+    {
+      const Json::Value& items = response["Items"];
+      itemCount = items.size();
       
-      if (item.isMember("ImageTags") && item["ImageTags"].isMember("Primary"))
+      for (unsigned int i = 0; i < items.size(); i++)
       {
-        channel.imageUrl = m_connection->GetServerUrl() + "/Items/" + channel.id + "/Images/Primary";
+        JellyfinChannel channel;
+        if (ParseChannel(items[i], startIndex + i, groupMembers, channel, excluded))
+          channels.push_back(std::move(channel));
       }
-      
-      m_channels.push_back(channel);
-      
-      // Create UID from hash of channel ID
-      std::hash<std::string> hasher;
-      int uid = static_cast<int>(hasher(channel.id) & 0x7FFFFFFF);
-      m_uidToChannelId[uid] = channel.id;
-      
-      Logger::Log(ADDON_LOG_DEBUG, "Loaded channel: %s (ID: %s, Number: %d, UID: %d)", 
-                  channel.name.c_str(), channel.id.c_str(), channel.number, uid);
     }
+    
+    // Without a count the end is the first page that is not full; an empty
+    // page ends it either way
+    lastPage = itemCount == 0 || (total <= 0 && itemCount < CHANNEL_PAGE_SIZE);
+    startIndex += CHANNEL_PAGE_SIZE;
+    pageCount++;
   }
   
-  Logger::Log(ADDON_LOG_INFO, "Loaded %d channels", static_cast<int>(m_channels.size()));
+  // Stopped half way, the lineup would look like it lost channels
+  if (!lastPage && (total <= 0 || startIndex < total))
+    return false;
+  
+  Logger::Log(ADDON_LOG_INFO, "Loaded %d channels in %d pages", static_cast<int>(channels.size()), pageCount);
+  
+  if (!m_rules.Empty())
+  {
+    Logger::Log(ADDON_LOG_INFO, "Channel rules excluded %d channels", excluded);
+    m_rules.LogStats();
+  }
   
-  // Load channel groups
-  endpoint.str("");
+  return true;
+}
+
+bool ChannelManager::FetchChannelGroups(std::vector<JellyfinChannelGroup>& groups)
+{
+  std::ostringstream endpoint;
   endpoint << "/LiveTv/ChannelGroups?userId=" << m_userId;
   
+  Json::Value response;
   if (m_connection->SendRequest(endpoint.str(), response))
   {
-    m_channelGroups.clear();
-    
     if (response.isMember("Items") && response["Items"].isArray())
     {
       const Json::Value& items = response["Items"];
@@ -132,41 +485,288 @@ bool ChannelManager::LoadChannels()
         group.id = item["Id"].asString();
         group.name = item["Name"].asString();
         
-        m_channelGroups.push_back(group);
+        groups.push_back(group);
       }
     }
     
-    Logger::Log(ADDON_LOG_INFO, "Loaded %d channel groups", static_cast<int>(m_channelGroups.size()));
+    Logger::Log(ADDON_LOG_INFO, "Loaded %d channel groups", static_cast<int>(groups.size()));
+    return true;
   }
   
-  return true;
+  return false;
 }
 
-PVR_ERROR ChannelManager::GetChannels(kodi::addon::PVRChannelsResultSet& results)
+void ChannelManager::RebuildIndex()
 {
-  for (const auto& channel : m_channels)
+  m_uidToChannelId.clear();
+  m_uidToIndex.clear();
+  m_channelIdToIndex.clear();
+  
+  for (size_t i = 0; i < m_channels.size(); i++)
   {
-    kodi::addon::PVRChannel kodiChannel;
+    m_uidToChannelId[m_channels[i].uid] = m_channels[i].id;
+    m_uidToIndex[m_channels[i].uid] = i;
+    m_channelIdToIndex[m_channels[i].id] = i;
+  }
+}
+
+bool ChannelManager::SyncChannels()
+{
+  std::vector<JellyfinChannelGroup> groups;
+  bool groupsLoaded = FetchChannelGroups(groups);
+  
+  // Group-based rules can't be evaluated without the group list
+  if (!groupsLoaded && !m_rules.GetReferencedGroups().empty())
+  {
+    Logger::Log(ADDON_LOG_ERROR, "Channel groups unavailable, cannot apply channel rules");
+    return false;
+  }
+  
+  std::vector<JellyfinChannel> channels;
+  if (!FetchChannels(channels, groups))
+    return false;
+  
+  // Members of the groups Kodi has asked for are fetched again, since a
+  // channel can join or leave a group without anything else changing
+  std::vector<std::pair<std::string, std::string>> loadedGroups;   // Name, ID
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& group : m_channelGroups)
+    {
+      if (group.membersLoaded)
+        loadedGroups.emplace_back(group.name, group.id);
+    }
+  }
+  
+  std::map<std::string, std::unordered_set<std::string>> groupMemberIds;
+  for (const auto& group : loadedGroups)
+  {
+    if (!FetchGroupMemberIds(group.second, groupMemberIds[group.first]))
+      groupMemberIds.erase(group.first);
+  }
+  
+  int added = 0;
+  int updated = 0;
+  int removed = 0;
+  bool membershipChanged = false;
+  bool groupsChanged = false;
+  int groupMembersChanged = 0;
+  
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    
+    for (const auto& channel : channels)
+    {
+      auto it = m_channelIdToIndex.find(channel.id);
+      if (it == m_channelIdToIndex.end())
+        added++;
+      else if (m_channels[it->second].contentHash != channel.contentHash)
+        updated++;
+    }
+    removed = static_cast<int>(m_channels.size() + added) - static_cast<int>(channels.size());
+    
+    // Indices are positions in the lineup, so any reordering invalidates
+    // the group member bitsets even when no channel was added or removed
+    membershipChanged = channels.size() != m_channels.size();
+    for (size_t i = 0; !membershipChanged && i < channels.size(); i++)
+      membershipChanged = channels[i].id != m_channels[i].id;
     
-    // Find UID for this channel
-    int uid = 0;
-    for (const auto& pair : m_uidToChannelId)
+    if (groupsLoaded)
     {
-      if (pair.second == channel.id)
+      groupsChanged = groups.size() != m_channelGroups.size();
+      for (size_t i = 0; !groupsChanged && i < groups.size(); i++)
       {
-        uid = pair.first;
-        break;
+        groupsChanged = groups[i].id != m_channelGroups[i].id ||
+                        groups[i].name != m_channelGroups[i].name;
+      }
+    }
+    
+    // Only meaningful while the lineup and groups stay as they are;
+    // otherwise every group's members are reloaded anyway
+    if (!membershipChanged && !groupsChanged)
+    {
+      for (auto& group : m_channelGroups)
+      {
+        auto ids = groupMemberIds.find(group.name);
+        if (!group.membersLoaded || ids == groupMemberIds.end())
+          continue;
+        
+        ChannelBitset members = MembersFromIds(ids->second);
+        if (members != group.members)
+        {
+          group.members = std::move(members);
+          groupMembersChanged++;
+        }
       }
     }
     
-    kodiChannel.SetUniqueId(uid);
-    kodiChannel.SetIsRadio(channel.isRadio);
-    kodiChannel.SetChannelNumber(channel.number);
-    kodiChannel.SetChannelName(channel.name);
-    kodiChannel.SetIconPath(channel.imageUrl);
-    kodiChannel.SetIsHidden(false);
+    if (added == 0 && updated == 0 && removed == 0 && !membershipChanged && !groupsChanged &&
+        groupMembersChanged == 0)
+    {
+      Logger::Log(ADDON_LOG_DEBUG, "Channel sync: lineup unchanged (%d channels)",
+                  static_cast<int>(m_channels.size()));
+      return false;
+    }
+    
+    if (membershipChanged)
+    {
+      m_channels = std::move(channels);
+      RebuildIndex();
+    }
+    else
+    {
+      for (size_t i = 0; i < channels.size(); i++)
+      {
+        if (m_channels[i].contentHash != channels[i].contentHash)
+          m_channels[i] = std::move(channels[i]);
+      }
+    }
+    
+    if (groupsChanged)
+      m_channelGroups = std::move(groups);
+    
+    if (groupsChanged || membershipChanged)
+    {
+      for (auto& group : m_channelGroups)
+      {
+        group.members = ChannelBitset(m_channels.size());
+        group.membersLoaded = false;
+      }
+    }
+  }
+  
+  Logger::Log(ADDON_LOG_INFO, "Channel sync: %d added, %d updated, %d removed%s, members of %d group(s) changed",
+              added, updated, removed, groupsChanged ? ", groups changed" : "", groupMembersChanged);
+  
+  if (m_instance)
+  {
+    if (added || updated || removed || membershipChanged)
+      m_instance->TriggerChannelUpdate();
+    if (groupsChanged || membershipChanged || groupMembersChanged > 0)
+      m_instance->TriggerChannelGroupsUpdate();
+  }
+  
+  return true;
+}
+
+void ChannelManager::StartBackgroundSync(int intervalMinutes)
+{
+  StopBackgroundSync();
+  
+  if (intervalMinutes <= 0)
+    return;
+  
+  m_syncRunning = true;
+  m_syncThread = std::thread(&ChannelManager::SyncLoop, this, intervalMinutes);
+  Logger::Log(ADDON_LOG_INFO, "Channel sync every %d minutes", intervalMinutes);
+}
+
+void ChannelManager::StopBackgroundSync()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_syncMutex);
+    m_syncRunning = false;
+  }
+  m_syncCondition.notify_all();
+  
+  if (m_syncThread.joinable())
+    m_syncThread.join();
+}
+
+void ChannelManager::SyncLoop(int intervalMinutes)
+{
+  WaitForLoad();
+  
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(m_syncMutex);
+      m_syncCondition.wait_for(lock, std::chrono::minutes(intervalMinutes),
+                               [this] { return !m_syncRunning; });
+      if (!m_syncRunning)
+        break;
+    }
+    
+    SyncChannels();
+  }
+}
+
+int ChannelManager::GetChannelCount() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return static_cast<int>(m_channels.size());
+}
+
+size_t ChannelManager::GetMemoryUsage() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  
+  size_t bytes = m_channels.capacity() * sizeof(JellyfinChannel) +
+                 m_channelGroups.capacity() * sizeof(JellyfinChannelGroup);
+  for (const auto& channel : m_channels)
+    bytes += channel.id.capacity() + channel.name.capacity() + channel.imageTag.capacity();
+  for (const auto& group : m_channelGroups)
+    bytes += group.id.capacity() + group.name.capacity() + group.members.MemoryUsage();
+  
+  bytes += m_uidToChannelId.size() * (MAP_NODE_BYTES + sizeof(std::pair<int, std::string>));
+  for (const auto& uid : m_uidToChannelId)
+    bytes += uid.second.capacity();
+  bytes += m_uidToIndex.size() * (MAP_NODE_BYTES + sizeof(std::pair<int, size_t>));
+  bytes += m_channelIdToIndex.size() * (MAP_NODE_BYTES + sizeof(std::pair<std::string, size_t>));
+  for (const auto& channelId : m_channelIdToIndex)
+    bytes += channelId.first.capacity();
+  return bytes;
+}
+
+int ChannelManager::GetChannelGroupCount() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return static_cast<int>(m_channelGroups.size());
+}
+
+PVR_ERROR ChannelManager::GetChannels(kodi::addon::PVRChannelsResultSet& results)
+{
+  // While the pipelined load is running, hand channels to Kodi batch by
+  // batch as they reach the catalog instead of waiting for the whole lineup
+  std::unique_lock<std::mutex> lock(m_mutex);
+  size_t emitted = 0;
+  
+  while (true)
+  {
+    std::vector<JellyfinChannel> batch(m_channels.begin() + emitted, m_channels.end());
+    emitted = m_channels.size();
+    bool done = !m_loading;
+    
+    if (!batch.empty() && !m_firstChannelEmitted && !done)
+    {
+      m_firstChannelEmitted = true;
+      Logger::Log(ADDON_LOG_INFO, "First channel handed to Kodi %d ms after load start",
+                  static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - m_loadStart).count()));
+    }
     
-    results.Add(kodiChannel);
+    lock.unlock();
+    
+    for (const auto& channel : batch)
+    {
+      kodi::addon::PVRChannel kodiChannel;
+      
+      kodiChannel.SetUniqueId(channel.uid);
+      kodiChannel.SetIsRadio(channel.isRadio);
+      kodiChannel.SetChannelNumber(channel.number);
+      kodiChannel.SetChannelName(channel.name);
+      if (m_artwork)
+        kodiChannel.SetIconPath(m_artwork->GetImagePath(channel.id, channel.imageTag, ArtworkKind::ChannelLogo));
+      kodiChannel.SetIsHidden(false);
+      
+      results.Add(kodiChannel);
+    }
+    
+    if (done)
+      break;
+    
+    lock.lock();
+    m_loadCondition.wait(lock, [this, emitted] { return !m_loading || m_channels.size() > emitted; });
   }
   
   return PVR_ERROR_NO_ERROR;
@@ -174,11 +774,12 @@ PVR_ERROR ChannelManager::GetChannels(kodi::addon::PVRChannelsResultSet& results
 
 PVR_ERROR ChannelManager::GetChannelGroups(kodi::addon::PVRChannelGroupsResultSet& results)
 {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  
   for (const auto& group : m_channelGroups)
   {
     kodi::addon::PVRChannelGroup kodiGroup;
     
-    std::hash<std::string> hasher;
     kodiGroup.SetGroupName(group.name);
     kodiGroup.SetIsRadio(false);
     kodiGroup.SetPosition(0);
@@ -189,64 +790,100 @@ PVR_ERROR ChannelManager::GetChannelGroups(kodi::addon::PVRChannelGroupsResultSe
   return PVR_ERROR_NO_ERROR;
 }
 
-PVR_ERROR ChannelManager::GetChannelGroupMembers(const kodi::addon::PVRChannelGroup& group,
-                                                  kodi::addon::PVRChannelGroupMembersResultSet& results)
+JellyfinChannelGroup* ChannelManager::FindGroup(const std::string& groupName)
 {
-  // Find the group
-  std::string groupName = group.GetGroupName();
-  JellyfinChannelGroup* jellyfinGroup = nullptr;
-  
   for (auto& g : m_channelGroups)
   {
     if (g.name == groupName)
-    {
-      jellyfinGroup = &g;
-      break;
-    }
+      return &g;
+  }
+  return nullptr;
+}
+
+ChannelBitset ChannelManager::MembersFromIds(const std::unordered_set<std::string>& channelIds) const
+{
+  ChannelBitset members(m_channels.size());
+  for (const auto& channelId : channelIds)
+  {
+    auto it = m_channelIdToIndex.find(channelId);
+    if (it != m_channelIdToIndex.end())
+      members.Set(it->second);
+  }
+  return members;
+}
+
+bool ChannelManager::LoadGroupMembers(const std::string& groupName)
+{
+  std::string groupId;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    JellyfinChannelGroup* group = FindGroup(groupName);
+    if (!group)
+      return false;
+    if (group->membersLoaded)
+      return true;
+    groupId = group->id;
+  }
+  
+  // Fetched without m_mutex, so lookups and the EPG are not held up
+  std::unordered_set<std::string> channelIds;
+  if (!FetchGroupMemberIds(groupId, channelIds))
+  {
+    Logger::Log(ADDON_LOG_ERROR, "Failed to load members for channel group: %s", groupName.c_str());
+    return false;
   }
   
+  std::lock_guard<std::mutex> lock(m_mutex);
+  
+  // A sync may have replaced the groups or the lineup meanwhile; the IDs
+  // are mapped onto whatever lineup is current
+  JellyfinChannelGroup* group = FindGroup(groupName);
+  if (!group || group->id != groupId)
+    return false;
+  if (group->membersLoaded)
+    return true;
+  
+  group->members = MembersFromIds(channelIds);
+  group->membersLoaded = true;
+  
+  Logger::Log(ADDON_LOG_DEBUG, "Loaded %d members for channel group %s (%d bytes)",
+              static_cast<int>(group->members.Count()), group->name.c_str(),
+              static_cast<int>(group->members.MemoryUsage()));
+  return true;
+}
+
+PVR_ERROR ChannelManager::GetChannelGroupMembers(const kodi::addon::PVRChannelGroup& group,
+                                                  kodi::addon::PVRChannelGroupMembersResultSet& results)
+{
+  std::string groupName = group.GetGroupName();
+  LoadGroupMembers(groupName);
+  
+  std::lock_guard<std::mutex> lock(m_mutex);
+  JellyfinChannelGroup* jellyfinGroup = FindGroup(groupName);
+  
   if (!jellyfinGroup)
     return PVR_ERROR_NO_ERROR;
   
-  // If we haven't loaded the members yet, load them
-  if (jellyfinGroup->channelIds.empty())
+  // Kodi asks for members of groups it is about to show, so warm their logos
+  if (m_artwork)
   {
-    std::ostringstream endpoint;
-    endpoint << "/LiveTv/Channels?userId=" << m_userId << "&groupId=" << jellyfinGroup->id;
-    
-    Json::Value response;
-    if (m_connection->SendRequest(endpoint.str(), response))
-    {
-      if (response.isMember("Items") && response["Items"].isArray())
-      {
-        const Json::Value& items = response["Items"];
-        for (unsigned int i = 0; i < items.size(); i++)
-        {
-          jellyfinGroup->channelIds.push_back(items[i]["Id"].asString());
-        }
-      }
-    }
+    std::vector<ArtworkRequest> logos;
+    jellyfinGroup->members.ForEach([&](size_t index) {
+      logos.push_back({m_channels[index].id, m_channels[index].imageTag, ArtworkKind::ChannelLogo});
+    });
+    m_artwork->Prefetch(logos);
   }
   
-  // Add members
+  // Add members in lineup order
   int order = 0;
-  for (const auto& channelId : jellyfinGroup->channelIds)
-  {
-    // Find the channel UID
-    for (const auto& pair : m_uidToChannelId)
-    {
-      if (pair.second == channelId)
-      {
-        kodi::addon::PVRChannelGroupMember member;
-        member.SetGroupName(groupName);
-        member.SetChannelUniqueId(pair.first);
-        member.SetChannelNumber(++order);
-        
-        results.Add(member);
-        break;
-      }
-    }
-  }
+  jellyfinGroup->members.ForEach([&](size_t index) {
+    kodi::addon::PVRChannelGroupMember member;
+    member.SetGroupName(groupName);
+    member.SetChannelUniqueId(m_channels[index].uid);
+    member.SetChannelNumber(++order);
+    
+    results.Add(member);
+  });
   
   return PVR_ERROR_NO_ERROR;
 }
@@ -407,8 +1044,24 @@ PVR_ERROR ChannelManager::GetChannelStreamProperties(const kodi::addon::PVRChann
 
 std::string ChannelManager::GetChannelIdFromUid(int uid) const
 {
+  std::lock_guard<std::mutex> lock(m_mutex);
   auto it = m_uidToChannelId.find(uid);
   if (it != m_uidToChannelId.end())
     return it->second;
   return "";
 }
+
+bool ChannelManager::HasChannel(const std::string& channelId) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_channelIdToIndex.count(channelId) > 0;
+}
+
+int ChannelManager::GetChannelUid(const std::string& channelId) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_channelIdToIndex.find(channelId);
+  if (it != m_channelIdToIndex.end())
+    return m_channels[it->second].uid;
+  return -1;
+}
@@ -3,37 +3,59 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <json/json.h>
 #include <kodi/addon-instance/PVR.h>
+#include "../utilities/ChannelBitset.h"
+#include "ChannelRules.h"
+#include <chrono>
 
 class Connection;
+class ArtworkManager;
 
 struct JellyfinChannel
 {
   std::string id;
   std::string name;
+  int uid;
   int number;
-  std::string imageUrl;
+  std::string imageTag;
   bool isRadio;
+  size_t contentHash;   // Hash of the fields Kodi sees, used to diff lineups
 };
 
 struct JellyfinChannelGroup
 {
   std::string id;
   std::string name;
-  std::vector<std::string> channelIds;
+  ChannelBitset members;      // Indexed by position in ChannelManager::m_channels
+  bool membersLoaded = false;
 };
 
 class ChannelManager
 {
 public:
-  ChannelManager(Connection* connection, const std::string& userId);
-  ~ChannelManager() = default;
+  ChannelManager(Connection* connection, const std::string& userId,
+                 kodi::addon::CInstancePVRClient* instance, ArtworkManager* artwork);
+  ~ChannelManager();
 
+  // Blocking load of the full lineup
   bool LoadChannels();
-  int GetChannelCount() const { return m_channels.size(); }
+  
+  // Start a pipelined load (paged fetch, parse and catalog insert on
+  // separate threads). GetChannels streams channels while it is running.
+  void StartChannelLoad();
+  bool WaitForLoad();
+  
+  int GetChannelCount() const;
   PVR_ERROR GetChannels(kodi::addon::PVRChannelsResultSet& results);
   
-  int GetChannelGroupCount() const { return m_channelGroups.size(); }
+  int GetChannelGroupCount() const;
   PVR_ERROR GetChannelGroups(kodi::addon::PVRChannelGroupsResultSet& results);
   PVR_ERROR GetChannelGroupMembers(const kodi::addon::PVRChannelGroup& group,
                                    kodi::addon::PVRChannelGroupMembersResultSet& results);
@@ -42,11 +64,68 @@ public:
                                       std::vector<kodi::addon::PVRStreamProperty>& properties);
   
   std::string GetChannelIdFromUid(int uid) const;
+  bool HasChannel(const std::string& channelId) const;
+  int GetChannelUid(const std::string& channelId) const;   // -1 if not in the lineup
+  
+  // Re-fetch the lineup, apply only the differences and notify Kodi if
+  // anything changed. Returns true if channels or groups were updated.
+  bool SyncChannels();
+  
+  // Periodic background SyncChannels, interval in minutes (0 disables)
+  void StartBackgroundSync(int intervalMinutes);
+  void StopBackgroundSync();
+  
+  // Approximate memory held by the lineup and its lookup tables
+  size_t GetMemoryUsage() const;
 
 private:
   Connection* m_connection;
   std::string m_userId;
+  kodi::addon::CInstancePVRClient* m_instance;
+  ArtworkManager* m_artwork;
+  
+  mutable std::mutex m_mutex;
   std::vector<JellyfinChannel> m_channels;
   std::vector<JellyfinChannelGroup> m_channelGroups;
   std::map<int, std::string> m_uidToChannelId;
+  std::unordered_map<int, size_t> m_uidToIndex;
+  std::unordered_map<std::string, size_t> m_channelIdToIndex;
+  
+  ChannelRules m_rules;
+  
+  struct ChannelPage
+  {
+    unsigned int startIndex = 0;
+    std::string body;
+  };
+  
+  std::thread m_loadThread;
+  std::condition_variable m_loadCondition;   // Guarded by m_mutex
+  bool m_loading;
+  bool m_loadSucceeded;
+  bool m_firstChannelEmitted;
+  std::chrono::steady_clock::time_point m_loadStart;
+  std::atomic<bool> m_loadCancelled;
+  
+  std::thread m_syncThread;
+  std::atomic<bool> m_syncRunning;
+  std::mutex m_syncMutex;
+  std::condition_variable m_syncCondition;
+  
+  bool FetchChannels(std::vector<JellyfinChannel>& channels, const std::vector<JellyfinChannelGroup>& groups);
+  void PipelinedLoad();
+  bool ParseChannel(const Json::Value& item, unsigned int position,
+                    const ChannelRules::GroupMembers& groupMembers,
+                    JellyfinChannel& channel, int& excluded);
+  bool FetchRuleGroupMembers(const std::vector<JellyfinChannelGroup>& groups,
+                             ChannelRules::GroupMembers& groupMembers);
+  bool FetchGroupMemberIds(const std::string& groupId, std::unordered_set<std::string>& channelIds);
+  bool FetchChannelGroups(std::vector<JellyfinChannelGroup>& groups);
+  void RebuildIndex();
+  JellyfinChannelGroup* FindGroup(const std::string& groupName);
+  ChannelBitset MembersFromIds(const std::unordered_set<std::string>& channelIds) const;   // With m_mutex held
+  
+  // Takes m_mutex itself, but not across the request
+  bool LoadGroupMembers(const std::string& groupName);
+  void SyncLoop(int intervalMinutes);
 };
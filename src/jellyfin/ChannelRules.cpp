@@ -0,0 +1,208 @@
+#include "ChannelRules.h"
+#include "../utilities/Logger.h"
+#include <kodi/Filesystem.h>
+#include <json/json.h>
+#include <sstream>
+
+bool ChannelRules::Load(const std::string& path)
+{
+  m_rules.clear();
+  m_referencedGroups.clear();
+  m_hasIncludeRules = false;
+  
+  kodi::vfs::CFile file;
+  if (!kodi::vfs::FileExists(path) || !file.OpenFile(path))
+    return false;
+  
+  std::string content;
+  char buffer[4096];
+  ssize_t bytesRead;
+  while ((bytesRead = file.Read(buffer, sizeof(buffer))) > 0)
+    content.append(buffer, bytesRead);
+  file.Close();
+  
+  Json::Value rules;
+  Json::CharReaderBuilder builder;
+  std::string errors;
+  std::istringstream stream(content);
+  if (!Json::parseFromStream(builder, stream, &rules, &errors) || !rules.isArray())
+  {
+    Logger::Log(ADDON_LOG_ERROR, "Failed to parse channel rules %s: %s", path.c_str(), errors.c_str());
+    return false;
+  }
+  
+  for (unsigned int i = 0; i < rules.size(); i++)
+  {
+    const Json::Value& item = rules[i];
+    std::string action = item.get("Action", "").asString();
+    
+    Rule rule;
+    if (action == "include")
+      rule.action = Action::Include;
+    else if (action == "exclude")
+      rule.action = Action::Exclude;
+    else if (action == "rename")
+      rule.action = Action::Rename;
+    else if (action == "renumber")
+      rule.action = Action::Renumber;
+    else
+    {
+      Logger::Log(ADDON_LOG_WARNING, "Channel rule %d has unknown action '%s', skipping", i, action.c_str());
+      continue;
+    }
+    
+    std::ostringstream description;
+    description << action;
+    
+    if (item.isMember("NamePattern"))
+    {
+      std::string pattern = item["NamePattern"].asString();
+      try
+      {
+        rule.pattern = std::regex(pattern, std::regex::ECMAScript | std::regex::icase | std::regex::optimize);
+        rule.hasPattern = true;
+      }
+      catch (const std::regex_error& e)
+      {
+        Logger::Log(ADDON_LOG_WARNING, "Channel rule %d has invalid pattern '%s': %s, skipping",
+                    i, pattern.c_str(), e.what());
+        continue;
+      }
+      description << " name~/" << pattern << "/";
+    }
+    
+    if (item.isMember("Group"))
+    {
+      rule.group = item["Group"].asString();
+      description << " group=" << rule.group;
+    }
+    
+    if (!rule.hasPattern && rule.group.empty())
+    {
+      Logger::Log(ADDON_LOG_WARNING, "Channel rule %d needs a NamePattern or Group, skipping", i);
+      continue;
+    }
+    
+    if (rule.action == Action::Rename)
+    {
+      if (!rule.hasPattern || !item.isMember("Replace"))
+      {
+        Logger::Log(ADDON_LOG_WARNING, "Channel rule %d: rename needs NamePattern and Replace, skipping", i);
+        continue;
+      }
+      rule.replace = item["Replace"].asString();
+    }
+    else if (rule.action == Action::Renumber)
+    {
+      if (item.isMember("Number"))
+      {
+        rule.number = item["Number"].asInt();
+        rule.hasNumber = true;
+      }
+      else if (item.isMember("Offset"))
+      {
+        rule.offset = item["Offset"].asInt();
+      }
+      else
+      {
+        Logger::Log(ADDON_LOG_WARNING, "Channel rule %d: renumber needs Number or Offset, skipping", i);
+        continue;
+      }
+    }
+    else if (rule.action == Action::Include)
+    {
+      m_hasIncludeRules = true;
+    }
+    
+    if (!rule.group.empty())
+      m_referencedGroups.insert(rule.group);
+    
+    rule.description = description.str();
+    m_rules.push_back(std::move(rule));
+  }
+  
+  Logger::Log(ADDON_LOG_INFO, "Loaded %d channel rules from %s", static_cast<int>(m_rules.size()), path.c_str());
+  return true;
+}
+
+void ChannelRules::ResetStats()
+{
+  for (auto& rule : m_rules)
+    rule.matches = 0;
+}
+
+bool ChannelRules::Matches(const Rule& rule, const std::string& channelId, const std::string& name,
+                           const GroupMembers& groupMembers)
+{
+  if (!rule.group.empty())
+  {
+    auto it = groupMembers.find(rule.group);
+    if (it == groupMembers.end() || !it->second.count(channelId))
+      return false;
+  }
+  
+  if (rule.hasPattern && !std::regex_search(name, rule.pattern))
+    return false;
+  
+  return true;
+}
+
+bool ChannelRules::IsExcluded(const std::string& channelId, const std::string& name,
+                              const GroupMembers& groupMembers)
+{
+  bool included = !m_hasIncludeRules;
+  
+  for (auto& rule : m_rules)
+  {
+    if (rule.action == Action::Include && !included && Matches(rule, channelId, name, groupMembers))
+    {
+      rule.matches++;
+      included = true;
+    }
+  }
+  
+  if (!included)
+    return true;
+  
+  for (auto& rule : m_rules)
+  {
+    if (rule.action == Action::Exclude && Matches(rule, channelId, name, groupMembers))
+    {
+      rule.matches++;
+      return true;
+    }
+  }
+  
+  return false;
+}
+
+void ChannelRules::Remap(const std::string& channelId, std::string& name, int& number,
+                         const GroupMembers& groupMembers)
+{
+  for (auto& rule : m_rules)
+  {
+    if (rule.action != Action::Rename && rule.action != Action::Renumber)
+      continue;
+    
+    if (!Matches(rule, channelId, name, groupMembers))
+      continue;
+    
+    rule.matches++;
+    
+    if (rule.action == Action::Rename)
+      name = std::regex_replace(name, rule.pattern, rule.replace);
+    else if (rule.hasNumber)
+      number = rule.number;
+    else
+      number += rule.offset;
+  }
+}
+
+void ChannelRules::LogStats() const
+{
+  for (size_t i = 0; i < m_rules.size(); i++)
+  {
+    Logger::Log(ADDON_LOG_INFO, "Channel rule %d (%s): %d matches",
+                static_cast<int>(i), m_rules[i].description.c_str(), m_rules[i].matches);
+  }
+}
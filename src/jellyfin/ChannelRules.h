@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <set>
+#include <regex>
+#include <unordered_map>
+#include <unordered_set>
+
+// Channel filter/remap rules applied while the lineup is loaded.
+//
+// Rules are read once from channel_rules.json in addon userdata, e.g.
+//   [ { "Action": "include", "Group": "Favourites" },
+//     { "Action": "exclude", "NamePattern": "^(XXX|Adult)" },
+//     { "Action": "rename",  "NamePattern": "^UK: (.*)", "Replace": "$1" },
+//     { "Action": "renumber", "NamePattern": "^BBC One", "Number": 1 } ]
+//
+// If any include rule exists a channel must match one of them; exclude rules
+// then drop channels, and rename/renumber rules are applied in file order to
+// whatever is left. Name patterns are case-insensitive regular expressions.
+class ChannelRules
+{
+public:
+  using GroupMembers = std::unordered_map<std::string, std::unordered_set<std::string>>;
+
+  ChannelRules() = default;
+
+  bool Load(const std::string& path);
+  bool Empty() const { return m_rules.empty(); }
+  
+  // Group names referenced by rules; their members must be supplied to
+  // IsExcluded and Remap
+  const std::set<std::string>& GetReferencedGroups() const { return m_referencedGroups; }
+  
+  void ResetStats();
+  bool IsExcluded(const std::string& channelId, const std::string& name, const GroupMembers& groupMembers);
+  void Remap(const std::string& channelId, std::string& name, int& number, const GroupMembers& groupMembers);
+  void LogStats() const;
+
+private:
+  enum class Action
+  {
+    Include,
+    Exclude,
+    Rename,
+    Renumber
+  };
+
+  struct Rule
+  {
+    Action action;
+    std::string description;
+    bool hasPattern = false;
+    std::regex pattern;
+    std::string group;
+    std::string replace;
+    int number = 0;
+    int offset = 0;
+    bool hasNumber = false;
+    int matches = 0;
+  };
+
+  std::vector<Rule> m_rules;
+  std::set<std::string> m_referencedGroups;
+  bool m_hasIncludeRules = false;
+
+  static bool Matches(const Rule& rule, const std::string& channelId, const std::string& name,
+                      const GroupMembers& groupMembers);
+};
@@ -0,0 +1,428 @@
+#include "ChannelSchedule.h"
+#include "../utilities/Compression.h"
+#include "../utilities/StringArena.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace
+{
+
+const time_t SECONDS_PER_DAY = 24 * 3600;
+
+// Decompressed description blocks kept around; Kodi reads a few channels'
+// worth of days at a time
+const size_t PLOT_CACHE_BLOCKS = 64;
+
+// LRU of decompressed description blocks, keyed by block ID. Blocks of
+// schedules that have been replaced simply age out.
+class PlotCache
+{
+public:
+  std::shared_ptr<const std::string> Find(uint64_t id)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_index.find(id);
+    if (it == m_index.end())
+    {
+      m_misses++;
+      return nullptr;
+    }
+    
+    m_hits++;
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+    return it->second->second;
+  }
+  
+  void Insert(uint64_t id, std::shared_ptr<const std::string> block, uint64_t decompressMicros)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_decompressMicros += decompressMicros;
+    
+    if (m_index.count(id))
+      return;
+    
+    m_bytes += block->capacity();
+    m_lru.emplace_front(id, std::move(block));
+    m_index[id] = m_lru.begin();
+    
+    while (m_lru.size() > PLOT_CACHE_BLOCKS)
+    {
+      m_bytes -= m_lru.back().second->capacity();
+      m_index.erase(m_lru.back().first);
+      m_lru.pop_back();
+    }
+  }
+  
+  size_t GetBytes()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_bytes;
+  }
+  
+  void Clear()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_lru.clear();
+    m_index.clear();
+    m_bytes = 0;
+  }
+  
+  void GetStats(uint64_t& hits, uint64_t& misses, uint64_t& decompressMicros)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    hits = m_hits;
+    misses = m_misses;
+    decompressMicros = m_decompressMicros;
+  }
+
+private:
+  using Entry = std::pair<uint64_t, std::shared_ptr<const std::string>>;
+  
+  std::mutex m_mutex;
+  std::list<Entry> m_lru;
+  std::unordered_map<uint64_t, std::list<Entry>::iterator> m_index;
+  size_t m_bytes = 0;
+  uint64_t m_hits = 0;
+  uint64_t m_misses = 0;
+  uint64_t m_decompressMicros = 0;
+};
+
+PlotCache& GetPlotCache()
+{
+  static PlotCache cache;
+  return cache;
+}
+
+std::atomic<uint64_t> g_nextPlotBlockId(1);
+
+time_t DayOf(time_t time)
+{
+  time_t day = time / SECONDS_PER_DAY;
+  if (time % SECONDS_PER_DAY < 0)
+    day--;
+  return day;
+}
+
+void HashCombine(uint64_t& seed, uint64_t value)
+{
+  seed ^= value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2);
+}
+
+uint64_t HashEntry(const EPGEntry& entry)
+{
+  std::hash<std::string> hasher;
+  uint64_t hash = hasher(entry.itemId);
+  HashCombine(hash, hasher(entry.title));
+  HashCombine(hash, hasher(entry.plot));
+  HashCombine(hash, hasher(entry.episodeTitle));
+  HashCombine(hash, hasher(entry.imageTag));
+  HashCombine(hash, static_cast<uint64_t>(entry.startTime));
+  HashCombine(hash, static_cast<uint64_t>(entry.endTime));
+  HashCombine(hash, static_cast<uint64_t>(entry.parentalRating));
+  HashCombine(hash, static_cast<uint64_t>(entry.seriesNumber));
+  return hash;
+}
+
+} // namespace
+
+ChannelSchedule::ChannelSchedule(std::vector<EPGEntry> entries, std::shared_ptr<StringArena> arena)
+{
+  if (!arena)
+    arena = std::make_shared<StringArena>();
+  m_arena = arena;
+  
+  // Ties are broken by ID so the same programmes always build the same columns
+  std::sort(entries.begin(), entries.end(), [](const EPGEntry& a, const EPGEntry& b) {
+    if (a.startTime != b.startTime)
+      return a.startTime < b.startTime;
+    return a.itemId < b.itemId;
+  });
+  
+  size_t count = entries.size();
+  m_starts.reserve(count);
+  m_durations.reserve(count);
+  m_textOffsets.reserve(count * TEXT_FIELDS + 1);
+  m_parentalRatings.reserve(count);
+  m_seriesNumbers.reserve(count);
+  m_plotOffsets.reserve(count);
+  m_titles.reserve(count);
+  m_episodeTitles.reserve(count);
+  
+  size_t textBytes = 0;
+  for (const auto& entry : entries)
+    textBytes += entry.itemId.size() + entry.imageTag.size();
+  m_text.reserve(textBytes);
+  
+  if (!entries.empty())
+    m_baseTime = entries.front().startTime;
+  
+  const time_t maxOffset = std::numeric_limits<uint32_t>::max();
+  
+  std::string plots;
+  uint32_t blockStart = 0;
+  
+  for (size_t i = 0; i < count; i++)
+  {
+    const EPGEntry& entry = entries[i];
+    
+    time_t duration = std::min(std::max<time_t>(entry.endTime - entry.startTime, 0), maxOffset);
+    m_starts.push_back(static_cast<uint32_t>(std::min(entry.startTime - m_baseTime, maxOffset)));
+    m_durations.push_back(static_cast<uint32_t>(duration));
+    m_maxDuration = std::max(m_maxDuration, duration);
+    
+    for (const std::string* text : {&entry.itemId, &entry.imageTag})
+    {
+      m_textOffsets.push_back(static_cast<uint32_t>(m_text.size()));
+      m_text.append(*text);
+    }
+    
+    m_titles.push_back(arena->Intern(entry.title));
+    m_episodeTitles.push_back(arena->Intern(entry.episodeTitle));
+    
+    m_parentalRatings.push_back(entry.parentalRating);
+    m_seriesNumbers.push_back(entry.seriesNumber);
+    
+    // Sorted by start, so each day's descriptions are contiguous
+    if (i > 0 && DayOf(entry.startTime) != DayOf(entries[i - 1].startTime))
+    {
+      AddPlotBlock(blockStart, plots);
+      plots.clear();
+      blockStart = static_cast<uint32_t>(i);
+    }
+    
+    if (i == 0 || blockStart == i)
+      m_days.push_back({DayOf(entry.startTime) * SECONDS_PER_DAY, i, 0, 0});
+    m_days.back().count++;
+    HashCombine(m_days.back().contentHash, HashEntry(entry));
+    
+    m_plotOffsets.push_back(static_cast<uint32_t>(plots.size()));
+    plots.append(entry.plot);
+  }
+  
+  if (count > 0)
+    AddPlotBlock(blockStart, plots);
+  
+  m_textOffsets.push_back(static_cast<uint32_t>(m_text.size()));
+}
+
+void ChannelSchedule::AddPlotBlock(uint32_t firstIndex, const std::string& raw)
+{
+  PlotBlock block;
+  block.id = g_nextPlotBlockId++;
+  block.firstIndex = firstIndex;
+  block.rawSize = static_cast<uint32_t>(raw.size());
+  
+  // Blocks that don't shrink (short or already dense text) stay as they are
+  std::string packed = Compression::Compress(raw.data(), raw.size());
+  block.compressed = packed.size() < raw.size();
+  block.data = block.compressed ? std::move(packed) : raw;
+  block.data.shrink_to_fit();
+  
+  m_plotBlocks.push_back(std::move(block));
+}
+
+size_t ChannelSchedule::LowerBound(time_t time) const
+{
+  if (time <= m_baseTime)
+    return 0;
+  
+  time_t offset = time - m_baseTime;
+  if (offset > static_cast<time_t>(std::numeric_limits<uint32_t>::max()))
+    return m_starts.size();
+  
+  return std::lower_bound(m_starts.begin(), m_starts.end(), static_cast<uint32_t>(offset)) - m_starts.begin();
+}
+
+std::pair<size_t, size_t> ChannelSchedule::FindRange(time_t start, time_t end) const
+{
+  size_t first = LowerBound(start - m_maxDuration);
+  size_t last = std::max(first, LowerBound(end));
+  return {first, last};
+}
+
+std::string ChannelSchedule::GetText(size_t index, TextField field) const
+{
+  size_t slot = index * TEXT_FIELDS + field;
+  return m_text.substr(m_textOffsets[slot], m_textOffsets[slot + 1] - m_textOffsets[slot]);
+}
+
+size_t ChannelSchedule::FindPlotBlock(size_t index) const
+{
+  auto it = std::upper_bound(m_plotBlocks.begin(), m_plotBlocks.end(), index,
+                             [](size_t value, const PlotBlock& block) { return value < block.firstIndex; });
+  return static_cast<size_t>(it - m_plotBlocks.begin()) - 1;
+}
+
+size_t ChannelSchedule::GetPlotEnd(size_t index, size_t block) const
+{
+  size_t next = block + 1 < m_plotBlocks.size() ? m_plotBlocks[block + 1].firstIndex : Size();
+  return index + 1 < next ? m_plotOffsets[index + 1] : m_plotBlocks[block].rawSize;
+}
+
+bool ChannelSchedule::UnpackPlotBlock(const PlotBlock& block, std::string& raw) const
+{
+  if (!block.compressed)
+  {
+    raw = block.data;
+    return true;
+  }
+  return Compression::Decompress(block.data.data(), block.data.size(), block.rawSize, raw);
+}
+
+std::string ChannelSchedule::GetPlot(size_t index) const
+{
+  size_t blockIndex = FindPlotBlock(index);
+  const PlotBlock& block = m_plotBlocks[blockIndex];
+  size_t start = m_plotOffsets[index];
+  size_t end = GetPlotEnd(index, blockIndex);
+  
+  if (!block.compressed)
+    return block.data.substr(start, end - start);
+  
+  PlotCache& cache = GetPlotCache();
+  std::shared_ptr<const std::string> raw = cache.Find(block.id);
+  if (!raw)
+  {
+    auto begin = std::chrono::steady_clock::now();
+    
+    auto unpacked = std::make_shared<std::string>();
+    if (!UnpackPlotBlock(block, *unpacked))
+      return "";
+    
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - begin);
+    cache.Insert(block.id, unpacked, static_cast<uint64_t>(elapsed.count()));
+    raw = unpacked;
+  }
+  
+  return raw->substr(start, end - start);
+}
+
+void ChannelSchedule::GetEntry(size_t index, EPGEntry& entry) const
+{
+  entry.itemId = GetText(index, ITEM_ID);
+  entry.title = std::string(m_titles[index]);
+  entry.plot = GetPlot(index);
+  entry.episodeTitle = std::string(m_episodeTitles[index]);
+  entry.imageTag = GetText(index, IMAGE_TAG);
+  entry.startTime = GetStartTime(index);
+  entry.endTime = GetEndTime(index);
+  entry.parentalRating = m_parentalRatings[index];
+  entry.seriesNumber = m_seriesNumbers[index];
+}
+
+std::vector<EPGEntry> ChannelSchedule::ToEntries() const
+{
+  std::vector<EPGEntry> entries(Size());
+  
+  // Bulk decode unpacks each block once and leaves the shared cache alone
+  std::string raw;
+  for (size_t blockIndex = 0; blockIndex < m_plotBlocks.size(); blockIndex++)
+  {
+    const PlotBlock& block = m_plotBlocks[blockIndex];
+    if (!UnpackPlotBlock(block, raw))
+      raw.assign(block.rawSize, ' ');
+    
+    size_t next = blockIndex + 1 < m_plotBlocks.size() ? m_plotBlocks[blockIndex + 1].firstIndex : Size();
+    for (size_t i = block.firstIndex; i < next; i++)
+    {
+      EPGEntry& entry = entries[i];
+      entry.itemId = GetText(i, ITEM_ID);
+      entry.title = std::string(m_titles[i]);
+      entry.plot = raw.substr(m_plotOffsets[i], GetPlotEnd(i, blockIndex) - m_plotOffsets[i]);
+      entry.episodeTitle = std::string(m_episodeTitles[i]);
+      entry.imageTag = GetText(i, IMAGE_TAG);
+      entry.startTime = GetStartTime(i);
+      entry.endTime = GetEndTime(i);
+      entry.parentalRating = m_parentalRatings[i];
+      entry.seriesNumber = m_seriesNumbers[i];
+    }
+  }
+  
+  return entries;
+}
+
+bool ChannelSchedule::SameAs(const ChannelSchedule& other) const
+{
+  if (m_baseTime != other.m_baseTime || m_starts != other.m_starts ||
+      m_durations != other.m_durations || m_textOffsets != other.m_textOffsets ||
+      m_text != other.m_text || m_titles != other.m_titles ||
+      m_episodeTitles != other.m_episodeTitles || m_parentalRatings != other.m_parentalRatings ||
+      m_seriesNumbers != other.m_seriesNumbers || m_plotOffsets != other.m_plotOffsets ||
+      m_plotBlocks.size() != other.m_plotBlocks.size())
+    return false;
+  
+  // Compression is deterministic, so equal text gives equal blocks
+  for (size_t i = 0; i < m_plotBlocks.size(); i++)
+  {
+    const PlotBlock& a = m_plotBlocks[i];
+    const PlotBlock& b = other.m_plotBlocks[i];
+    if (a.firstIndex != b.firstIndex || a.rawSize != b.rawSize ||
+        a.compressed != b.compressed || a.data != b.data)
+      return false;
+  }
+  return true;
+}
+
+// The shared arena is accounted for by its owner
+size_t ChannelSchedule::MemoryUsage() const
+{
+  size_t bytes = sizeof(*this) +
+                 (m_starts.capacity() + m_durations.capacity() + m_textOffsets.capacity() +
+                  m_plotOffsets.capacity()) * sizeof(uint32_t) +
+                 (m_parentalRatings.capacity() + m_seriesNumbers.capacity()) * sizeof(int32_t) +
+                 (m_titles.capacity() + m_episodeTitles.capacity()) * sizeof(std::string_view) +
+                 m_text.capacity() + m_plotBlocks.capacity() * sizeof(PlotBlock) +
+                 m_days.capacity() * sizeof(Day);
+  
+  for (const auto& block : m_plotBlocks)
+    bytes += block.data.capacity();
+  return bytes;
+}
+
+size_t ChannelSchedule::GetRawPlotBytes() const
+{
+  size_t bytes = 0;
+  for (const auto& block : m_plotBlocks)
+    bytes += block.rawSize;
+  return bytes;
+}
+
+size_t ChannelSchedule::GetStoredPlotBytes() const
+{
+  size_t bytes = 0;
+  for (const auto& block : m_plotBlocks)
+    bytes += block.data.size();
+  return bytes;
+}
+
+size_t ChannelSchedule::GetPlotSize(size_t index) const
+{
+  if (m_plotBlocks.empty())
+    return 0;
+  
+  size_t block = FindPlotBlock(index);
+  return GetPlotEnd(index, block) - m_plotOffsets[index];
+}
+
+size_t ChannelSchedule::GetPlotCacheBytes()
+{
+  return GetPlotCache().GetBytes();
+}
+
+void ChannelSchedule::ClearPlotCache()
+{
+  GetPlotCache().Clear();
+}
+
+void ChannelSchedule::GetPlotCacheStats(uint64_t& hits, uint64_t& misses, uint64_t& decompressMicros)
+{
+  GetPlotCache().GetStats(hits, misses, decompressMicros);
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+class StringArena;
+
+struct EPGEntry
+{
+  std::string itemId;
+  std::string channelId;
+  std::string title;
+  std::string plot;
+  std::string episodeTitle;
+  std::string imageTag;
+  time_t startTime = 0;
+  time_t endTime = 0;
+  int parentalRating = 0;
+  int seriesNumber = 0;
+};
+
+// Programmes of one channel, stored column-wise and sorted by start time.
+// Range scans only touch the hot start and duration columns; the text of a
+// programme lives in cold columns and is decoded into an EPGEntry only when
+// a tag is built. Titles and episode titles, which repeat across days and
+// channels, are views into a StringArena shared by the schedules of one
+// refresh; IDs and image tags live in a per-channel buffer. Times are
+// seconds relative to the channel's earliest programme, so they fit in 32
+// bits.
+//
+// Programme descriptions, the bulk of the text, are compressed in blocks of
+// one UTC day and decompressed through a small LRU shared by all schedules
+// when Kodi actually asks for the tags.
+//
+// Schedules are immutable once built; changes build a new one.
+class ChannelSchedule
+{
+public:
+  ChannelSchedule() = default;
+  
+  // Programmes may be passed in any order. Without an arena the schedule
+  // interns into one of its own.
+  explicit ChannelSchedule(std::vector<EPGEntry> entries,
+                           std::shared_ptr<StringArena> arena = nullptr);
+  
+  size_t Size() const { return m_starts.size(); }
+  bool Empty() const { return m_starts.empty(); }
+  
+  time_t GetStartTime(size_t index) const { return m_baseTime + m_starts[index]; }
+  time_t GetEndTime(size_t index) const { return GetStartTime(index) + m_durations[index]; }
+  
+  // Longest programme; bounds how far before a window start an overlapping
+  // programme can begin, so range lookups stay a binary search
+  time_t GetMaxDuration() const { return m_maxDuration; }
+  
+  // Index range [first, last) of programmes that may overlap [start, end);
+  // programmes in the range still need an end time > start check
+  std::pair<size_t, size_t> FindRange(time_t start, time_t end) const;
+  
+  // Title columns without decoding the rest of the programme
+  std::string_view GetTitle(size_t index) const { return m_titles[index]; }
+  std::string_view GetEpisodeTitle(size_t index) const { return m_episodeTitles[index]; }
+  
+  // Decodes one programme; channelId is left untouched
+  void GetEntry(size_t index, EPGEntry& entry) const;
+  std::vector<EPGEntry> ToEntries() const;
+  
+  bool SameAs(const ChannelSchedule& other) const;
+  
+  // Programmes starting on one UTC day, with a hash of their content so
+  // two versions of a schedule can be compared a day at a time
+  struct Day
+  {
+    time_t start;
+    size_t firstIndex;
+    size_t count;
+    uint64_t contentHash;
+  };
+  const std::vector<Day>& GetDays() const { return m_days; }
+  size_t MemoryUsage() const;
+  
+  // Description bytes before and after compression
+  size_t GetRawPlotBytes() const;
+  size_t GetStoredPlotBytes() const;
+  
+  // Length of one programme's description, without decompressing it
+  size_t GetPlotSize(size_t index) const;
+  
+  // Counters of the shared description cache since startup
+  static void GetPlotCacheStats(uint64_t& hits, uint64_t& misses, uint64_t& decompressMicros);
+  
+  // Bytes held by the shared description cache; clearing it only costs
+  // decompressing again
+  static size_t GetPlotCacheBytes();
+  static void ClearPlotCache();
+
+private:
+  enum TextField
+  {
+    ITEM_ID,
+    IMAGE_TAG,
+    TEXT_FIELDS
+  };
+  
+  struct PlotBlock
+  {
+    uint64_t id;            // Key in the shared decompression cache
+    uint32_t firstIndex;    // First programme of the block
+    uint32_t rawSize;
+    bool compressed;
+    std::string data;
+  };
+  
+  time_t m_baseTime = 0;
+  time_t m_maxDuration = 0;
+  
+  // Hot columns
+  std::vector<uint32_t> m_starts;       // Seconds after m_baseTime
+  std::vector<uint32_t> m_durations;
+  
+  // Cold columns. Field f of programme i spans
+  // [m_textOffsets[i * TEXT_FIELDS + f], m_textOffsets[i * TEXT_FIELDS + f + 1])
+  std::vector<uint32_t> m_textOffsets;
+  std::string m_text;
+  std::shared_ptr<const StringArena> m_arena;
+  std::vector<std::string_view> m_titles;
+  std::vector<std::string_view> m_episodeTitles;
+  std::vector<int32_t> m_parentalRatings;
+  std::vector<int32_t> m_seriesNumbers;
+  
+  // Programme i's description starts at m_plotOffsets[i] in its block
+  std::vector<PlotBlock> m_plotBlocks;
+  std::vector<uint32_t> m_plotOffsets;
+  
+  std::vector<Day> m_days;
+  
+  size_t LowerBound(time_t time) const;
+  std::string GetText(size_t index, TextField field) const;
+  
+  void AddPlotBlock(uint32_t firstIndex, const std::string& raw);
+  size_t FindPlotBlock(size_t index) const;
+  size_t GetPlotEnd(size_t index, size_t block) const;
+  bool UnpackPlotBlock(const PlotBlock& block, std::string& raw) const;
+  std::string GetPlot(size_t index) const;
+};
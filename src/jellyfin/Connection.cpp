@@ -27,21 +27,35 @@ std::string Connection::BuildUrl(const std::string& endpoint) const
 }
 
 bool Connection::SendRequest(const std::string& endpoint, Json::Value& response)
+{
+  std::string responseStr;
+  if (!SendRawRequest(endpoint, responseStr))
+    return false;
+
+  return ParseJson(responseStr, response);
+}
+
+bool Connection::SendRawRequest(const std::string& endpoint, std::string& response)
 {
   std::string url = BuildUrl(endpoint);
-  std::string responseStr = PerformHttpGet(url);
+  response = PerformHttpGet(url);
   
-  if (responseStr.empty())
+  if (response.empty())
   {
     Logger::Log(ADDON_LOG_ERROR, "Empty response from server for endpoint: %s", endpoint.c_str());
     return false;
   }
 
+  return true;
+}
+
+bool Connection::ParseJson(const std::string& text, Json::Value& value)
+{
   Json::CharReaderBuilder builder;
   std::string errors;
-  std::istringstream responseStream(responseStr);
+  std::istringstream stream(text);
   
-  if (!Json::parseFromStream(builder, responseStream, &response, &errors))
+  if (!Json::parseFromStream(builder, stream, &value, &errors))
   {
     Logger::Log(ADDON_LOG_ERROR, "Failed to parse JSON response: %s", errors.c_str());
     return false;
@@ -10,11 +10,14 @@ public:
   ~Connection() = default;
 
   bool SendRequest(const std::string& endpoint, Json::Value& response);
+  bool SendRawRequest(const std::string& endpoint, std::string& response);
   bool SendPostRequest(const std::string& endpoint, const Json::Value& data, Json::Value& response);
   bool SendDeleteRequest(const std::string& endpoint);
   
   std::string GetServerUrl() const { return m_serverUrl; }
   std::string GetApiKey() const { return m_apiKey; }
+  
+  static bool ParseJson(const std::string& text, Json::Value& value);
 
 private:
   std::string m_serverUrl;
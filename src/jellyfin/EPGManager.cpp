@@ -1,44 +1,1074 @@
 #include "EPGManager.h"
 #include "Connection.h"
+#include "ArtworkManager.h"
+#include "EPGStoreFile.h"
+#include "SharedEPGStore.h"
+#include "../utilities/StringArena.h"
+#include <kodi/Filesystem.h>
 #include "../utilities/Logger.h"
 #include "../utilities/Utilities.h"
 #include <json/json.h>
 #include <sstream>
 #include <chrono>
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
 
-EPGManager::EPGManager(Connection* connection, const std::string& userId)
+namespace
+{
+
+// Future window loaded before Kodi has asked for anything (Kodi's default)
+const time_t DEFAULT_EPG_FUTURE_SECONDS = 3 * 24 * 3600;
+
+// Under memory pressure the guide is cut to a day ahead, with descriptions
+// for the next few hours
+const time_t TRIMMED_FUTURE_SECONDS = 24 * 3600;
+const time_t TRIMMED_PLOT_SECONDS = 6 * 3600;
+
+// The first load of a cold start fetches programmes running now or starting
+// within this window, then the rest in slices outward from now, each twice
+// as long as the previous one
+const time_t NOW_NEXT_SECONDS = 2 * 3600;
+const time_t FIRST_SLICE_SECONDS = 6 * 3600;
+
+// Fetches are split into slices of this length, at most
+// EPG_FETCH_CONCURRENCY of them in flight at once
+const time_t EPG_SLICE_SECONDS = 6 * 3600;
+const size_t EPG_FETCH_CONCURRENCY = 4;
+
+// Delay before a failed refresh is retried
+const int EPG_RETRY_SECONDS = 60;
+
+// How often instances reading a shared store look for a new generation
+const int SHARED_POLL_SECONDS = 30;
+
+// Auto fetch mode switches to on-demand from this many channels
+const int DEMAND_MODE_MIN_CHANNELS = 5000;
+
+// On-demand batches: channel IDs per request, how long the first request
+// waits for others to join it, and how often the store file is rewritten
+const size_t DEMAND_BATCH_SIZE = 50;
+const int DEMAND_GATHER_MS = 250;
+const time_t DEMAND_SAVE_SECONDS = 300;
+
+// Slim ingest: programme details are fetched for what Kodi asks for up to
+// this far ahead, this many items per request, after letting requests for
+// neighbouring channels gather for a moment
+const time_t DETAIL_HORIZON_SECONDS = 24 * 3600;
+const size_t DETAIL_BATCH_SIZE = 100;
+const int DETAIL_GATHER_MS = 250;
+
+// A channel with more changed tags than this is reloaded by Kodi instead
+const size_t EPG_PUSH_MAX_TAGS_PER_CHANNEL = 200;
+
+// Parses the date in place, without copying the string out of the JSON
+time_t ParseDate(const Json::Value& value)
+{
+  const char* begin = nullptr;
+  const char* end = nullptr;
+  if (!value.isString() || !value.getString(&begin, &end))
+    return 0;
+  return Utilities::ParseDateTime(std::string_view(begin, end - begin));
+}
+
+// Fills every field Jellyfin sent; what a slim request left out stays empty
+void ParseProgramme(const Json::Value& item, EPGEntry& entry)
+{
+  entry.itemId = item["Id"].asString();
+  entry.channelId = item.get("ChannelId", "").asString();
+  entry.title = item.get("Name", "").asString();
+  entry.plot = item.get("Overview", "").asString();
+  entry.episodeTitle = item.get("EpisodeTitle", "").asString();
+  
+  if (item.isMember("ImageTags") && item["ImageTags"].isMember("Primary"))
+  {
+    entry.imageTag = item["ImageTags"]["Primary"].asString();
+  }
+  
+  if (item.isMember("StartDate"))
+  {
+    entry.startTime = ParseDate(item["StartDate"]);
+  }
+  
+  if (item.isMember("EndDate"))
+  {
+    entry.endTime = ParseDate(item["EndDate"]);
+  }
+  
+  if (item.isMember("ParentalRating"))
+  {
+    entry.parentalRating = item["ParentalRating"].asInt();
+  }
+  else
+  {
+    entry.parentalRating = 0;
+  }
+  
+  if (item.isMember("SeriesId") && item.isMember("IndexNumber"))
+  {
+    entry.seriesNumber = item["IndexNumber"].asInt();
+  }
+  else
+  {
+    entry.seriesNumber = 0;
+  }
+}
+
+bool SameEntry(const EPGEntry& a, const EPGEntry& b)
+{
+  return a.itemId == b.itemId && a.startTime == b.startTime && a.endTime == b.endTime &&
+         a.title == b.title && a.plot == b.plot && a.episodeTitle == b.episodeTitle &&
+         a.imageTag == b.imageTag && a.parentalRating == b.parentalRating &&
+         a.seriesNumber == b.seriesNumber;
+}
+
+} // namespace
+
+void EPGSnapshot::ForEachInRange(const std::string& channelId, time_t start, time_t end,
+                                 const std::function<void(const EPGEntry&)>& callback) const
+{
+  if (view)
+  {
+    view->ForEachInRange(channelId, start, end, callback);
+    return;
+  }
+  
+  auto it = channels.find(channelId);
+  if (it == channels.end())
+    return;
+  
+  const ChannelSchedule& schedule = *it->second;
+  std::pair<size_t, size_t> range = schedule.FindRange(start, end);
+  
+  EPGEntry entry;
+  entry.channelId = channelId;
+  
+  // Only programmes that really overlap get their text decoded
+  for (size_t i = range.first; i < range.second; i++)
+  {
+    if (schedule.GetEndTime(i) <= start)
+      continue;
+    
+    schedule.GetEntry(i, entry);
+    callback(entry);
+  }
+}
+
+EPGManager::EPGManager(Connection* connection, const std::string& userId,
+                       kodi::addon::CInstancePVRClient* instance, ArtworkManager* artwork)
   : m_connection(connection)
   , m_userId(userId)
-  , m_lastEPGUpdate(0)
+  , m_instance(instance)
+  , m_artwork(artwork)
+  , m_arena(std::make_shared<StringArena>())
+  , m_lastFullRefresh(0)
+  , m_lookbackSeconds(24 * 3600)
+  , m_trimLevel(EPGTrim::None)
+  , m_memoryUsage(0)
+  , m_fetchMode(EPGFetchMode::Bulk)
+  , m_demandMode(false)
+  , m_slimIngest(false)
+  , m_sharedGeneration(0)
+  , m_refreshRunning(false)
+  , m_requestedEnd(0)
+  , m_refreshRequested(false)
+  , m_firstLoadDone(false)
+  , m_servedError(false)
+  , m_lastStoreSave(0)
+{
+  m_storePath = kodi::addon::GetUserPath("epg.bin");
+  m_storeOwner = connection->GetServerUrl() + "|" + userId;
+}
+
+EPGManager::~EPGManager()
+{
+  StopBackgroundRefresh();
+}
+
+bool EPGManager::EnableSharedStore(const std::string& key)
+{
+  std::string directory = kodi::vfs::TranslateSpecialProtocol("special://temp/pvr.jellyfin/");
+  if (!kodi::vfs::DirectoryExists(directory) && !kodi::vfs::CreateDirectory(directory))
+  {
+    Logger::Log(ADDON_LOG_ERROR, "Failed to create shared EPG directory: %s", directory.c_str());
+    return false;
+  }
+  
+  auto store = std::make_unique<SharedEPGStore>(directory, key);
+  if (!store->Open())
+    return false;
+  
+  m_sharedStore = std::move(store);
+  Logger::Log(ADDON_LOG_INFO, "Sharing the EPG with other instances on this host");
+  return true;
+}
+
+void EPGManager::SetLookbackHours(int hours)
 {
+  m_lookbackSeconds = static_cast<time_t>(std::max(hours, 0)) * 3600;
+}
+
+time_t EPGManager::GetLookbackSeconds() const
+{
+  return m_trimLevel.load() >= EPGTrim::PastProgrammes ? 0 : m_lookbackSeconds.load();
+}
+
+time_t EPGManager::GetFutureSeconds() const
+{
+  return m_trimLevel.load() >= EPGTrim::Horizon ? TRIMMED_FUTURE_SECONDS : DEFAULT_EPG_FUTURE_SECONDS;
+}
+
+void EPGManager::SetTrimLevel(EPGTrim level)
+{
+  m_trimLevel = level;
+  if (level == EPGTrim::None)
+    return;
+  
+  // Nothing is pushed to Kodi: it keeps the tags it has, and a later
+  // refresh at a lower level simply brings ours back
+  std::lock_guard<std::mutex> lock(m_mutex);
+  
+  // A guide read from a shared store lives in the page cache, not in our
+  // schedules, and publishing those would blank it until the next generation
+  std::shared_ptr<const EPGSnapshot> current = std::atomic_load(&m_snapshot);
+  if (current && current->view)
+    return;
+  
+  size_t before = m_memoryUsage;
+  time_t now = std::time(nullptr);
+  PruneExpired(now);
+  
+  bool trimHorizon = level >= EPGTrim::Horizon;
+  bool trimPlots = level >= EPGTrim::Descriptions;
+  time_t end = now + TRIMMED_FUTURE_SECONDS;
+  time_t plotEnd = now + TRIMMED_PLOT_SECONDS;
+  if (trimHorizon)
+    m_coverage.TrimAfter(end);
+  
+  if (trimPlots)
+  {
+    for (auto it = m_details.begin(); it != m_details.end();)
+    {
+      if (it->second.endTime > plotEnd)
+        it = m_details.erase(it);
+      else
+        ++it;
+    }
+  }
+  
+  for (auto it = m_schedules.begin(); it != m_schedules.end();)
+  {
+    const ChannelSchedule& current = *it->second;
+    
+    // Only programmes starting after the plot cut-off can need trimming
+    bool needed = false;
+    std::pair<size_t, size_t> range = current.FindRange(plotEnd, std::numeric_limits<time_t>::max());
+    for (size_t i = range.first; i < range.second && !needed; i++)
+    {
+      time_t start = current.GetStartTime(i);
+      needed = (trimHorizon && start >= end) || (trimPlots && start >= plotEnd && current.GetPlotSize(i) > 0);
+    }
+    
+    if (!needed)
+    {
+      ++it;
+      continue;
+    }
+    
+    std::vector<EPGEntry> entries = current.ToEntries();
+    if (trimHorizon)
+    {
+      entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                   [end](const EPGEntry& e) { return e.startTime >= end; }),
+                    entries.end());
+    }
+    if (trimPlots)
+    {
+      for (auto& entry : entries)
+      {
+        if (entry.startTime >= plotEnd)
+          std::string().swap(entry.plot);
+      }
+    }
+    
+    if (entries.empty())
+    {
+      it = m_schedules.erase(it);
+    }
+    else
+    {
+      it->second = std::make_shared<ChannelSchedule>(std::move(entries), m_arena);
+      ++it;
+    }
+  }
+  
+  Publish();
+  Logger::Log(ADDON_LOG_DEBUG, "EPG trimmed to level %d: %d KB, was %d KB", static_cast<int>(level),
+              static_cast<int>(m_memoryUsage / 1024), static_cast<int>(before / 1024));
+}
+
+void EPGManager::StartBackgroundRefresh(int intervalMinutes)
+{
+  StopBackgroundRefresh();
+  
+  {
+    std::lock_guard<std::mutex> lock(m_refreshMutex);
+    m_firstLoadDone = false;
+    m_demandPending.clear();
+    m_demandInFlight.clear();
+    m_demandFetched.clear();
+  }
+  
+  m_nowNext.Start();
+  
+  {
+    std::lock_guard<std::mutex> lock(m_detailMutex);
+    m_detailPending.clear();
+    m_detailCoverage.clear();
+  }
+  
+  m_refreshStarted = std::chrono::steady_clock::now();
+  m_refreshRunning = true;
+  m_refreshThread = std::thread(&EPGManager::RefreshLoop, this, std::max(intervalMinutes, 0));
+  if (m_slimIngest)
+    m_detailThread = std::thread(&EPGManager::DetailLoop, this);
+  Logger::Log(ADDON_LOG_INFO, "EPG refresh every %d minutes", intervalMinutes);
+}
+
+void EPGManager::StopBackgroundRefresh()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_refreshMutex);
+    m_refreshRunning = false;
+  }
+  m_refreshCondition.notify_all();
+  
+  {
+    std::lock_guard<std::mutex> lock(m_detailMutex);
+  }
+  m_detailCondition.notify_all();
+  
+  if (m_refreshThread.joinable())
+    m_refreshThread.join();
+  if (m_detailThread.joinable())
+    m_detailThread.join();
+  
+  m_nowNext.Stop();
+}
+
+void EPGManager::RefreshLoop(int intervalMinutes)
+{
+  const time_t interval = static_cast<time_t>(intervalMinutes) * 60;
+  
+  bool seeded = false;
+  
+  while (m_refreshRunning)
+  {
+    // Instances that lose the writer election only follow the shared store
+    // and take over if the writer goes away
+    if (m_sharedStore && !m_sharedStore->TryBecomeWriter())
+    {
+      ReadSharedStore();
+      
+      std::unique_lock<std::mutex> lock(m_refreshMutex);
+      m_firstLoadDone = true;
+      m_refreshCondition.notify_all();
+      m_refreshCondition.wait_for(lock, std::chrono::seconds(SHARED_POLL_SECONDS),
+                                  [this] { return !m_refreshRunning || m_refreshRequested; });
+      m_refreshRequested = false;
+      continue;
+    }
+    
+    // Serve the guide saved by the previous session (or the last shared
+    // generation) straight away; after that only what is missing is fetched
+    // until the next full refresh
+    if (!seeded)
+    {
+      seeded = true;
+      bool restored = AdoptSharedStore() || LoadStore();
+      
+      // Before anything is served, so no request takes the wrong path
+      ResolveFetchMode();
+      
+      if (restored)
+      {
+        std::lock_guard<std::mutex> lock(m_refreshMutex);
+        m_firstLoadDone = true;
+        m_refreshCondition.notify_all();
+      }
+    }
+    
+    // On-demand mode only fetches channels Kodi has asked for; there is no
+    // full refresh, each channel expires on its own
+    if (m_demandMode)
+    {
+      std::map<std::string, time_t> batch;
+      {
+        std::unique_lock<std::mutex> lock(m_refreshMutex);
+        m_firstLoadDone = true;
+        m_refreshCondition.notify_all();
+        
+        m_refreshCondition.wait(lock, [this] { return !m_refreshRunning || !m_demandPending.empty(); });
+        
+        // Kodi asks one channel at a time; give the requests that follow
+        // the first one a moment to arrive so they share its call
+        m_refreshCondition.wait_for(lock, std::chrono::milliseconds(DEMAND_GATHER_MS), [this] {
+          return !m_refreshRunning || m_demandPending.size() >= DEMAND_BATCH_SIZE;
+        });
+        if (!m_refreshRunning)
+          break;
+        
+        while (!m_demandPending.empty() && batch.size() < DEMAND_BATCH_SIZE)
+        {
+          auto next = m_demandPending.begin();
+          m_demandInFlight.insert(next->first);
+          batch.insert(*next);
+          m_demandPending.erase(next);
+        }
+        m_refreshRequested = false;
+      }
+      
+      RefreshChannels(batch, interval);
+      continue;
+    }
+    
+    time_t requestedEnd;
+    {
+      std::lock_guard<std::mutex> lock(m_refreshMutex);
+      requestedEnd = m_requestedEnd;
+      m_refreshRequested = false;
+    }
+    
+    // Periodic runs re-fetch the whole window so removed or moved
+    // programmes disappear; in between only newly requested ranges are loaded
+    time_t now = std::time(nullptr);
+    time_t lastFullRefresh;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      lastFullRefresh = m_lastFullRefresh;
+    }
+    bool full = lastFullRefresh == 0 || (interval > 0 && now - lastFullRefresh >= interval);
+    
+    // With nothing to show yet, a first full load would leave the guide
+    // blank until the whole window is in
+    time_t end = now + GetFutureSeconds();
+    if (m_trimLevel.load() < EPGTrim::Horizon)
+      end = std::max(end, requestedEnd);
+    bool ok = lastFullRefresh == 0 ? LoadInPhases(end) : Refresh(end, full);
+    if (ok && full)
+    {
+      lastFullRefresh = now;
+      if (m_slimIngest)
+        RequeueDetails();
+    }
+    
+    std::unique_lock<std::mutex> lock(m_refreshMutex);
+    m_firstLoadDone = true;
+    m_refreshCondition.notify_all();
+    
+    auto woken = [this] { return !m_refreshRunning || m_refreshRequested; };
+    if (!ok)
+    {
+      m_refreshCondition.wait_for(lock, std::chrono::seconds(EPG_RETRY_SECONDS), woken);
+    }
+    else if (interval > 0)
+    {
+      time_t remaining = std::max<time_t>(lastFullRefresh + interval - std::time(nullptr), 0);
+      m_refreshCondition.wait_for(lock, std::chrono::seconds(remaining), woken);
+    }
+    else
+    {
+      m_refreshCondition.wait(lock, woken);
+    }
+  }
+}
+
+void EPGManager::ResolveFetchMode()
+{
+  bool demand = m_fetchMode == EPGFetchMode::OnDemand;
+  int lineupSize = -1;
+  if (m_fetchMode == EPGFetchMode::Auto && m_lineupSizeLookup)
+  {
+    lineupSize = m_lineupSizeLookup();
+    demand = lineupSize >= DEMAND_MODE_MIN_CHANNELS;
+  }
+  
+  // Instances reading a shared store have no way to ask its writer for a
+  // channel, so the writer has to fetch everything
+  if (demand && m_sharedStore)
+  {
+    Logger::Log(ADDON_LOG_INFO, "Shared EPG store enabled, fetching the guide for all channels");
+    demand = false;
+  }
+  
+  m_demandMode = demand;
+  Logger::Log(ADDON_LOG_INFO, "EPG fetched %s (lineup of %d channels)",
+              demand ? "per channel on demand" : "for all channels at once", lineupSize);
+}
+
+bool EPGManager::Refresh(time_t end, bool full)
+{
+  Published published;
+  std::set<std::string> changed;
+  
+  time_t start = std::time(nullptr) - GetLookbackSeconds();
+  bool ok = full ? ReplaceEPGData(start, end, changed, published) : LoadEPGData(start, end, changed, published);
+  
+  NotifyChanged(published, changed);
+  
+  if (!changed.empty() || (ok && full))
+    SaveStore();
+  
+  return ok;
+}
+
+bool EPGManager::LoadInPhases(time_t end)
+{
+  time_t now = std::time(nullptr);
+  time_t start = now - GetLookbackSeconds();
+  
+  // Phase one: what is on now and next, for every channel
+  if (!RefreshSlice(now, std::min(now + NOW_NEXT_SECONDS, end)))
+    return false;
+  
+  {
+    std::lock_guard<std::mutex> lock(m_refreshMutex);
+    m_firstLoadDone = true;
+  }
+  m_refreshCondition.notify_all();
+  
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - m_refreshStarted);
+  
+  // Other instances sharing the store get the partial guide too. A restart
+  // from this file finishes the window, since it is not marked as a full
+  // refresh yet.
+  SaveStore();
+  
+  Logger::Log(ADDON_LOG_INFO, "EPG now/next ready %d ms after start", static_cast<int>(elapsed.count()));
+  
+  // Phase two: the rest of the window in slices that grow with their
+  // distance from now, nearest first
+  std::vector<IntervalSet::Interval> slices;
+  time_t length = FIRST_SLICE_SECONDS;
+  for (time_t cursor = now + NOW_NEXT_SECONDS; cursor < end; cursor += length, length *= 2)
+    slices.emplace_back(cursor, std::min(cursor + length, end));
+  
+  length = FIRST_SLICE_SECONDS;
+  for (time_t cursor = now; cursor > start; cursor -= length, length *= 2)
+    slices.emplace_back(std::max(cursor - length, start), cursor);
+  
+  auto distance = [now](const IntervalSet::Interval& slice) {
+    return slice.second <= now ? now - slice.second : slice.first - now;
+  };
+  std::stable_sort(slices.begin(), slices.end(),
+                   [&distance](const IntervalSet::Interval& a, const IntervalSet::Interval& b) {
+                     return distance(a) < distance(b);
+                   });
+  
+  for (const auto& slice : slices)
+  {
+    if (!m_refreshRunning || !RefreshSlice(slice.first, slice.second))
+      return false;
+  }
+  
+  // Together the slices are a full refresh
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_lastFullRefresh = now;
+    Publish();
+    LogStoreStats();
+  }
+  SaveStore();
+  
+  elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - m_refreshStarted);
+  Logger::Log(ADDON_LOG_INFO, "EPG window complete in %d slices, %d ms after start",
+              static_cast<int>(slices.size()), static_cast<int>(elapsed.count()));
+  return true;
+}
+
+bool EPGManager::RefreshSlice(time_t start, time_t end)
+{
+  Published published;
+  std::set<std::string> changed;
+  bool ok = LoadEPGData(start, end, changed, published);
+  
+  NotifyChanged(published, changed);
+  return ok;
+}
+
+void EPGManager::SaveStore()
+{
+  // Snapshots are immutable, so the store is written without holding m_mutex
+  std::shared_ptr<const EPGSnapshot> snapshot = std::atomic_load(&m_snapshot);
+  if (!snapshot)
+    return;
+  
+  EPGStoreFile::Save(m_storePath, *snapshot, m_storeOwner);
+  
+  if (m_sharedStore)
+    m_sharedStore->Publish(*snapshot);
+}
+
+bool EPGManager::RefreshChannels(const std::map<std::string, time_t>& batch, time_t ttl)
+{
+  time_t now = std::time(nullptr);
+  time_t end = now + GetFutureSeconds();
+  std::vector<std::string> channelIds;
+  channelIds.reserve(batch.size());
+  for (const auto& channel : batch)
+  {
+    channelIds.push_back(channel.first);
+    end = std::max(end, channel.second);
+  }
+  
+  Published published;
+  std::set<std::string> changed;
+  
+  std::map<std::string, std::vector<EPGEntry>> fetched;
+  bool ok = FetchEPGRange(now - GetLookbackSeconds(), end, fetched, channelIds);
+  
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    PruneExpired(now);
+    
+    if (ok)
+    {
+      ApplyDetailsLocked(fetched);
+      
+      // The whole window of each channel was fetched, so its schedule is
+      // replaced rather than merged. Each batch interns into its own arena,
+      // which goes away once all its channels have been fetched again.
+      m_arena = std::make_shared<StringArena>();
+      
+      for (const auto& channelId : channelIds)
+      {
+        auto existing = m_schedules.find(channelId);
+        auto entries = fetched.find(channelId);
+        if (entries == fetched.end())
+        {
+          if (existing != m_schedules.end())
+          {
+            m_schedules.erase(existing);
+            changed.insert(channelId);
+          }
+          continue;
+        }
+        
+        auto schedule = std::make_shared<ChannelSchedule>(std::move(entries->second), m_arena);
+        if (existing == m_schedules.end() || !existing->second->SameAs(*schedule))
+          changed.insert(channelId);
+        m_schedules[channelId] = schedule;
+      }
+      
+      published = Publish();
+    }
+  }
+  
+  {
+    std::lock_guard<std::mutex> lock(m_refreshMutex);
+    for (const auto& channel : batch)
+    {
+      // A failed batch is not asked for again until the retry delay is up
+      DemandState& state = m_demandFetched[channel.first];
+      if (ok)
+      {
+        state.expires = ttl > 0 ? now + ttl : std::numeric_limits<time_t>::max();
+        state.end = end;
+      }
+      else
+      {
+        state.expires = now + EPG_RETRY_SECONDS;
+        state.end = channel.second;
+      }
+      m_demandInFlight.erase(channel.first);
+    }
+  }
+  
+  NotifyChanged(published, changed);
+  
+  Logger::Log(ADDON_LOG_DEBUG, "Fetched EPG for %d requested channel(s), %d changed",
+              static_cast<int>(batch.size()), static_cast<int>(changed.size()));
+  
+  // Kodi's first pass over the lineup produces many small batches, so the
+  // store file is only rewritten every few minutes
+  if (!changed.empty() && now - m_lastStoreSave >= DEMAND_SAVE_SECONDS)
+  {
+    std::shared_ptr<const EPGSnapshot> snapshot = std::atomic_load(&m_snapshot);
+    if (snapshot && EPGStoreFile::Save(m_storePath, *snapshot, m_storeOwner))
+      m_lastStoreSave = now;
+  }
+  
+  return ok;
+}
+
+bool EPGManager::ReadSharedStore()
+{
+  if (m_sharedStore->GetGeneration() == m_sharedGeneration)
+    return true;
+  
+  uint64_t generation = 0;
+  std::shared_ptr<EPGStoreView> view = m_sharedStore->Read(generation);
+  if (!view)
+    return false;
+  
+  // Channel hashes in the store tell which channels Kodi has to re-read
+  std::map<std::string, uint64_t> hashes = view->GetChannelHashes();
+  std::set<std::string> changed;
+  for (const auto& channel : hashes)
+  {
+    auto previous = m_sharedHashes.find(channel.first);
+    if (previous == m_sharedHashes.end() || previous->second != channel.second)
+      changed.insert(channel.first);
+  }
+  for (const auto& channel : m_sharedHashes)
+  {
+    if (hashes.count(channel.first) == 0)
+      changed.insert(channel.first);
+  }
+  
+  auto snapshot = std::make_shared<EPGSnapshot>();
+  snapshot->coverage = view->GetCoverage();
+  snapshot->refreshedAt = view->GetRefreshedAt();
+  snapshot->view = view;
+  Published published;
+  published.current = snapshot;
+  {
+    // Ordered against SetTrimLevel, which publishes from another thread
+    std::lock_guard<std::mutex> lock(m_mutex);
+    published.previous = std::atomic_exchange(&m_snapshot, published.current);
+  }
+  
+  m_sharedGeneration = generation;
+  m_sharedHashes.swap(hashes);
+  
+  Logger::Log(ADDON_LOG_DEBUG, "Reading shared EPG generation %llu, %d channels changed",
+              static_cast<unsigned long long>(generation), static_cast<int>(changed.size()));
+  
+  NotifyChanged(published, changed);
+  return true;
+}
+
+bool EPGManager::AdoptSharedStore()
+{
+  if (!m_sharedStore)
+    return false;
+  
+  uint64_t generation = 0;
+  std::shared_ptr<EPGStoreView> view = m_sharedStore->Read(generation);
+  if (!view)
+    return false;
+  
+  auto arena = std::make_shared<StringArena>();
+  EPGSnapshot stored;
+  EPGStoreFile::Materialize(*view, stored, arena);
+  
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_schedules = std::move(stored.channels);
+  m_coverage = std::move(stored.coverage);
+  m_arena = arena;
+  m_lastFullRefresh = stored.refreshedAt;
+  PruneExpired(std::time(nullptr));
+  Publish();
+  
+  Logger::Log(ADDON_LOG_INFO, "Took over shared EPG generation %llu with %d channels",
+              static_cast<unsigned long long>(generation), static_cast<int>(m_schedules.size()));
+  return true;
+}
+
+bool EPGManager::LoadStore()
+{
+  auto start = std::chrono::steady_clock::now();
+  
+  auto arena = std::make_shared<StringArena>();
+  EPGSnapshot stored;
+  if (!EPGStoreFile::Load(m_storePath, m_storeOwner, stored, arena))
+    return false;
+  
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_schedules = std::move(stored.channels);
+  m_coverage = std::move(stored.coverage);
+  m_arena = arena;
+  m_lastFullRefresh = stored.refreshedAt;
+  PruneExpired(std::time(nullptr));
+  Publish();
+  
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start);
+  Logger::Log(ADDON_LOG_INFO, "Loaded EPG store with %d channels in %d ms",
+              static_cast<int>(m_schedules.size()), static_cast<int>(elapsed.count()));
+  LogStoreStats();
+  return true;
+}
+
+bool EPGManager::LoadEPGData(time_t start, time_t end, std::set<std::string>& changed, Published& published)
+{
+  time_t now = std::time(nullptr);
+  start = std::max(start, now - GetLookbackSeconds());
+  
+  std::vector<IntervalSet::Interval> gaps;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    gaps = m_coverage.Gaps(start, end);
+  }
+  
+  // Fetched without m_mutex; only the refresh thread fills gaps, so they
+  // are still gaps once merged
+  std::vector<std::pair<IntervalSet::Interval, std::map<std::string, std::vector<EPGEntry>>>> fetched;
+  bool ok = true;
+  for (const auto& gap : gaps)
+  {
+    std::map<std::string, std::vector<EPGEntry>> entries;
+    if (!FetchEPGRange(gap.first, gap.second, entries))
+    {
+      ok = false;
+      break;
+    }
+    fetched.emplace_back(gap, std::move(entries));
+  }
+  
+  std::lock_guard<std::mutex> lock(m_mutex);
+  PruneExpired(now);
+  
+  // A partially failed gap fetch still merges and publishes what did arrive
+  for (auto& gap : fetched)
+  {
+    ApplyDetailsLocked(gap.second);
+    MergeEntries(gap.second, changed);
+    m_coverage.Add(gap.first.first, gap.first.second);
+  }
+  
+  if (!fetched.empty())
+  {
+    Logger::Log(ADDON_LOG_INFO, "EPG cache now holds %d channels after fetching %d missing interval(s)",
+                static_cast<int>(m_schedules.size()), static_cast<int>(fetched.size()));
+  }
+  
+  if (ok || !changed.empty())
+    published = Publish();
+  
+  return ok;
+}
+
+bool EPGManager::ReplaceEPGData(time_t start, time_t end, std::set<std::string>& changed, Published& published)
+{
+  std::map<std::string, std::vector<EPGEntry>> fetched;
+  if (!FetchEPGRange(start, end, fetched))
+    return false;
+  
+  std::lock_guard<std::mutex> lock(m_mutex);
+  ApplyDetailsLocked(fetched);
+  
+  // Old programmes that fell out of the window must not count as changes
+  PruneExpired(std::time(nullptr));
+  
+  // Every full refresh interns into a fresh arena, and every schedule is
+  // rebuilt in it, so the previous generation's arena goes away with the
+  // last snapshot that uses it
+  auto arena = std::make_shared<StringArena>();
+  
+  ScheduleMap schedules;
+  for (auto& channel : fetched)
+  {
+    auto schedule = std::make_shared<ChannelSchedule>(std::move(channel.second), arena);
+    
+    auto existing = m_schedules.find(channel.first);
+    if (existing == m_schedules.end() || !existing->second->SameAs(*schedule))
+      changed.insert(channel.first);
+    
+    schedules[channel.first] = schedule;
+  }
+  
+  for (const auto& channel : m_schedules)
+  {
+    if (schedules.count(channel.first) == 0)
+      changed.insert(channel.first);
+  }
+  
+  m_schedules.swap(schedules);
+  m_arena = arena;
+  m_coverage.Clear();
+  m_coverage.Add(start, end);
+  m_lastFullRefresh = std::time(nullptr);
+  
+  Logger::Log(ADDON_LOG_INFO, "EPG refreshed: %d channels, %d changed",
+              static_cast<int>(m_schedules.size()), static_cast<int>(changed.size()));
+  LogStoreStats();
+  
+  published = Publish();
+  return true;
+}
+
+void EPGManager::LogStoreStats() const
+{
+  size_t programmes = 0;
+  size_t bytes = 0;
+  size_t rawPlotBytes = 0;
+  size_t storedPlotBytes = 0;
+  for (const auto& channel : m_schedules)
+  {
+    programmes += channel.second->Size();
+    bytes += channel.second->MemoryUsage();
+    rawPlotBytes += channel.second->GetRawPlotBytes();
+    storedPlotBytes += channel.second->GetStoredPlotBytes();
+  }
+  
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t decompressMicros = 0;
+  ChannelSchedule::GetPlotCacheStats(hits, misses, decompressMicros);
+  
+  bytes += m_arena->MemoryUsage();
+  
+  int saved = rawPlotBytes > 0 ? static_cast<int>(100 - storedPlotBytes * 100 / rawPlotBytes) : 0;
+  Logger::Log(ADDON_LOG_INFO, "EPG store: %d programmes in %d KB; descriptions %d KB stored as %d KB (%d%% saved)",
+              static_cast<int>(programmes), static_cast<int>(bytes / 1024),
+              static_cast<int>(rawPlotBytes / 1024), static_cast<int>(storedPlotBytes / 1024), saved);
+  Logger::Log(ADDON_LOG_INFO, "EPG description cache: %llu hits, %llu misses, %llu us per decompressed block",
+              static_cast<unsigned long long>(hits), static_cast<unsigned long long>(misses),
+              static_cast<unsigned long long>(misses > 0 ? decompressMicros / misses : 0));
+  
+  m_arena->LogStats("EPG");
+}
+
+bool EPGManager::FetchEPGRange(time_t start, time_t end, std::map<std::string, std::vector<EPGEntry>>& fetched,
+                               const std::vector<std::string>& channelIds)
+{
+  auto fetchStart = std::chrono::steady_clock::now();
+  Logger::Log(ADDON_LOG_INFO, "Loading EPG data from %s to %s for %s", 
+              Utilities::FormatDateTime(start).c_str(),
+              Utilities::FormatDateTime(end).c_str(),
+              channelIds.empty() ? "all channels" : (std::to_string(channelIds.size()) + " channel(s)").c_str());
+  
+  // The server produces, and we parse, several short windows much faster
+  // than one long one, so the range is fetched in slices a few at a time
+  std::vector<FetchedSlice> slices;
+  for (time_t cursor = start; cursor < end; cursor += EPG_SLICE_SECONDS)
+  {
+    FetchedSlice slice;
+    slice.start = cursor;
+    slice.end = std::min(cursor + EPG_SLICE_SECONDS, end);
+    slices.push_back(std::move(slice));
+  }
+  
+  std::atomic<size_t> next(0);
+  std::atomic<bool> failed(false);
+  auto worker = [&]() {
+    for (size_t i = next++; i < slices.size() && !failed; i = next++)
+    {
+      if (!FetchEPGSlice(channelIds, slices[i]))
+        failed = true;
+    }
+  };
+  
+  std::vector<std::thread> workers;
+  size_t workerCount = std::min(EPG_FETCH_CONCURRENCY, slices.size());
+  for (size_t i = 1; i < workerCount; i++)
+    workers.emplace_back(worker);
+  worker();
+  for (auto& thread : workers)
+    thread.join();
+  
+  if (failed)
+  {
+    Logger::Log(ADDON_LOG_ERROR, "Failed to load EPG data");
+    return false;
+  }
+  
+  // A programme crossing a slice boundary comes back from both slices; it
+  // is kept by the slice it starts in (the first and last slices also keep
+  // what starts before or after the range)
+  int skipped = 0;
+  size_t bytes = 0;
+  for (size_t i = 0; i < slices.size(); i++)
+  {
+    FetchedSlice& slice = slices[i];
+    skipped += slice.skipped;
+    bytes += slice.bytes;
+    
+    for (auto& channel : slice.channels)
+    {
+      std::vector<EPGEntry>& entries = fetched[channel.first];
+      for (auto& entry : channel.second)
+      {
+        if ((i > 0 && entry.startTime < slice.start) ||
+            (i + 1 < slices.size() && entry.startTime >= slice.end))
+          continue;
+        entries.push_back(std::move(entry));
+      }
+    }
+  }
+  
+  for (auto& channel : fetched)
+  {
+    std::stable_sort(channel.second.begin(), channel.second.end(),
+                     [](const EPGEntry& a, const EPGEntry& b) { return a.startTime < b.startTime; });
+  }
+  
+  if (skipped > 0)
+  {
+    Logger::Log(ADDON_LOG_INFO, "Skipped %d EPG items for channels not in the lineup", skipped);
+  }
+  
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - fetchStart);
+  Logger::Log(ADDON_LOG_INFO, "Loaded %s EPG data for %d channels in %d slice(s), %d KB in %d ms",
+              m_slimIngest ? "slim" : "full", static_cast<int>(fetched.size()),
+              static_cast<int>(slices.size()), static_cast<int>(bytes / 1024),
+              static_cast<int>(elapsed.count()));
+  
+  return true;
 }
 
-bool EPGManager::LoadEPGData(time_t start, time_t end)
+bool EPGManager::FetchEPGSlice(const std::vector<std::string>& channelIds, FetchedSlice& slice)
 {
-  Logger::Log(ADDON_LOG_INFO, "Loading EPG data from %s to %s", 
-              Utilities::FormatDateTime(start).c_str(),
-              Utilities::FormatDateTime(end).c_str());
-  
-  // Make ONE bulk API call for all channels
+  // minEndDate rather than minStartDate so programmes already running at
+  // the slice start are included
   std::ostringstream endpoint;
   endpoint << "/LiveTv/Programs?userId=" << m_userId
-           << "&minStartDate=" << Utilities::FormatDateTime(start)
-           << "&maxStartDate=" << Utilities::FormatDateTime(end);
+           << "&minEndDate=" << Utilities::FormatDateTime(slice.start)
+           << "&maxStartDate=" << Utilities::FormatDateTime(slice.end);
   
-  Json::Value response;
-  if (!m_connection->SendRequest(endpoint.str(), response))
+  // A slim guide is titles and times only; details come from FetchDetails
+  if (m_slimIngest)
+    endpoint << "&EnableImages=false&EnableUserData=false";
+  else
+    endpoint << "&Fields=Overview";
+  
+  if (!channelIds.empty())
   {
-    Logger::Log(ADDON_LOG_ERROR, "Failed to load EPG data");
+    endpoint << "&channelIds=";
+    for (size_t i = 0; i < channelIds.size(); i++)
+      endpoint << (i > 0 ? "," : "") << channelIds[i];
+  }
+  
+  auto requestStart = std::chrono::steady_clock::now();
+  std::string body;
+  if (!m_connection->SendRawRequest(endpoint.str(), body))
     return false;
+  
+  // Programmes of channels filtered out of the lineup are skipped; a shared
+  // store keeps everything, as other profiles may see more channels. Without
+  // a lineup to check against, dropping them all would blank the guide.
+  bool filter = m_channelFilter && !m_sharedStore;
+  if (filter && m_channelFilterReady && !m_channelFilterReady())
+  {
+    Logger::Log(ADDON_LOG_WARNING, "Channel lineup not loaded, keeping the guide of every channel");
+    filter = false;
   }
   
-  // Clear old cache
-  m_epgCache.clear();
+  auto parseStart = std::chrono::steady_clock::now();
+  slice.bytes = body.size();
+  Json::Value response;
+  if (!Connection::ParseJson(body, response))
+    return false;
   
+  int itemCount = 0;
   if (response.isMember("Items") && response["Items"].isArray())
   {
     const Json::Value& items = response["Items"];
-    Logger::Log(ADDON_LOG_INFO, "Processing %d EPG items", items.size());
+    itemCount = static_cast<int>(items.size());
     
     for (unsigned int i = 0; i < items.size(); i++)
     {
@@ -52,112 +1082,638 @@ bool EPGManager::LoadEPGData(time_t start, time_t end)
       
       std::string channelId = item["ChannelId"].asString();
       
-      EPGEntry entry;
-      entry.itemId = item["Id"].asString();
-      entry.channelId = channelId;
-      entry.title = item.get("Name", "").asString();
-      entry.plot = item.get("Overview", "").asString();
-      entry.episodeTitle = item.get("EpisodeTitle", "").asString();
-      
-      if (item.isMember("StartDate"))
+      if (filter && !m_channelFilter(channelId))
       {
-        entry.startTime = Utilities::ParseDateTime(item["StartDate"].asString());
+        slice.skipped++;
+        continue;
       }
       
-      if (item.isMember("EndDate"))
-      {
-        entry.endTime = Utilities::ParseDateTime(item["EndDate"].asString());
-      }
+      EPGEntry entry;
+      ParseProgramme(item, entry);
+      slice.channels[channelId].push_back(std::move(entry));
+    }
+  }
+  
+  auto parseEnd = std::chrono::steady_clock::now();
+  Logger::Log(ADDON_LOG_DEBUG, "EPG slice from %s: %d items in %d KB, server %d ms, parse %d ms",
+              Utilities::FormatDateTime(slice.start).c_str(), itemCount, static_cast<int>(body.size() / 1024),
+              static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(parseStart - requestStart).count()),
+              static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(parseEnd - parseStart).count()));
+  
+  return true;
+}
+
+void EPGManager::DetailLoop()
+{
+  while (m_refreshRunning)
+  {
+    std::vector<DetailRequest> batch;
+    {
+      std::unique_lock<std::mutex> lock(m_detailMutex);
+      m_detailCondition.wait(lock, [this] { return !m_refreshRunning || !m_detailPending.empty(); });
       
-      if (item.isMember("ParentalRating"))
-      {
-        entry.parentalRating = item["ParentalRating"].asInt();
-      }
-      else
+      // Kodi asks one channel at a time; let the neighbours catch up
+      m_detailCondition.wait_for(lock, std::chrono::milliseconds(DETAIL_GATHER_MS),
+                                 [this] { return !m_refreshRunning; });
+      if (!m_refreshRunning)
+        break;
+      
+      batch.swap(m_detailPending);
+    }
+    
+    EnrichDetails(batch);
+  }
+}
+
+void EPGManager::RequestDetails(const std::string& channelId, time_t start, time_t end)
+{
+  time_t now = std::time(nullptr);
+  start = std::max(start, now);
+  end = std::min(end, now + DETAIL_HORIZON_SECONDS);
+  if (start >= end)
+    return;
+  
+  {
+    std::lock_guard<std::mutex> lock(m_detailMutex);
+    auto coverage = m_detailCoverage.find(channelId);
+    if (coverage != m_detailCoverage.end() && coverage->second.Contains(start, end))
+      return;
+    
+    m_detailPending.push_back({channelId, start, end});
+  }
+  m_detailCondition.notify_all();
+}
+
+void EPGManager::RequeueDetails()
+{
+  // The horizon has moved on and new programmes came in slim; channels Kodi
+  // has read get details for the new window. Known items are not fetched again.
+  time_t now = std::time(nullptr);
+  {
+    std::lock_guard<std::mutex> lock(m_detailMutex);
+    for (const auto& channel : m_detailCoverage)
+      m_detailPending.push_back({channel.first, now, now + DETAIL_HORIZON_SECONDS});
+    m_detailCoverage.clear();
+  }
+  m_detailCondition.notify_all();
+}
+
+bool EPGManager::EnrichDetails(const std::vector<DetailRequest>& batch)
+{
+  auto enrichStart = std::chrono::steady_clock::now();
+  Published published;
+  std::set<std::string> changed;
+  std::set<std::string> channels;
+  std::vector<std::string> ids;
+  
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    
+    std::set<std::string> missing;
+    for (const auto& request : batch)
+    {
+      auto schedule = m_schedules.find(request.channelId);
+      if (schedule == m_schedules.end())
+        continue;
+      channels.insert(request.channelId);
+      
+      std::pair<size_t, size_t> range = schedule->second->FindRange(request.start, request.end);
+      EPGEntry entry;
+      for (size_t i = range.first; i < range.second; i++)
       {
-        entry.parentalRating = 0;
+        if (schedule->second->GetEndTime(i) <= request.start)
+          continue;
+        schedule->second->GetEntry(i, entry);
+        if (m_details.count(entry.itemId) == 0)
+          missing.insert(entry.itemId);
       }
+    }
+    ids.assign(missing.begin(), missing.end());
+  }
+  
+  // The guide stays readable and publishable during the requests
+  bool ok = true;
+  std::unordered_map<std::string, ProgrammeDetails> fetched;
+  for (size_t i = 0; i < ids.size() && ok; i += DETAIL_BATCH_SIZE)
+  {
+    std::vector<std::string> chunk(ids.begin() + i, ids.begin() + std::min(i + DETAIL_BATCH_SIZE, ids.size()));
+    ok = FetchDetails(chunk, fetched);
+  }
+  
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& details : fetched)
+      m_details[details.first] = std::move(details.second);
+    
+    // Whatever did arrive is applied even if a later request failed. A
+    // refresh may have dropped or replaced a channel meanwhile; the details
+    // apply to whatever schedule it has now.
+    for (const auto& channelId : channels)
+    {
+      auto existing = m_schedules.find(channelId);
+      if (existing == m_schedules.end())
+        continue;
+      
+      std::vector<EPGEntry> entries = existing->second->ToEntries();
+      if (!ApplyDetailsLocked(entries))
+        continue;
+      
+      existing->second = std::make_shared<ChannelSchedule>(std::move(entries), m_arena);
+      changed.insert(channelId);
+    }
+    
+    if (!changed.empty())
+      published = Publish();
+  }
+  
+  if (ok)
+  {
+    std::lock_guard<std::mutex> lock(m_detailMutex);
+    for (const auto& request : batch)
+    {
+      if (channels.count(request.channelId) > 0)
+        m_detailCoverage[request.channelId].Add(request.start, request.end);
+    }
+  }
+  
+  NotifyChanged(published, changed);
+  
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - enrichStart);
+  Logger::Log(ADDON_LOG_DEBUG, "Fetched details of %d programme(s) on %d channel(s) in %d ms",
+              static_cast<int>(ids.size()), static_cast<int>(channels.size()),
+              static_cast<int>(elapsed.count()));
+  return ok;
+}
+
+bool EPGManager::FetchDetails(const std::vector<std::string>& itemIds,
+                              std::unordered_map<std::string, ProgrammeDetails>& fetched)
+{
+  std::ostringstream endpoint;
+  endpoint << "/Items?userId=" << m_userId << "&Fields=Overview&ids=";
+  for (size_t i = 0; i < itemIds.size(); i++)
+    endpoint << (i > 0 ? "," : "") << itemIds[i];
+  
+  Json::Value response;
+  if (!m_connection->SendRequest(endpoint.str(), response))
+  {
+    Logger::Log(ADDON_LOG_ERROR, "Failed to load programme details");
+    return false;
+  }
+  
+  if (response.isMember("Items") && response["Items"].isArray())
+  {
+    const Json::Value& items = response["Items"];
+    for (unsigned int i = 0; i < items.size(); i++)
+    {
+      if (!items[i].isMember("Id"))
+        continue;
+      
+      EPGEntry entry;
+      ParseProgramme(items[i], entry);
       
-      if (item.isMember("SeriesId") && item.isMember("IndexNumber"))
+      ProgrammeDetails& details = fetched[entry.itemId];
+      details.plot = std::move(entry.plot);
+      details.episodeTitle = std::move(entry.episodeTitle);
+      details.imageTag = std::move(entry.imageTag);
+      details.parentalRating = entry.parentalRating;
+      details.seriesNumber = entry.seriesNumber;
+      details.endTime = entry.endTime;
+    }
+  }
+  
+  return true;
+}
+
+bool EPGManager::ApplyDetailsLocked(std::vector<EPGEntry>& entries) const
+{
+  bool modified = false;
+  for (auto& entry : entries)
+  {
+    auto it = m_details.find(entry.itemId);
+    if (it == m_details.end())
+      continue;
+    
+    const ProgrammeDetails& details = it->second;
+    if (entry.plot == details.plot && entry.episodeTitle == details.episodeTitle &&
+        entry.imageTag == details.imageTag && entry.parentalRating == details.parentalRating &&
+        entry.seriesNumber == details.seriesNumber)
+      continue;
+    
+    entry.plot = details.plot;
+    entry.episodeTitle = details.episodeTitle;
+    entry.imageTag = details.imageTag;
+    entry.parentalRating = details.parentalRating;
+    entry.seriesNumber = details.seriesNumber;
+    modified = true;
+  }
+  return modified;
+}
+
+void EPGManager::ApplyDetailsLocked(std::map<std::string, std::vector<EPGEntry>>& fetched) const
+{
+  // Programmes enriched before keep their details across slim refreshes
+  if (!m_slimIngest)
+    return;
+  
+  for (auto& channel : fetched)
+    ApplyDetailsLocked(channel.second);
+}
+
+void EPGManager::MergeEntries(std::map<std::string, std::vector<EPGEntry>>& fetched,
+                              std::set<std::string>& changed)
+{
+  for (auto& channel : fetched)
+  {
+    // Published schedules are immutable, so merge into a decoded copy
+    auto existing = m_schedules.find(channel.first);
+    std::vector<EPGEntry> entries;
+    if (existing != m_schedules.end())
+      entries = existing->second->ToEntries();
+    bool modified = false;
+    
+    // Programmes at interval edges come back from both neighbouring fetches;
+    // a repeated ID replaces the older copy
+    std::unordered_map<std::string, size_t> positions;
+    positions.reserve(entries.size());
+    for (size_t i = 0; i < entries.size(); i++)
+      positions[entries[i].itemId] = i;
+    
+    for (auto& entry : channel.second)
+    {
+      auto it = positions.find(entry.itemId);
+      if (it != positions.end())
       {
-        entry.seriesNumber = item["IndexNumber"].asInt();
+        if (!SameEntry(entries[it->second], entry))
+        {
+          entries[it->second] = std::move(entry);
+          modified = true;
+        }
       }
       else
       {
-        entry.seriesNumber = 0;
+        positions[entry.itemId] = entries.size();
+        entries.push_back(std::move(entry));
+        modified = true;
       }
-      
-      // Store in cache organized by channel ID
-      m_epgCache[channelId].push_back(entry);
     }
+    
+    if (!modified)
+      continue;
+    
+    m_schedules[channel.first] = std::make_shared<ChannelSchedule>(std::move(entries), m_arena);
+    changed.insert(channel.first);
   }
+}
+
+void EPGManager::PruneExpired(time_t now)
+{
+  time_t horizon = now - GetLookbackSeconds();
+  m_coverage.TrimBefore(horizon);
   
-  m_lastEPGUpdate = std::time(nullptr);
-  Logger::Log(ADDON_LOG_INFO, "Loaded EPG data for %d channels", static_cast<int>(m_epgCache.size()));
+  for (auto it = m_details.begin(); it != m_details.end();)
+  {
+    if (it->second.endTime < horizon)
+      it = m_details.erase(it);
+    else
+      ++it;
+  }
   
-  return true;
+  for (auto it = m_schedules.begin(); it != m_schedules.end();)
+  {
+    const ChannelSchedule& current = *it->second;
+    
+    bool anyExpired = false;
+    for (size_t i = 0; i < current.Size() && !anyExpired; i++)
+      anyExpired = current.GetEndTime(i) < horizon;
+    
+    if (!anyExpired)
+    {
+      ++it;
+      continue;
+    }
+    
+    std::vector<EPGEntry> entries = current.ToEntries();
+    entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                 [horizon](const EPGEntry& e) { return e.endTime < horizon; }),
+                  entries.end());
+    
+    if (entries.empty())
+    {
+      it = m_schedules.erase(it);
+    }
+    else
+    {
+      it->second = std::make_shared<ChannelSchedule>(std::move(entries), m_arena);
+      ++it;
+    }
+  }
 }
 
-PVR_ERROR EPGManager::GetEPGForChannel(int channelUid, time_t start, time_t end,
-                                       kodi::addon::PVREPGTagsResultSet& results,
-                                       const std::string& jellyfinChannelId)
+EPGManager::Published EPGManager::Publish()
 {
-  // Check if we need to refresh the cache
-  time_t now = std::time(nullptr);
-  if (m_epgCache.empty() || (now - m_lastEPGUpdate) > 3600) // Refresh every hour
+  auto snapshot = std::make_shared<EPGSnapshot>();
+  snapshot->channels = m_schedules;
+  snapshot->coverage = m_coverage;
+  snapshot->refreshedAt = m_lastFullRefresh;
+  Published published;
+  published.current = snapshot;
+  published.previous = std::atomic_exchange(&m_snapshot, published.current);
+  
+  m_nowNext.Update(m_schedules);
+  if (m_scheduleListener)
+    m_scheduleListener(m_schedules);
+  
+  // Titles are shared through the arena and counted once
+  size_t bytes = m_arena->MemoryUsage();
+  for (const auto& channel : m_schedules)
+    bytes += channel.second->MemoryUsage();
+  for (const auto& details : m_details)
+  {
+    bytes += sizeof(details) + details.first.capacity() + details.second.plot.capacity() +
+             details.second.episodeTitle.capacity() + details.second.imageTag.capacity();
+  }
+  m_memoryUsage = bytes;
+  return published;
+}
+
+void EPGManager::NotifyChanged(const Published& published, const std::set<std::string>& changed)
+{
+  bool firstPublish;
+  {
+    std::lock_guard<std::mutex> lock(m_refreshMutex);
+    // Kodi has nothing to re-read before its first answer, unless it was
+    // turned away while the first load was failing
+    firstPublish = !m_firstLoadDone && !m_servedError;
+    m_servedError = false;
+  }
+  
+  if (!m_instance || !m_channelUidLookup || changed.empty() || firstPublish)
+    return;
+  
+  // Tags are diffed between the two snapshots' schedules, not against
+  // whatever is current: other threads publish too. Guides read from a
+  // shared store have no schedules, so Kodi re-reads those channels whole.
+  const std::shared_ptr<const EPGSnapshot>& previous = published.previous;
+  const std::shared_ptr<const EPGSnapshot>& current = published.current;
+  bool push = previous && !previous->view && current && !current->view;
+  
+  PushStats stats;
+  for (const auto& channelId : changed)
   {
-    if (!LoadEPGData(start, end))
+    int uid = m_channelUidLookup(channelId);
+    if (uid < 0)
+      continue;
+    
+    if (push)
     {
-      return PVR_ERROR_SERVER_ERROR;
+      auto before = previous->channels.find(channelId);
+      auto after = current->channels.find(channelId);
+      if (PushChannelChanges(uid, channelId,
+                             before != previous->channels.end() ? before->second.get() : nullptr,
+                             after != current->channels.end() ? after->second.get() : nullptr, stats))
+        continue;
     }
+    
+    m_instance->TriggerEpgUpdate(static_cast<unsigned int>(uid));
+    stats.reloaded++;
   }
   
-  // Find entries for this specific channel from cache
-  auto it = m_epgCache.find(jellyfinChannelId);
-  if (it == m_epgCache.end())
+  // Everything Kodi already has that was not pushed again
+  size_t suppressed = 0;
+  if (push)
   {
-    // No EPG data for this channel
-    return PVR_ERROR_NO_ERROR;
+    for (const auto& channel : current->channels)
+      suppressed += channel.second->Size();
+    suppressed -= std::min(suppressed, stats.created + stats.updated);
   }
   
-  int addedCount = 0;
+  Logger::Log(ADDON_LOG_INFO, "EPG push: %d tags created, %d updated, %d deleted, %d suppressed; %d channel(s) reloaded",
+              static_cast<int>(stats.created), static_cast<int>(stats.updated),
+              static_cast<int>(stats.deleted), static_cast<int>(suppressed), static_cast<int>(stats.reloaded));
+}
+
+bool EPGManager::PushChannelChanges(int channelUid, const std::string& channelId,
+                                    const ChannelSchedule* before, const ChannelSchedule* after,
+                                    PushStats& stats)
+{
+  static const std::vector<ChannelSchedule::Day> noDays;
+  const std::vector<ChannelSchedule::Day>& beforeDays = before ? before->GetDays() : noDays;
+  const std::vector<ChannelSchedule::Day>& afterDays = after ? after->GetDays() : noDays;
   
-  for (const auto& entry : it->second)
+  // Walk both day lists in step; only days whose hash differs are decoded.
+  // Across all changed days at once, so a programme moved to another day is
+  // an update rather than a delete and a create.
+  std::unordered_map<std::string, EPGEntry> removed;
+  std::vector<EPGEntry> candidates;
+  size_t i = 0;
+  size_t j = 0;
+  while (i < beforeDays.size() || j < afterDays.size())
   {
-    kodi::addon::PVREPGTag tag;
+    const ChannelSchedule::Day* oldDay = i < beforeDays.size() ? &beforeDays[i] : nullptr;
+    const ChannelSchedule::Day* newDay = j < afterDays.size() ? &afterDays[j] : nullptr;
+    if (oldDay && newDay && oldDay->start != newDay->start)
+    {
+      if (oldDay->start < newDay->start)
+        newDay = nullptr;
+      else
+        oldDay = nullptr;
+    }
     
-    // Generate unique broadcast ID from hash
-    std::hash<std::string> hasher;
-    unsigned int broadcastId = static_cast<unsigned int>(hasher(entry.itemId));
+    if (oldDay)
+      i++;
+    if (newDay)
+      j++;
     
-    tag.SetUniqueBroadcastId(broadcastId);
-    tag.SetUniqueChannelId(channelUid);
-    tag.SetTitle(entry.title);
-    tag.SetPlot(entry.plot);
-    tag.SetStartTime(entry.startTime);
-    tag.SetEndTime(entry.endTime);
+    if (oldDay && newDay && oldDay->contentHash == newDay->contentHash)
+      continue;
     
-    if (!entry.episodeTitle.empty())
+    if (oldDay)
     {
-      tag.SetEpisodeName(entry.episodeTitle);
+      for (size_t k = oldDay->firstIndex; k < oldDay->firstIndex + oldDay->count; k++)
+      {
+        EPGEntry entry;
+        before->GetEntry(k, entry);
+        removed[entry.itemId] = std::move(entry);
+      }
     }
     
-    if (entry.parentalRating > 0)
+    if (newDay)
     {
-      tag.SetParentalRating(entry.parentalRating);
+      for (size_t k = newDay->firstIndex; k < newDay->firstIndex + newDay->count; k++)
+      {
+        candidates.emplace_back();
+        after->GetEntry(k, candidates.back());
+      }
     }
-    
-    if (entry.seriesNumber > 0)
+  }
+  
+  std::vector<std::pair<const EPGEntry*, EPG_EVENT_STATE>> events;
+  for (const auto& entry : candidates)
+  {
+    auto old = removed.find(entry.itemId);
+    if (old == removed.end())
     {
-      tag.SetSeriesNumber(entry.seriesNumber);
+      events.emplace_back(&entry, EPG_EVENT_CREATED);
+      continue;
     }
     
+    if (!SameEntry(old->second, entry))
+      events.emplace_back(&entry, EPG_EVENT_UPDATED);
+    removed.erase(old);
+  }
+  // Programmes that only aged out of the lookback window are left to Kodi
+  time_t horizon = std::time(nullptr) - GetLookbackSeconds();
+  for (const auto& entry : removed)
+  {
+    if (entry.second.endTime >= horizon)
+      events.emplace_back(&entry.second, EPG_EVENT_DELETED);
+  }
+  
+  // Past a point one reload is cheaper for Kodi than many single events
+  if (events.size() > EPG_PUSH_MAX_TAGS_PER_CHANNEL)
+    return false;
+  
+  for (const auto& event : events)
+  {
+    kodi::addon::PVREPGTag tag;
+    FillTag(*event.first, channelUid, tag);
+    m_instance->EpgEventStateChange(tag, event.second);
+    
+    if (event.second == EPG_EVENT_CREATED)
+      stats.created++;
+    else if (event.second == EPG_EVENT_UPDATED)
+      stats.updated++;
+    else
+      stats.deleted++;
+  }
+  
+  Logger::Log(ADDON_LOG_DEBUG, "Pushed %d EPG change(s) for channel %s",
+              static_cast<int>(events.size()), channelId.c_str());
+  return true;
+}
+
+std::shared_ptr<const EPGSnapshot> EPGManager::WaitForSnapshot()
+{
+  std::unique_lock<std::mutex> lock(m_refreshMutex);
+  m_refreshCondition.wait(lock, [this] { return m_firstLoadDone || !m_refreshRunning; });
+  
+  std::shared_ptr<const EPGSnapshot> snapshot = std::atomic_load(&m_snapshot);
+  if (!snapshot)
+    m_servedError = true;
+  return snapshot;
+}
+
+void EPGManager::RequestWindow(time_t end)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_refreshMutex);
+    if (end <= m_requestedEnd)
+      return;
+    
+    m_requestedEnd = end;
+    m_refreshRequested = true;
+  }
+  m_refreshCondition.notify_all();
+}
+
+void EPGManager::RequestChannel(const std::string& channelId, time_t end)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_refreshMutex);
+    if (m_demandInFlight.count(channelId) > 0)
+      return;
+    
+    auto fetched = m_demandFetched.find(channelId);
+    if (fetched != m_demandFetched.end() && fetched->second.expires > std::time(nullptr) &&
+        fetched->second.end >= end)
+      return;
+    
+    time_t& pending = m_demandPending[channelId];
+    pending = std::max(pending, end);
+    m_refreshRequested = true;
+  }
+  m_refreshCondition.notify_all();
+}
+
+void EPGManager::FillTag(const EPGEntry& entry, int channelUid, kodi::addon::PVREPGTag& tag)
+{
+  // Generate unique broadcast ID from hash
+  std::hash<std::string> hasher;
+  unsigned int broadcastId = static_cast<unsigned int>(hasher(entry.itemId));
+  
+  tag.SetUniqueBroadcastId(broadcastId);
+  tag.SetUniqueChannelId(channelUid);
+  tag.SetTitle(entry.title);
+  tag.SetPlot(entry.plot);
+  tag.SetStartTime(entry.startTime);
+  tag.SetEndTime(entry.endTime);
+  
+  if (!entry.episodeTitle.empty())
+  {
+    tag.SetEpisodeName(entry.episodeTitle);
+  }
+  
+  if (entry.parentalRating > 0)
+  {
+    tag.SetParentalRating(entry.parentalRating);
+  }
+  
+  if (entry.seriesNumber > 0)
+  {
+    tag.SetSeriesNumber(entry.seriesNumber);
+  }
+  
+  if (m_artwork && !entry.imageTag.empty())
+  {
+    tag.SetIconPath(m_artwork->GetImagePath(entry.itemId, entry.imageTag, ArtworkKind::ProgrammePoster));
+  }
+}
+
+PVR_ERROR EPGManager::GetEPGForChannel(int channelUid, time_t start, time_t end,
+                                       kodi::addon::PVREPGTagsResultSet& results,
+                                       const std::string& jellyfinChannelId)
+{
+  std::shared_ptr<const EPGSnapshot> snapshot = WaitForSnapshot();
+  auto callStart = std::chrono::steady_clock::now();
+  if (!snapshot)
+  {
+    return PVR_ERROR_SERVER_ERROR;
+  }
+  
+  // Windows (or channels) we don't hold yet are loaded in the background;
+  // Kodi is told about the tags that change once they arrive
+  if (m_demandMode)
+  {
+    RequestChannel(jellyfinChannelId, end);
+  }
+  else
+  {
+    time_t horizon = std::max(start, std::time(nullptr) - GetLookbackSeconds());
+    if (!snapshot->coverage.Gaps(horizon, end).empty())
+    {
+      RequestWindow(end);
+    }
+  }
+  
+  int addedCount = 0;
+  
+  // Only programmes of this channel overlapping the requested window go back to Kodi
+  snapshot->ForEachInRange(jellyfinChannelId, start, end, [&](const EPGEntry& entry) {
+    kodi::addon::PVREPGTag tag;
+    FillTag(entry, channelUid, tag);
     results.Add(tag);
     addedCount++;
-  }
+  });
+  
+  if (m_slimIngest && addedCount > 0)
+    RequestDetails(jellyfinChannelId, start, end);
   
-  Logger::Log(ADDON_LOG_DEBUG, "Added %d EPG entries for channel UID %d (%s)", 
-              addedCount, channelUid, jellyfinChannelId.c_str());
+  // Includes decompressing any description blocks that were not cached
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - callStart);
+  Logger::Log(ADDON_LOG_DEBUG, "Added %d EPG entries for channel UID %d (%s) in %d us", 
+              addedCount, channelUid, jellyfinChannelId.c_str(), static_cast<int>(elapsed.count()));
   
   return PVR_ERROR_NO_ERROR;
 }
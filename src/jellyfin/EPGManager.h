@@ -4,40 +4,288 @@
 #include <vector>
 #include <map>
 #include <ctime>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <set>
+#include <unordered_map>
 #include <kodi/addon-instance/PVR.h>
+#include "../utilities/IntervalSet.h"
+#include "ChannelSchedule.h"
+#include "NowNextIndex.h"
 
 class Connection;
+class ArtworkManager;
+class EPGStoreView;
+class SharedEPGStore;
+class StringArena;
 
-struct EPGEntry
+// Immutable view of the guide published by the refresh thread. Readers keep
+// a shared_ptr to it, so a refresh never blocks or invalidates them. Between
+// full refreshes, channels that did not change are shared by consecutive
+// snapshots.
+struct EPGSnapshot
 {
-  std::string itemId;
-  std::string channelId;
-  std::string title;
-  std::string plot;
-  std::string episodeTitle;
-  time_t startTime;
-  time_t endTime;
-  int parentalRating;
-  int seriesNumber;
+  std::map<std::string, std::shared_ptr<const ChannelSchedule>> channels;
+  IntervalSet coverage;
+  time_t refreshedAt = 0;   // Time of the last full refresh
+  
+  // Set instead of channels when the guide is read from a SharedEPGStore
+  std::shared_ptr<const EPGStoreView> view;
+  
+  // Programmes of one channel overlapping [start, end), in start order
+  void ForEachInRange(const std::string& channelId, time_t start, time_t end,
+                      const std::function<void(const EPGEntry&)>& callback) const;
+};
+
+// How the guide is fetched from the server
+enum class EPGFetchMode
+{
+  Auto,       // OnDemand for large lineups, Bulk otherwise
+  Bulk,       // The whole window for all channels in one call
+  OnDemand    // Each channel when Kodi first asks for it, in batches
+};
+
+// How much of the guide is given up to stay within a memory budget; each
+// level includes the ones before it
+enum class EPGTrim
+{
+  None,
+  PastProgrammes,   // Nothing that has already ended
+  Horizon,          // Only the next day
+  Descriptions      // Descriptions of the next few hours only
 };
 
 class EPGManager
 {
 public:
-  EPGManager(Connection* connection, const std::string& userId);
-  ~EPGManager() = default;
+  EPGManager(Connection* connection, const std::string& userId,
+             kodi::addon::CInstancePVRClient* instance, ArtworkManager* artwork);
+  ~EPGManager();
 
+  // Answers from the published snapshot only. Waits for the first load;
+  // after that a window (in on-demand mode, a channel) that is not cached
+  // yet is handed to the refresh thread and Kodi is told to ask again once
+  // it is in.
   PVR_ERROR GetEPGForChannel(int channelUid, time_t start, time_t end,
                             kodi::addon::PVREPGTagsResultSet& results,
                             const std::string& jellyfinChannelId);
   
-  bool LoadEPGData(time_t start, time_t end);
+  // Background thread doing a full refresh every intervalMinutes (0 only
+  // loads what Kodi asks for) and publishing a new snapshot each time
+  void StartBackgroundRefresh(int intervalMinutes);
+  void StopBackgroundRefresh();
+  
+  // Programmes that ended more than this long ago are dropped
+  void SetLookbackHours(int hours);
+  
+  // Only programmes on channels accepted by the filter are kept. ready is
+  // asked once per fetch and may block until the lineup is known; when it
+  // returns false (the lineup failed to load) nothing is filtered out.
+  void SetChannelFilter(std::function<bool()> ready, std::function<bool(const std::string&)> filter)
+  {
+    m_channelFilterReady = std::move(ready);
+    m_channelFilter = std::move(filter);
+  }
+  
+  // Maps a Jellyfin channel ID to its Kodi UID (negative if unknown), used
+  // to tell Kodi which channels changed after a refresh
+  void SetChannelUidLookup(std::function<int(const std::string&)> lookup) { m_channelUidLookup = std::move(lookup); }
+  
+  // Must be called before StartBackgroundRefresh. Auto uses the lineup
+  // size lookup, which may block until the lineup is known.
+  void SetFetchMode(EPGFetchMode mode) { m_fetchMode = mode; }
+  void SetLineupSizeLookup(std::function<int()> lookup) { m_lineupSizeLookup = std::move(lookup); }
+  
+  // Download only titles and times for the guide; the rest of a programme
+  // is fetched once Kodi asks for a window containing it. Must be called
+  // before StartBackgroundRefresh.
+  void SetSlimIngest(bool slim) { m_slimIngest = slim; }
+  
+  // Now and next of every channel in the guide, with programme boundary
+  // events. Instances reading a shared store hold no schedules in memory,
+  // so their index stays empty.
+  NowNextIndex& GetNowNextIndex() { return m_nowNext; }
+  
+  // Called with every guide published, after the now/next index, on the
+  // thread that published it and with the guide locked; must be quick.
+  // Set before StartBackgroundRefresh.
+  using ScheduleListener = std::function<void(const std::map<std::string, std::shared_ptr<const ChannelSchedule>>&)>;
+  void SetScheduleListener(ScheduleListener listener) { m_scheduleListener = std::move(listener); }
+  
+  // Memory held by the guide as of the last published snapshot, including
+  // programme details fetched for a slim guide
+  size_t GetMemoryUsage() const { return m_memoryUsage; }
+  
+  // Applies to the guide held now and to every refresh until the level is
+  // lowered. Kodi keeps the tags it already has; only our copy shrinks. A
+  // guide read from a shared store is left alone.
+  void SetTrimLevel(EPGTrim level);
+  
+  // Share the guide with other instances on this host using the same key
+  // (server and user). Must be called before StartBackgroundRefresh.
+  bool EnableSharedStore(const std::string& key);
 
 private:
+  using ScheduleMap = std::map<std::string, std::shared_ptr<const ChannelSchedule>>;
+  
   Connection* m_connection;
   std::string m_userId;
+  kodi::addon::CInstancePVRClient* m_instance;
+  ArtworkManager* m_artwork;
+  
+  // Writer state, owned by whoever holds m_mutex (normally the refresh thread)
+  std::mutex m_mutex;
+  ScheduleMap m_schedules;
+  IntervalSet m_coverage;
+  std::shared_ptr<StringArena> m_arena;   // Titles of the current generation
+  time_t m_lastFullRefresh;
+  std::atomic<time_t> m_lookbackSeconds;
+  std::atomic<EPGTrim> m_trimLevel;
+  std::atomic<size_t> m_memoryUsage;
+  std::function<bool()> m_channelFilterReady;
+  std::function<bool(const std::string&)> m_channelFilter;
+  std::function<int(const std::string&)> m_channelUidLookup;
+  std::function<int()> m_lineupSizeLookup;
+  ScheduleListener m_scheduleListener;
+  EPGFetchMode m_fetchMode;
+  std::atomic<bool> m_demandMode;   // Resolved from m_fetchMode by the refresh thread
+  
+  // Slim ingest: details fetched so far, applied to every schedule built
+  // from a slim fetch
+  struct ProgrammeDetails
+  {
+    std::string plot;
+    std::string episodeTitle;
+    std::string imageTag;
+    int parentalRating = 0;
+    int seriesNumber = 0;
+    time_t endTime = 0;
+  };
+  bool m_slimIngest;
+  std::unordered_map<std::string, ProgrammeDetails> m_details;
+  
+  // Current snapshot, swapped with std::atomic_load / std::atomic_store
+  std::shared_ptr<const EPGSnapshot> m_snapshot;
+  NowNextIndex m_nowNext;   // Follows every published snapshot
+  std::string m_storePath;
+  std::string m_storeOwner;   // Server and user, recorded in the store file
+  
+  // Cross-process store; only the instance holding its writer lock fetches
+  std::unique_ptr<SharedEPGStore> m_sharedStore;
+  uint64_t m_sharedGeneration;
+  std::map<std::string, uint64_t> m_sharedHashes;
+  
+  // Refresh thread; the fields below m_refreshMutex are guarded by it
+  std::thread m_refreshThread;
+  std::chrono::steady_clock::time_point m_refreshStarted;
+  std::atomic<bool> m_refreshRunning;
+  std::mutex m_refreshMutex;
+  std::condition_variable m_refreshCondition;
+  time_t m_requestedEnd;
+  bool m_refreshRequested;
+  bool m_firstLoadDone;
+  bool m_servedError;
+  
+  // On-demand mode: channels Kodi asked for that are waiting for the next
+  // batch (with the end of the window asked for), being fetched, or cached
+  struct DemandState
+  {
+    time_t expires;
+    time_t end;
+  };
+  std::map<std::string, time_t> m_demandPending;
+  std::set<std::string> m_demandInFlight;
+  std::map<std::string, DemandState> m_demandFetched;
+  time_t m_lastStoreSave;   // Only touched by the refresh thread
+  
+  // Detail thread for slim ingest: windows Kodi asked for that still need
+  // details, and the windows of each channel that have them
+  struct DetailRequest
+  {
+    std::string channelId;
+    time_t start;
+    time_t end;
+  };
+  std::thread m_detailThread;
+  std::mutex m_detailMutex;
+  std::condition_variable m_detailCondition;
+  std::vector<DetailRequest> m_detailPending;
+  std::map<std::string, IntervalSet> m_detailCoverage;
+  
+  void RefreshLoop(int intervalMinutes);
+  bool LoadStore();
+  bool ReadSharedStore();
+  bool AdoptSharedStore();
+  void ResolveFetchMode();
+  bool Refresh(time_t end, bool full);
+  bool LoadInPhases(time_t end);
+  bool RefreshSlice(time_t start, time_t end);
+  void SaveStore();
+  bool RefreshChannels(const std::map<std::string, time_t>& batch, time_t ttl);
+  std::shared_ptr<const EPGSnapshot> WaitForSnapshot();
+  void RequestWindow(time_t end);
+  void RequestChannel(const std::string& channelId, time_t end);
+  
+  // The guide is downloaded without m_mutex, which is then taken to merge
+  // and publish. LoadEPGData fetches what [start, end) is missing,
+  // ReplaceEPGData all of it.
+  struct Published;
+  bool LoadEPGData(time_t start, time_t end, std::set<std::string>& changed, Published& published);
+  bool ReplaceEPGData(time_t start, time_t end, std::set<std::string>& changed, Published& published);
+  // One time slice of a fetch, filled by FetchEPGSlice on a worker thread
+  struct FetchedSlice
+  {
+    time_t start;
+    time_t end;
+    std::map<std::string, std::vector<EPGEntry>> channels;
+    int skipped = 0;
+    size_t bytes = 0;
+  };
+  
+  // Without m_mutex; the caller applies known details under it
+  bool FetchEPGRange(time_t start, time_t end, std::map<std::string, std::vector<EPGEntry>>& fetched,
+                     const std::vector<std::string>& channelIds = {});
+  bool FetchEPGSlice(const std::vector<std::string>& channelIds, FetchedSlice& slice);
+  
+  void DetailLoop();
+  void RequestDetails(const std::string& channelId, time_t start, time_t end);
+  void RequeueDetails();
+  bool EnrichDetails(const std::vector<DetailRequest>& batch);
+  // Without m_mutex; the caller merges the result into m_details
+  bool FetchDetails(const std::vector<std::string>& itemIds,
+                    std::unordered_map<std::string, ProgrammeDetails>& fetched);
+  bool ApplyDetailsLocked(std::vector<EPGEntry>& entries) const;
+  void ApplyDetailsLocked(std::map<std::string, std::vector<EPGEntry>>& fetched) const;
+  void MergeEntries(std::map<std::string, std::vector<EPGEntry>>& fetched, std::set<std::string>& changed);
+  time_t GetLookbackSeconds() const;
+  time_t GetFutureSeconds() const;
+  void PruneExpired(time_t now);
+  
+  // The snapshot a publish replaced and the one it produced
+  struct Published
+  {
+    std::shared_ptr<const EPGSnapshot> previous;
+    std::shared_ptr<const EPGSnapshot> current;
+  };
+  Published Publish();
+  void LogStoreStats() const;
   
-  // Cache EPG data organized by channel ID
-  std::map<std::string, std::vector<EPGEntry>> m_epgCache;
-  time_t m_lastEPGUpdate;
+  // Tells Kodi what changed between two snapshots, as single tag events
+  // where the days that differ are few, otherwise as a channel reload
+  struct PushStats
+  {
+    size_t created = 0;
+    size_t updated = 0;
+    size_t deleted = 0;
+    size_t reloaded = 0;
+  };
+  void NotifyChanged(const Published& published, const std::set<std::string>& changed);
+  bool PushChannelChanges(int channelUid, const std::string& channelId,
+                          const ChannelSchedule* before, const ChannelSchedule* after, PushStats& stats);
+  void FillTag(const EPGEntry& entry, int channelUid, kodi::addon::PVREPGTag& tag);
 };
@@ -0,0 +1,439 @@
+#include "EPGStoreFile.h"
+#include "../utilities/Logger.h"
+#include <kodi/Filesystem.h>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace
+{
+
+const uint32_t STORE_MAGIC = 0x4750454A;   // "JEPG"
+const uint32_t STORE_VERSION = 3;
+
+struct StringRef
+{
+  uint32_t offset;
+  uint32_t length;
+};
+
+struct FileHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t channelCount;
+  uint32_t coverageCount;
+  uint32_t entryCount;
+  uint32_t reserved;
+  int64_t refreshedAt;
+  uint64_t stringBytes;
+  StringRef owner;
+};
+
+struct ChannelRecord
+{
+  StringRef id;
+  uint32_t firstEntry;
+  uint32_t entryCount;
+  int64_t maxDuration;
+  uint64_t contentHash;
+};
+
+struct CoverageRecord
+{
+  int64_t start;
+  int64_t end;
+};
+
+struct EntryRecord
+{
+  int64_t startTime;
+  int64_t endTime;
+  StringRef itemId;
+  StringRef title;
+  StringRef plot;
+  StringRef episodeTitle;
+  StringRef imageTag;
+  int32_t parentalRating;
+  int32_t seriesNumber;
+};
+
+// Every section starts 8-byte aligned, so records can be read in place
+static_assert(sizeof(FileHeader) == 48, "unexpected FileHeader layout");
+static_assert(sizeof(ChannelRecord) == 32, "unexpected ChannelRecord layout");
+static_assert(sizeof(CoverageRecord) == 16, "unexpected CoverageRecord layout");
+static_assert(sizeof(EntryRecord) == 64, "unexpected EntryRecord layout");
+
+class StringSection
+{
+public:
+  bool Add(const std::string& value, StringRef& ref)
+  {
+    if (m_data.size() + value.size() > std::numeric_limits<uint32_t>::max())
+      return false;
+    
+    ref.offset = static_cast<uint32_t>(m_data.size());
+    ref.length = static_cast<uint32_t>(value.size());
+    m_data.append(value);
+    return true;
+  }
+  
+  const std::string& Data() const { return m_data; }
+
+private:
+  std::string m_data;
+};
+
+template<typename T>
+void AppendRecords(std::string& buffer, const std::vector<T>& records)
+{
+  if (!records.empty())
+    buffer.append(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(T));
+}
+
+void HashCombine(uint64_t& seed, uint64_t value)
+{
+  seed ^= value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2);
+}
+
+uint64_t HashEntries(const std::vector<EPGEntry>& entries)
+{
+  std::hash<std::string> hasher;
+  uint64_t hash = entries.size();
+  
+  for (const auto& entry : entries)
+  {
+    HashCombine(hash, hasher(entry.itemId));
+    HashCombine(hash, hasher(entry.title));
+    HashCombine(hash, hasher(entry.plot));
+    HashCombine(hash, hasher(entry.episodeTitle));
+    HashCombine(hash, hasher(entry.imageTag));
+    HashCombine(hash, static_cast<uint64_t>(entry.startTime));
+    HashCombine(hash, static_cast<uint64_t>(entry.endTime));
+    HashCombine(hash, static_cast<uint64_t>(entry.parentalRating));
+    HashCombine(hash, static_cast<uint64_t>(entry.seriesNumber));
+  }
+  return hash;
+}
+
+bool ValidRef(const StringRef& ref, uint64_t stringBytes)
+{
+  return static_cast<uint64_t>(ref.offset) + ref.length <= stringBytes;
+}
+
+} // namespace
+
+namespace EPGStoreFile
+{
+
+bool Save(const std::string& path, const EPGSnapshot& snapshot, const std::string& owner)
+{
+  StringSection strings;
+  std::vector<ChannelRecord> channels;
+  std::vector<CoverageRecord> coverage;
+  std::vector<EntryRecord> entries;
+  
+  StringRef ownerRef;
+  if (!strings.Add(owner, ownerRef))
+    return false;
+  
+  channels.reserve(snapshot.channels.size());
+  
+  // snapshot.channels is ordered by ID, which keeps the records searchable
+  for (const auto& channel : snapshot.channels)
+  {
+    const ChannelSchedule& schedule = *channel.second;
+    std::vector<EPGEntry> programmes = schedule.ToEntries();
+    
+    ChannelRecord channelRecord;
+    channelRecord.firstEntry = static_cast<uint32_t>(entries.size());
+    channelRecord.entryCount = static_cast<uint32_t>(programmes.size());
+    channelRecord.maxDuration = schedule.GetMaxDuration();
+    channelRecord.contentHash = HashEntries(programmes);
+    if (!strings.Add(channel.first, channelRecord.id))
+      return false;
+    channels.push_back(channelRecord);
+    
+    for (const auto& entry : programmes)
+    {
+      EntryRecord record;
+      record.startTime = entry.startTime;
+      record.endTime = entry.endTime;
+      record.parentalRating = entry.parentalRating;
+      record.seriesNumber = entry.seriesNumber;
+      
+      if (!strings.Add(entry.itemId, record.itemId) ||
+          !strings.Add(entry.title, record.title) ||
+          !strings.Add(entry.plot, record.plot) ||
+          !strings.Add(entry.episodeTitle, record.episodeTitle) ||
+          !strings.Add(entry.imageTag, record.imageTag))
+      {
+        Logger::Log(ADDON_LOG_WARNING, "EPG too large for the on-disk store, not saving");
+        return false;
+      }
+      
+      entries.push_back(record);
+    }
+  }
+  
+  for (const auto& interval : snapshot.coverage.GetIntervals())
+  {
+    coverage.push_back({static_cast<int64_t>(interval.first), static_cast<int64_t>(interval.second)});
+  }
+  
+  FileHeader header;
+  std::memset(&header, 0, sizeof(header));
+  header.magic = STORE_MAGIC;
+  header.version = STORE_VERSION;
+  header.channelCount = static_cast<uint32_t>(channels.size());
+  header.coverageCount = static_cast<uint32_t>(coverage.size());
+  header.entryCount = static_cast<uint32_t>(entries.size());
+  header.refreshedAt = snapshot.refreshedAt;
+  header.stringBytes = strings.Data().size();
+  header.owner = ownerRef;
+  
+  std::string buffer;
+  buffer.reserve(sizeof(header) + channels.size() * sizeof(ChannelRecord) +
+                 coverage.size() * sizeof(CoverageRecord) + entries.size() * sizeof(EntryRecord) +
+                 strings.Data().size());
+  buffer.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  AppendRecords(buffer, channels);
+  AppendRecords(buffer, coverage);
+  AppendRecords(buffer, entries);
+  buffer.append(strings.Data());
+  
+  // Write next to the old store and swap, so a crash never leaves a torn file
+  // and processes that still map the old one keep a valid copy
+  std::string tempPath = path + ".tmp";
+  {
+    kodi::vfs::CFile file;
+    if (!file.OpenFileForWrite(tempPath, true))
+    {
+      Logger::Log(ADDON_LOG_WARNING, "Failed to write EPG store: %s", tempPath.c_str());
+      return false;
+    }
+    
+    if (file.Write(buffer.data(), buffer.size()) != static_cast<ssize_t>(buffer.size()))
+    {
+      file.Close();
+      kodi::vfs::DeleteFile(tempPath);
+      return false;
+    }
+  }
+  
+  if (kodi::vfs::FileExists(path))
+    kodi::vfs::DeleteFile(path);
+  
+  if (!kodi::vfs::RenameFile(tempPath, path))
+  {
+    kodi::vfs::DeleteFile(tempPath);
+    return false;
+  }
+  
+  Logger::Log(ADDON_LOG_DEBUG, "Saved EPG store: %d channels, %d programmes, %d bytes",
+              static_cast<int>(channels.size()), static_cast<int>(entries.size()),
+              static_cast<int>(buffer.size()));
+  return true;
+}
+
+bool Load(const std::string& path, const std::string& owner, EPGSnapshot& snapshot,
+          const std::shared_ptr<StringArena>& arena)
+{
+  EPGStoreView view;
+  if (!view.Open(path, owner))
+    return false;
+  
+  Materialize(view, snapshot, arena);
+  return true;
+}
+
+void Materialize(const EPGStoreView& view, EPGSnapshot& snapshot,
+                 const std::shared_ptr<StringArena>& arena)
+{
+  EPGSnapshot loaded;
+  loaded.refreshedAt = view.GetRefreshedAt();
+  loaded.coverage = view.GetCoverage();
+  
+  view.ForEachChannel([&loaded, &arena](const std::string& channelId, std::vector<EPGEntry>&& entries) {
+    loaded.channels[channelId] = std::make_shared<ChannelSchedule>(std::move(entries), arena);
+  });
+  
+  snapshot = std::move(loaded);
+}
+
+} // namespace EPGStoreFile
+
+bool EPGStoreView::Open(const std::string& path, const std::string& owner)
+{
+  if (!m_file.Open(path))
+    return false;
+  
+  if (m_file.Size() < sizeof(FileHeader))
+    return false;
+  
+  FileHeader header;
+  std::memcpy(&header, m_file.Data(), sizeof(header));
+  
+  if (header.magic != STORE_MAGIC || header.version != STORE_VERSION)
+  {
+    Logger::Log(ADDON_LOG_INFO, "Ignoring EPG store with unknown format (version %u)", header.version);
+    return false;
+  }
+  
+  uint64_t expectedSize = sizeof(FileHeader) +
+                          static_cast<uint64_t>(header.channelCount) * sizeof(ChannelRecord) +
+                          static_cast<uint64_t>(header.coverageCount) * sizeof(CoverageRecord) +
+                          static_cast<uint64_t>(header.entryCount) * sizeof(EntryRecord) +
+                          header.stringBytes;
+  if (expectedSize != m_file.Size())
+  {
+    Logger::Log(ADDON_LOG_WARNING, "Ignoring truncated EPG store");
+    return false;
+  }
+  
+  // A guide saved for another server or user would show the wrong channels
+  if (!ValidRef(header.owner, header.stringBytes))
+  {
+    Logger::Log(ADDON_LOG_WARNING, "Ignoring corrupt EPG store");
+    return false;
+  }
+  const char* strings = m_file.Data() + (m_file.Size() - header.stringBytes);
+  if (owner.compare(0, std::string::npos, strings + header.owner.offset, header.owner.length) != 0)
+  {
+    Logger::Log(ADDON_LOG_INFO, "Ignoring EPG store saved for another server or user");
+    return false;
+  }
+  
+  const char* cursor = m_file.Data() + sizeof(FileHeader);
+  const ChannelRecord* channels = reinterpret_cast<const ChannelRecord*>(cursor);
+  cursor += header.channelCount * sizeof(ChannelRecord);
+  const CoverageRecord* coverage = reinterpret_cast<const CoverageRecord*>(cursor);
+  cursor += header.coverageCount * sizeof(CoverageRecord);
+  const EntryRecord* entries = reinterpret_cast<const EntryRecord*>(cursor);
+  cursor += static_cast<size_t>(header.entryCount) * sizeof(EntryRecord);
+  
+  // Validate once so lookups can trust every offset
+  for (uint32_t i = 0; i < header.channelCount; i++)
+  {
+    const ChannelRecord& record = channels[i];
+    if (!ValidRef(record.id, header.stringBytes) ||
+        static_cast<uint64_t>(record.firstEntry) + record.entryCount > header.entryCount)
+    {
+      Logger::Log(ADDON_LOG_WARNING, "Ignoring corrupt EPG store");
+      return false;
+    }
+  }
+  
+  for (uint32_t i = 0; i < header.entryCount; i++)
+  {
+    const EntryRecord& record = entries[i];
+    if (!ValidRef(record.itemId, header.stringBytes) || !ValidRef(record.title, header.stringBytes) ||
+        !ValidRef(record.plot, header.stringBytes) || !ValidRef(record.episodeTitle, header.stringBytes) ||
+        !ValidRef(record.imageTag, header.stringBytes))
+    {
+      Logger::Log(ADDON_LOG_WARNING, "Ignoring corrupt EPG store");
+      return false;
+    }
+  }
+  
+  m_coverage.Clear();
+  for (uint32_t i = 0; i < header.coverageCount; i++)
+  {
+    m_coverage.Add(static_cast<time_t>(coverage[i].start), static_cast<time_t>(coverage[i].end));
+  }
+  
+  m_channels = reinterpret_cast<const char*>(channels);
+  m_entries = reinterpret_cast<const char*>(entries);
+  m_strings = cursor;
+  m_channelCount = header.channelCount;
+  m_refreshedAt = static_cast<time_t>(header.refreshedAt);
+  return true;
+}
+
+std::map<std::string, uint64_t> EPGStoreView::GetChannelHashes() const
+{
+  std::map<std::string, uint64_t> hashes;
+  const ChannelRecord* channels = reinterpret_cast<const ChannelRecord*>(m_channels);
+  
+  for (uint32_t i = 0; i < m_channelCount; i++)
+  {
+    const StringRef& id = channels[i].id;
+    hashes[std::string(m_strings + id.offset, id.length)] = channels[i].contentHash;
+  }
+  return hashes;
+}
+
+const void* EPGStoreView::FindChannel(const std::string& channelId) const
+{
+  const ChannelRecord* first = reinterpret_cast<const ChannelRecord*>(m_channels);
+  const ChannelRecord* last = first + m_channelCount;
+  
+  auto it = std::lower_bound(first, last, channelId, [this](const ChannelRecord& record, const std::string& id) {
+    return id.compare(0, std::string::npos, m_strings + record.id.offset, record.id.length) > 0;
+  });
+  
+  if (it == last || channelId.compare(0, std::string::npos, m_strings + it->id.offset, it->id.length) != 0)
+    return nullptr;
+  return it;
+}
+
+void EPGStoreView::Decode(const void* record, const std::string& channelId, EPGEntry& entry) const
+{
+  const EntryRecord& source = *static_cast<const EntryRecord*>(record);
+  auto getString = [this](const StringRef& ref) { return std::string(m_strings + ref.offset, ref.length); };
+  
+  entry.itemId = getString(source.itemId);
+  entry.channelId = channelId;
+  entry.title = getString(source.title);
+  entry.plot = getString(source.plot);
+  entry.episodeTitle = getString(source.episodeTitle);
+  entry.imageTag = getString(source.imageTag);
+  entry.startTime = static_cast<time_t>(source.startTime);
+  entry.endTime = static_cast<time_t>(source.endTime);
+  entry.parentalRating = source.parentalRating;
+  entry.seriesNumber = source.seriesNumber;
+}
+
+void EPGStoreView::ForEachInRange(const std::string& channelId, time_t start, time_t end,
+                                  const std::function<void(const EPGEntry&)>& callback) const
+{
+  const ChannelRecord* channel = static_cast<const ChannelRecord*>(FindChannel(channelId));
+  if (!channel)
+    return;
+  
+  const EntryRecord* first = reinterpret_cast<const EntryRecord*>(m_entries) + channel->firstEntry;
+  const EntryRecord* last = first + channel->entryCount;
+  
+  // Same search as ChannelSchedule::FindRange, over the mapped records
+  auto byStart = [](const EntryRecord& record, int64_t time) { return record.startTime < time; };
+  const EntryRecord* from = std::lower_bound(first, last, static_cast<int64_t>(start - channel->maxDuration), byStart);
+  const EntryRecord* to = std::lower_bound(from, last, static_cast<int64_t>(end), byStart);
+  
+  EPGEntry entry;
+  for (const EntryRecord* record = from; record != to; ++record)
+  {
+    if (record->endTime <= start)
+      continue;
+    
+    Decode(record, channelId, entry);
+    callback(entry);
+  }
+}
+
+void EPGStoreView::ForEachChannel(const std::function<void(const std::string&, std::vector<EPGEntry>&&)>& callback) const
+{
+  const ChannelRecord* channels = reinterpret_cast<const ChannelRecord*>(m_channels);
+  const EntryRecord* entries = reinterpret_cast<const EntryRecord*>(m_entries);
+  
+  for (uint32_t i = 0; i < m_channelCount; i++)
+  {
+    const ChannelRecord& channel = channels[i];
+    std::string channelId(m_strings + channel.id.offset, channel.id.length);
+    
+    std::vector<EPGEntry> schedule(channel.entryCount);
+    for (uint32_t j = 0; j < channel.entryCount; j++)
+      Decode(&entries[channel.firstEntry + j], channelId, schedule[j]);
+    
+    callback(channelId, std::move(schedule));
+  }
+}
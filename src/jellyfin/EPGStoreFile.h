@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <functional>
+#include <cstdint>
+#include "EPGManager.h"
+#include "../utilities/MappedFile.h"
+
+// Versioned binary copy of the guide, read back at startup so the EPG is
+// usable before the first download finishes, and used as the exchange format
+// of the cross-process SharedEPGStore.
+//
+// Layout: header, channel records (sorted by channel ID), coverage records
+// and fixed-size programme records, followed by a single string section that
+// the records point into by offset and length. Programmes are stored per
+// channel in start order. The header names the owner (server and user) the
+// guide was fetched for, and a store of any other owner is not loaded.
+namespace EPGStoreFile
+{
+  bool Save(const std::string& path, const EPGSnapshot& snapshot, const std::string& owner);
+  // Titles are interned into arena
+  bool Load(const std::string& path, const std::string& owner, EPGSnapshot& snapshot,
+            const std::shared_ptr<StringArena>& arena);
+  
+  // Copy a mapped store into owned schedules
+  void Materialize(const EPGStoreView& view, EPGSnapshot& snapshot,
+                   const std::shared_ptr<StringArena>& arena);
+}
+
+// Read-only view over a mapped store file. Programmes are read in place, so
+// any number of processes can serve the same file from the page cache.
+class EPGStoreView
+{
+public:
+  // Maps the file and validates every record once; fails if the store
+  // belongs to another owner
+  bool Open(const std::string& path, const std::string& owner);
+  
+  time_t GetRefreshedAt() const { return m_refreshedAt; }
+  const IntervalSet& GetCoverage() const { return m_coverage; }
+  size_t GetChannelCount() const { return m_channelCount; }
+  
+  // Channel ID -> hash of its programmes, to find what changed between files
+  std::map<std::string, uint64_t> GetChannelHashes() const;
+  
+  // Programmes of one channel overlapping [start, end), in start order
+  void ForEachInRange(const std::string& channelId, time_t start, time_t end,
+                      const std::function<void(const EPGEntry&)>& callback) const;
+  
+  // Every channel's programmes, decoded into owned strings
+  void ForEachChannel(const std::function<void(const std::string&, std::vector<EPGEntry>&&)>& callback) const;
+
+private:
+  MappedFile m_file;
+  const char* m_channels = nullptr;
+  const char* m_entries = nullptr;
+  const char* m_strings = nullptr;
+  uint32_t m_channelCount = 0;
+  time_t m_refreshedAt = 0;
+  IntervalSet m_coverage;
+  
+  const void* FindChannel(const std::string& channelId) const;
+  void Decode(const void* record, const std::string& channelId, EPGEntry& entry) const;
+};
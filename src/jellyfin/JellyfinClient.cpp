@@ -4,15 +4,29 @@
 #include "EPGManager.h"
 #include "RecordingManager.h"
 #include "AuthManager.h"
+#include "ArtworkManager.h"
+#include "AutoRecorder.h"
 #include "../utilities/Logger.h"
+#include "../utilities/MemoryGovernor.h"
 #include <json/json.h>
 #include <kodi/gui/dialogs/OK.h>
 #include <kodi/gui/dialogs/Progress.h>
 #include <thread>
 #include <chrono>
+#include <algorithm>
 
-JellyfinClient::JellyfinClient(const std::string& serverUrl, const std::string& userId, const std::string& apiKey)
-  : m_serverUrl(serverUrl)
+namespace
+{
+
+// How often cache memory is checked against the budget
+const int MEMORY_CHECK_SECONDS = 30;
+
+} // namespace
+
+JellyfinClient::JellyfinClient(kodi::addon::CInstancePVRClient* instance,
+                               const std::string& serverUrl, const std::string& userId, const std::string& apiKey)
+  : m_instance(instance)
+  , m_serverUrl(serverUrl)
   , m_userId(userId)
   , m_apiKey(apiKey)
   , m_serverVersion("Unknown")
@@ -22,7 +36,12 @@ JellyfinClient::JellyfinClient(const std::string& serverUrl, const std::string&
   m_authManager = std::make_unique<AuthManager>(m_connection.get());
 }
 
-JellyfinClient::~JellyfinClient() = default;
+JellyfinClient::~JellyfinClient()
+{
+  // The governor and the EPG refresh call into the other managers
+  m_memoryGovernor.reset();
+  m_epgManager.reset();
+}
 
 bool JellyfinClient::Initialize()
 {
@@ -187,17 +206,132 @@ bool JellyfinClient::Connect()
     return false;
   }
   
-  // Initialize managers
-  m_channelManager = std::make_unique<ChannelManager>(m_connection.get(), m_userId);
-  m_epgManager = std::make_unique<EPGManager>(m_connection.get(), m_userId);
-  m_recordingManager = std::make_unique<RecordingManager>(m_connection.get(), m_userId);
+  // Initialize managers (destroy the old ones first so no background thread
+  // outlives the artwork cache it points at)
+  m_memoryGovernor.reset();
+  m_epgManager.reset();
+  m_channelManager.reset();
+  m_recordingManager.reset();
+  
+  bool cacheArtwork = kodi::addon::GetSettingBoolean("artwork_cache", true);
+  uint64_t artworkCacheBytes = static_cast<uint64_t>(kodi::addon::GetSettingInt("artwork_cache_size", 100)) * 1024 * 1024;
+  m_artworkManager = std::make_unique<ArtworkManager>(m_connection.get(), cacheArtwork, artworkCacheBytes);
+  
+  m_channelManager = std::make_unique<ChannelManager>(m_connection.get(), m_userId, m_instance, m_artworkManager.get());
+  m_epgManager = std::make_unique<EPGManager>(m_connection.get(), m_userId, m_instance, m_artworkManager.get());
+  m_recordingManager = std::make_unique<RecordingManager>(m_connection.get(), m_userId, m_instance, m_artworkManager.get());
+  
+  m_epgManager->SetLookbackHours(kodi::addon::GetSettingInt("epg_lookback_hours", 24));
+  
+  ChannelManager* channelManager = m_channelManager.get();
+  // Each fetch waits for the initial lineup so the first EPG load, which
+  // runs in parallel with the channel load, doesn't drop every programme
+  m_epgManager->SetChannelFilter(
+      [channelManager]() { return channelManager->WaitForLoad(); },
+      [channelManager](const std::string& channelId) { return channelManager->HasChannel(channelId); });
+  m_epgManager->SetChannelUidLookup([channelManager](const std::string& channelId) {
+    return channelManager->GetChannelUid(channelId);
+  });
+  m_recordingManager->SetChannelUidLookup([channelManager](const std::string& channelId) {
+    return channelManager->GetChannelUid(channelId);
+  });
+  m_recordingManager->SetChannelIdLookup([channelManager](int uid) {
+    return channelManager->GetChannelIdFromUid(uid);
+  });
+  
+  // Timers are served from a cache kept in step with the server
+  m_recordingManager->StartTimerSync(kodi::addon::GetSettingInt("timer_update_interval", 5));
+  
+  // Load initial data in the background; GetChannels streams the lineup
+  // to Kodi as pages arrive
+  m_channelManager->StartChannelLoad();
+  
+  // Pick up lineup changes without an addon restart
+  m_channelManager->StartBackgroundSync(kodi::addon::GetSettingInt("channel_update_interval", 60));
+  
+  // Large lineups fetch the guide per channel as Kodi asks for it; auto
+  // decides once the lineup is known
+  switch (kodi::addon::GetSettingInt("epg_fetch_mode", 0))
+  {
+    case 1:
+      m_epgManager->SetFetchMode(EPGFetchMode::Bulk);
+      break;
+    case 2:
+      m_epgManager->SetFetchMode(EPGFetchMode::OnDemand);
+      break;
+    default:
+      m_epgManager->SetFetchMode(EPGFetchMode::Auto);
+      break;
+  }
+  m_epgManager->SetSlimIngest(kodi::addon::GetSettingBoolean("epg_slim_ingest", false));
+  m_epgManager->SetLineupSizeLookup([channelManager]() {
+    return channelManager->WaitForLoad() ? channelManager->GetChannelCount() : 0;
+  });
+  
+  // Cache the poster of the next programme while the current one airs
+  ArtworkManager* artwork = m_artworkManager.get();
+  m_epgManager->GetNowNextIndex().Subscribe([artwork](const NowNext& nowNext) {
+    if (nowNext.hasNext && !nowNext.next.imageTag.empty())
+      artwork->Prefetch({{nowNext.next.itemId, nowNext.next.imageTag, ArtworkKind::ProgrammePoster}});
+  });
+  
+  // Auto-record rules are matched against every guide the EPG publishes
+  AutoRecorder* autoRecorder = m_recordingManager->GetAutoRecorder();
+  m_epgManager->SetScheduleListener([autoRecorder](const AutoRecorder::ScheduleMap& channels) {
+    autoRecorder->Update(channels);
+  });
+  
+  // Profiles on the same host using the same server and user can share one guide
+  if (kodi::addon::GetSettingBoolean("epg_shared_store", false))
+    m_epgManager->EnableSharedStore(m_connection->GetServerUrl() + "|" + m_userId);
   
-  // Load initial data
-  m_channelManager->LoadChannels();
+  // The guide is loaded and refreshed off Kodi's threads
+  m_epgManager->StartBackgroundRefresh(kodi::addon::GetSettingInt("epg_update_interval", 120));
+  
+  StartMemoryGovernor();
   
   return true;
 }
 
+void JellyfinClient::StartMemoryGovernor()
+{
+  size_t budget = static_cast<size_t>(std::max(kodi::addon::GetSettingInt("memory_budget", 0), 0)) * 1024 * 1024;
+  m_memoryGovernor = std::make_unique<MemoryGovernor>(budget);
+  
+  ArtworkManager* artwork = m_artworkManager.get();
+  ChannelManager* channels = m_channelManager.get();
+  EPGManager* epg = m_epgManager.get();
+  RecordingManager* recordings = m_recordingManager.get();
+  
+  m_memoryGovernor->AddConsumer("EPG", [epg]() { return epg->GetMemoryUsage(); });
+  m_memoryGovernor->AddConsumer("EPG descriptions", []() { return ChannelSchedule::GetPlotCacheBytes(); });
+  m_memoryGovernor->AddConsumer("channels", [channels]() { return channels->GetMemoryUsage(); });
+  m_memoryGovernor->AddConsumer("recordings", [recordings]() { return recordings->GetMemoryUsage(); });
+  m_memoryGovernor->AddConsumer("auto-record index", [recordings]() {
+    return recordings->GetAutoRecorder()->GetMemoryUsage();
+  });
+  m_memoryGovernor->AddConsumer("artwork", [artwork]() { return artwork->GetMemoryUsage(); });
+  
+  // What is cheapest to do without goes first
+  m_memoryGovernor->AddShrinkStep("artwork prefetch and description cache",
+      [artwork]() {
+        artwork->SetPrefetchPaused(true);
+        ChannelSchedule::ClearPlotCache();
+      },
+      [artwork]() { artwork->SetPrefetchPaused(false); });
+  m_memoryGovernor->AddShrinkStep("past programmes",
+      [epg]() { epg->SetTrimLevel(EPGTrim::PastProgrammes); },
+      [epg]() { epg->SetTrimLevel(EPGTrim::None); });
+  m_memoryGovernor->AddShrinkStep("guide beyond the next day",
+      [epg]() { epg->SetTrimLevel(EPGTrim::Horizon); },
+      [epg]() { epg->SetTrimLevel(EPGTrim::PastProgrammes); });
+  m_memoryGovernor->AddShrinkStep("later programme descriptions",
+      [epg]() { epg->SetTrimLevel(EPGTrim::Descriptions); },
+      [epg]() { epg->SetTrimLevel(EPGTrim::Horizon); });
+  
+  m_memoryGovernor->Start(MEMORY_CHECK_SECONDS);
+}
+
 int JellyfinClient::GetChannelCount() const
 {
   if (m_channelManager)
@@ -239,6 +373,9 @@ PVR_ERROR JellyfinClient::GetEPGForChannel(int channelUid, time_t start, time_t
 {
   if (m_epgManager && m_channelManager)
   {
+    // UID to channel ID mapping needs the complete lineup
+    m_channelManager->WaitForLoad();
+    
     // Get Jellyfin channel ID from UID
     std::string jellyfinChannelId = m_channelManager->GetChannelIdFromUid(channelUid);
     if (jellyfinChannelId.empty())
@@ -301,6 +438,20 @@ PVR_ERROR JellyfinClient::DeleteTimer(const kodi::addon::PVRTimer& timer)
   return PVR_ERROR_SERVER_ERROR;
 }
 
+PVR_ERROR JellyfinClient::UpdateTimer(const kodi::addon::PVRTimer& timer)
+{
+  if (m_recordingManager)
+    return m_recordingManager->UpdateTimer(timer);
+  return PVR_ERROR_SERVER_ERROR;
+}
+
+PVR_ERROR JellyfinClient::GetTimerTypes(std::vector<kodi::addon::PVRTimerType>& types) const
+{
+  if (m_recordingManager)
+    return m_recordingManager->GetTimerTypes(types);
+  return PVR_ERROR_SERVER_ERROR;
+}
+
 PVR_ERROR JellyfinClient::GetChannelStreamProperties(const kodi::addon::PVRChannel& channel,
                                                      std::vector<kodi::addon::PVRStreamProperty>& properties)
 {
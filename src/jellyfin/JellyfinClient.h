@@ -9,11 +9,14 @@ class ChannelManager;
 class EPGManager;
 class RecordingManager;
 class AuthManager;
+class ArtworkManager;
+class MemoryGovernor;
 
 class JellyfinClient
 {
 public:
-  JellyfinClient(const std::string& serverUrl, const std::string& userId, const std::string& apiKey);
+  JellyfinClient(kodi::addon::CInstancePVRClient* instance,
+                 const std::string& serverUrl, const std::string& userId, const std::string& apiKey);
   ~JellyfinClient();
   
   // Initialize with authentication
@@ -46,6 +49,8 @@ public:
   PVR_ERROR GetTimers(kodi::addon::PVRTimersResultSet& results);
   PVR_ERROR AddTimer(const kodi::addon::PVRTimer& timer);
   PVR_ERROR DeleteTimer(const kodi::addon::PVRTimer& timer);
+  PVR_ERROR UpdateTimer(const kodi::addon::PVRTimer& timer);
+  PVR_ERROR GetTimerTypes(std::vector<kodi::addon::PVRTimerType>& types) const;
   
   // Stream operations
   PVR_ERROR GetChannelStreamProperties(const kodi::addon::PVRChannel& channel,
@@ -54,16 +59,22 @@ public:
                                         std::vector<kodi::addon::PVRStreamProperty>& properties);
 
 private:
+  kodi::addon::CInstancePVRClient* m_instance;
   std::string m_serverUrl;
   std::string m_userId;
   std::string m_apiKey;
   std::string m_serverVersion;
   
   std::unique_ptr<Connection> m_connection;
+  std::unique_ptr<ArtworkManager> m_artworkManager;
   std::unique_ptr<ChannelManager> m_channelManager;
   std::unique_ptr<EPGManager> m_epgManager;
   std::unique_ptr<RecordingManager> m_recordingManager;
   std::unique_ptr<AuthManager> m_authManager;
+  std::unique_ptr<MemoryGovernor> m_memoryGovernor;   // Destroyed first; its thread calls into the managers
   
   bool m_authenticated;
+  
+  // Accounts for and trims the managers' caches; started by Connect
+  void StartMemoryGovernor();
 };
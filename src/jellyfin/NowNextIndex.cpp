@@ -0,0 +1,220 @@
+#include "NowNextIndex.h"
+#include "../utilities/Logger.h"
+#include <algorithm>
+#include <chrono>
+
+NowNextIndex::NowNextIndex()
+  : m_wheel(std::time(nullptr))
+  , m_nextSubscriberId(1)
+  , m_running(false)
+{
+}
+
+NowNextIndex::~NowNextIndex()
+{
+  Stop();
+}
+
+void NowNextIndex::Start()
+{
+  Stop();
+
+  m_running = true;
+  m_thread = std::thread(&NowNextIndex::TickLoop, this);
+}
+
+void NowNextIndex::Stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_threadMutex);
+    m_running = false;
+  }
+  m_threadCondition.notify_all();
+
+  if (m_thread.joinable())
+    m_thread.join();
+}
+
+int NowNextIndex::Subscribe(Callback callback)
+{
+  std::lock_guard<std::mutex> lock(m_subscriberMutex);
+  int id = m_nextSubscriberId++;
+  m_subscribers[id] = std::move(callback);
+  return id;
+}
+
+void NowNextIndex::Unsubscribe(int id)
+{
+  // Waits for a dispatch in progress, so the callback is not running once
+  // this returns
+  std::lock_guard<std::mutex> lock(m_subscriberMutex);
+  m_subscribers.erase(id);
+}
+
+void NowNextIndex::Update(const std::map<std::string, std::shared_ptr<const ChannelSchedule>>& channels)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  time_t now = std::time(nullptr);
+
+  for (auto it = m_channelIndex.begin(); it != m_channelIndex.end();)
+  {
+    if (channels.count(it->first) > 0)
+    {
+      ++it;
+      continue;
+    }
+
+    // Timers still pointing at the slot find it empty and are ignored
+    ChannelState& state = m_channels[it->second];
+    state.schedule.reset();
+    state.boundary = 0;
+    m_freeSlots.push_back(it->second);
+    it = m_channelIndex.erase(it);
+  }
+
+  for (const auto& channel : channels)
+  {
+    size_t key;
+    auto existing = m_channelIndex.find(channel.first);
+    if (existing != m_channelIndex.end())
+    {
+      key = existing->second;
+      if (m_channels[key].schedule == channel.second)
+        continue;
+    }
+    else if (!m_freeSlots.empty())
+    {
+      key = m_freeSlots.back();
+      m_freeSlots.pop_back();
+      m_channelIndex[channel.first] = key;
+    }
+    else
+    {
+      key = m_channels.size();
+      m_channels.emplace_back();
+      m_channelIndex[channel.first] = key;
+    }
+
+    ChannelState& state = m_channels[key];
+    time_t previousBoundary = state.boundary;
+    state.channelId = channel.first;
+    state.schedule = channel.second;
+    Seat(state, now);
+
+    // A timer already armed for a different boundary is ignored when it fires
+    if (state.boundary != 0 && state.boundary != previousBoundary)
+      ScheduleLocked(key);
+  }
+}
+
+void NowNextIndex::Seat(ChannelState& state, time_t now)
+{
+  // First programme starting after now
+  const ChannelSchedule& schedule = *state.schedule;
+  size_t low = 0;
+  size_t high = schedule.Size();
+  while (low < high)
+  {
+    size_t middle = low + (high - low) / 2;
+    if (schedule.GetStartTime(middle) <= now)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  state.next = low;
+  Step(state, now);
+}
+
+void NowNextIndex::Step(ChannelState& state, time_t now)
+{
+  // Usually moves by one programme
+  const ChannelSchedule& schedule = *state.schedule;
+  while (state.next < schedule.Size() && schedule.GetStartTime(state.next) <= now)
+    state.next++;
+
+  time_t boundary = 0;
+  if (state.next > 0 && schedule.GetEndTime(state.next - 1) > now)
+    boundary = schedule.GetEndTime(state.next - 1);
+  if (state.next < schedule.Size())
+  {
+    time_t start = schedule.GetStartTime(state.next);
+    boundary = boundary == 0 ? start : std::min(boundary, start);
+  }
+  state.boundary = boundary;
+}
+
+void NowNextIndex::Fill(const ChannelState& state, time_t now, NowNext& result) const
+{
+  const ChannelSchedule& schedule = *state.schedule;
+  result.channelId = state.channelId;
+
+  result.hasNow = state.next > 0 && schedule.GetEndTime(state.next - 1) > now;
+  if (result.hasNow)
+  {
+    schedule.GetEntry(state.next - 1, result.now);
+    result.now.channelId = state.channelId;
+  }
+
+  result.hasNext = state.next < schedule.Size();
+  if (result.hasNext)
+  {
+    schedule.GetEntry(state.next, result.next);
+    result.next.channelId = state.channelId;
+  }
+}
+
+void NowNextIndex::ScheduleLocked(size_t key)
+{
+  m_wheel.Schedule(m_channels[key].boundary, key);
+}
+
+void NowNextIndex::TickLoop()
+{
+  std::vector<uint64_t> expired;
+  std::vector<NowNext> events;
+
+  while (m_running)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      time_t now = std::time(nullptr);
+
+      expired.clear();
+      m_wheel.Advance(now, expired);
+
+      for (uint64_t key : expired)
+      {
+        ChannelState& state = m_channels[key];
+
+        // Stale timer: the channel went away or was re-seated since
+        if (!state.schedule || state.boundary == 0 || state.boundary > now)
+          continue;
+
+        Step(state, now);
+        if (state.boundary != 0)
+          ScheduleLocked(key);
+
+        events.emplace_back();
+        Fill(state, now, events.back());
+      }
+    }
+
+    if (!events.empty())
+    {
+      std::lock_guard<std::mutex> lock(m_subscriberMutex);
+      for (const NowNext& event : events)
+      {
+        for (const auto& subscriber : m_subscribers)
+          subscriber.second(event);
+      }
+
+      Logger::Log(ADDON_LOG_DEBUG, "Programme boundary passed on %d channel(s)",
+                  static_cast<int>(events.size()));
+      events.clear();
+    }
+
+    std::unique_lock<std::mutex> lock(m_threadMutex);
+    m_threadCondition.wait_for(lock, std::chrono::seconds(1), [this] { return !m_running; });
+  }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <ctime>
+#include "ChannelSchedule.h"
+#include "../utilities/TimerWheel.h"
+
+// What is on a channel now and what comes next
+struct NowNext
+{
+  std::string channelId;
+  bool hasNow = false;
+  bool hasNext = false;
+  EPGEntry now;
+  EPGEntry next;
+};
+
+// Current and next programme of every channel, kept up to date by a timer
+// wheel holding each channel's next programme boundary. When a boundary
+// passes the channel steps forward in its schedule and subscribers get a
+// NowNext event on the index's thread.
+//
+// The index follows the schedules handed to Update; replacing a channel's
+// schedule re-seats it without raising an event.
+class NowNextIndex
+{
+public:
+  using Callback = std::function<void(const NowNext&)>;
+
+  NowNextIndex();
+  ~NowNextIndex();
+
+  void Start();
+  void Stop();
+
+  // Channels missing from the map are dropped
+  void Update(const std::map<std::string, std::shared_ptr<const ChannelSchedule>>& channels);
+
+  // Callbacks must not call Subscribe or Unsubscribe
+  int Subscribe(Callback callback);
+  void Unsubscribe(int id);
+
+private:
+  struct ChannelState
+  {
+    std::string channelId;
+    std::shared_ptr<const ChannelSchedule> schedule;   // Null once the channel is gone
+    size_t next = 0;        // First programme starting after the last boundary
+    time_t boundary = 0;    // Next time now or next changes, 0 if never
+  };
+
+  std::mutex m_mutex;
+  std::vector<ChannelState> m_channels;   // Indexed by timer key
+  std::unordered_map<std::string, size_t> m_channelIndex;
+  std::vector<size_t> m_freeSlots;
+  TimerWheel m_wheel;
+
+  std::mutex m_subscriberMutex;
+  std::map<int, Callback> m_subscribers;
+  int m_nextSubscriberId;
+
+  std::thread m_thread;
+  std::atomic<bool> m_running;
+  std::mutex m_threadMutex;
+  std::condition_variable m_threadCondition;
+
+  void TickLoop();
+  void Seat(ChannelState& state, time_t now);
+  void Step(ChannelState& state, time_t now);
+  void Fill(const ChannelState& state, time_t now, NowNext& result) const;
+  void ScheduleLocked(size_t key);
+};
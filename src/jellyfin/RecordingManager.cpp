@@ -1,14 +1,122 @@
 #include "RecordingManager.h"
 #include "Connection.h"
+#include "ArtworkManager.h"
+#include "AutoRecorder.h"
 #include "../utilities/Logger.h"
+#include "../utilities/StringArena.h"
 #include "../utilities/Utilities.h"
 #include <json/json.h>
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <set>
 #include <sstream>
+#include <unordered_map>
+#include <utility>
 
-RecordingManager::RecordingManager(Connection* connection, const std::string& userId)
+namespace
+{
+
+const unsigned int TIMER_TYPE_MANUAL = 1;
+const unsigned int TIMER_TYPE_EPG = 2;
+const unsigned int TIMER_TYPE_AUTO_RECORD = 3;
+
+// Server timers and local rules share Kodi's client index space; rules
+// take the upper half
+const unsigned int RULE_INDEX_FLAG = 0x80000000;
+
+// Tuner hosts rarely change; they are re-read with the timers this often
+const time_t TUNER_REFRESH_SECONDS = 3600;
+
+// Times a sync is repeated when its fetch keeps racing local changes
+const int SYNC_ATTEMPTS = 3;
+
+// Approximate per-node overhead of the timer map and index
+const size_t MAP_NODE_BYTES = 48;
+
+// What Kodi shows of a timer; anything else changing is not worth a refresh
+bool SameTimer(const JellyfinTimer& a, const JellyfinTimer& b)
+{
+  return a.id == b.id && a.title == b.title && a.channelId == b.channelId &&
+         a.externalChannelId == b.externalChannelId && a.programId == b.programId &&
+         a.startTime == b.startTime && a.endTime == b.endTime &&
+         a.prePaddingSeconds == b.prePaddingSeconds && a.postPaddingSeconds == b.postPaddingSeconds &&
+         a.isScheduled == b.isScheduled && a.usesTuner == b.usesTuner;
+}
+
+int MinuteOfDay(time_t time)
+{
+  struct tm local = {};
+#ifdef _WIN32
+  localtime_s(&local, &time);
+#else
+  localtime_r(&time, &local);
+#endif
+  return local.tm_hour * 60 + local.tm_min;
+}
+
+// Kodi shows a rule's start window as times of day; the date is irrelevant
+time_t TodayAtMinute(int minute)
+{
+  time_t now = std::time(nullptr);
+  struct tm local = {};
+#ifdef _WIN32
+  localtime_s(&local, &now);
+#else
+  localtime_r(&now, &local);
+#endif
+  local.tm_hour = minute / 60;
+  local.tm_min = minute % 60;
+  local.tm_sec = 0;
+  return std::mktime(&local);
+}
+
+AutoRecordRule RuleFromTimer(const kodi::addon::PVRTimer& timer, const std::string& channelId)
+{
+  AutoRecordRule rule;
+  rule.id = timer.GetClientIndex() & ~RULE_INDEX_FLAG;
+  rule.name = timer.GetTitle().empty() ? timer.GetEPGSearchString() : timer.GetTitle();
+  if (timer.GetFullTextEpgSearch())
+    rule.keywords = timer.GetEPGSearchString();
+  else
+    rule.title = timer.GetEPGSearchString();
+  rule.channelId = channelId;
+  rule.startMinuteFrom = timer.GetStartAnyTime() ? -1 : MinuteOfDay(timer.GetStartTime());
+  rule.startMinuteTo = timer.GetEndAnyTime() ? -1 : MinuteOfDay(timer.GetEndTime());
+  rule.weekdays = timer.GetWeekdays() == PVR_WEEKDAY_ALLDAYS ? 0 : timer.GetWeekdays();
+  rule.enabled = timer.GetState() != PVR_TIMER_STATE_DISABLED;
+  return rule;
+}
+
+} // namespace
+
+RecordingManager::RecordingManager(Connection* connection, const std::string& userId,
+                                   kodi::addon::CInstancePVRClient* instance, ArtworkManager* artwork)
   : m_connection(connection)
   , m_userId(userId)
+  , m_artwork(artwork)
+  , m_recordingBytes(0)
+  , m_memoryUsage(0)
+  , m_nextTimerIndex(1)
+  , m_timerArena(std::make_shared<StringArena>())
+  , m_timersLoaded(false)
+  , m_localChanges(0)
+  , m_instance(instance)
+  , m_tunersLoadedAt(0)
+  , m_syncRunning(false)
+  , m_syncRequested(false)
+  , m_autoRecorder(std::make_unique<AutoRecorder>())
 {
+  m_autoRecorder->LoadRules();
+  m_autoRecorder->Start([this](const std::vector<AutoRecordMatch>& matches) {
+    return ScheduleMatches(matches);
+  });
+}
+
+RecordingManager::~RecordingManager()
+{
+  m_autoRecorder->Stop();
+  StopTimerSync();
 }
 
 bool RecordingManager::LoadRecordings()
@@ -25,7 +133,8 @@ bool RecordingManager::LoadRecordings()
     return false;
   }
   
-  m_recordings.clear();
+  auto arena = std::make_shared<StringArena>();
+  std::vector<JellyfinRecording> recordings;
   
   if (response.isMember("Items") && response["Items"].isArray())
   {
@@ -43,8 +152,8 @@ bool RecordingManager::LoadRecordings()
       
       JellyfinRecording recording;
       recording.id = item["Id"].asString();
-      recording.title = item.get("Name", "").asString();
-      recording.channelName = item.get("ChannelName", "").asString();
+      recording.title = arena->Intern(item.get("Name", "").asString());
+      recording.channelName = arena->Intern(item.get("ChannelName", "").asString());
       recording.plot = item.get("Overview", "").asString();
       recording.playCount = item.get("UserData", Json::Value::null).get("PlayCount", 0).asInt();
       
@@ -58,20 +167,36 @@ bool RecordingManager::LoadRecordings()
         recording.endTime = Utilities::ParseDateTime(item["EndDate"].asString());
       }
       
-      recording.directory = item.get("SeriesName", "").asString();
+      recording.directory = arena->Intern(item.get("SeriesName", "").asString());
+      
+      if (item.isMember("ImageTags") && item["ImageTags"].isMember("Primary"))
+      {
+        recording.imageTag = item["ImageTags"]["Primary"].asString();
+      }
       
-      m_recordings.push_back(recording);
+      recordings.push_back(recording);
     }
   }
   
+  m_recordings = std::move(recordings);
+  m_recordingArena = std::move(arena);
+  m_recordingArena->LogStats("recordings");
+  
+  // The sync thread totals the memory too, so it only reads this count
+  size_t bytes = m_recordings.capacity() * sizeof(JellyfinRecording) + m_recordingArena->MemoryUsage();
+  for (const auto& recording : m_recordings)
+    bytes += recording.id.capacity() + recording.plot.capacity() + recording.imageTag.capacity();
+  m_recordingBytes = bytes;
+  {
+    std::lock_guard<std::mutex> lock(m_timerMutex);
+    UpdateMemoryUsage();
+  }
   Logger::Log(ADDON_LOG_INFO, "Loaded %d recordings", static_cast<int>(m_recordings.size()));
   return true;
 }
 
-bool RecordingManager::LoadTimers()
+bool RecordingManager::FetchTimers(std::vector<JellyfinTimer>& timers, StringArena& arena)
 {
-  Logger::Log(ADDON_LOG_INFO, "Loading timers from Jellyfin...");
-  
   std::ostringstream endpoint;
   endpoint << "/LiveTv/Timers?userId=" << m_userId;
   
@@ -82,8 +207,6 @@ bool RecordingManager::LoadTimers()
     return false;
   }
   
-  m_timers.clear();
-  
   if (response.isMember("Items") && response["Items"].isArray())
   {
     const Json::Value& items = response["Items"];
@@ -99,10 +222,20 @@ bool RecordingManager::LoadTimers()
       }
       
       JellyfinTimer timer;
+      timer.index = 0;
       timer.id = item["Id"].asString();
-      timer.title = item.get("Name", "").asString();
-      timer.channelId = item.get("ChannelId", "").asString();
-      timer.isScheduled = item.get("Status", "").asString() == "New";
+      timer.title = arena.Intern(item.get("Name", "").asString());
+      timer.channelId = arena.Intern(item.get("ChannelId", "").asString());
+      timer.externalChannelId = arena.Intern(item.get("ExternalChannelId", "").asString());
+      timer.programId = item.get("ProgramId", "").asString();
+      timer.prePaddingSeconds = item.get("PrePaddingSeconds", 0).asInt();
+      timer.postPaddingSeconds = item.get("PostPaddingSeconds", 0).asInt();
+      
+      std::string status = item.get("Status", "").asString();
+      timer.isScheduled = status == "New";
+      timer.usesTuner = status == "New" || status == "InProgress";
+      timer.startTime = 0;
+      timer.endTime = 0;
       
       if (item.isMember("StartDate"))
       {
@@ -114,14 +247,292 @@ bool RecordingManager::LoadTimers()
         timer.endTime = Utilities::ParseDateTime(item["EndDate"].asString());
       }
       
-      m_timers.push_back(timer);
+      timers.push_back(timer);
     }
   }
   
-  Logger::Log(ADDON_LOG_INFO, "Loaded %d timers", static_cast<int>(m_timers.size()));
   return true;
 }
 
+bool RecordingManager::SyncTimers(bool notify)
+{
+  // A fetch that raced a local change is repeated rather than applied
+  for (int attempt = 0; attempt < SYNC_ATTEMPTS; attempt++)
+  {
+    SyncResult result = TrySyncTimers(notify);
+    if (result != SyncResult::Raced)
+      return result == SyncResult::Applied;
+  }
+  
+  Logger::Log(ADDON_LOG_WARNING, "Timer sync kept racing local changes, trying again in the background");
+  RequestSync();
+  return false;
+}
+
+RecordingManager::SyncResult RecordingManager::TrySyncTimers(bool notify)
+{
+  Logger::Log(ADDON_LOG_DEBUG, "Syncing timers with Jellyfin...");
+  
+  // One sync at a time, so an older fetch is never applied over a newer one
+  std::lock_guard<std::mutex> syncLock(m_syncTimersMutex);
+  
+  uint64_t localChanges;
+  {
+    std::lock_guard<std::mutex> lock(m_timerMutex);
+    localChanges = m_localChanges;
+  }
+  
+  time_t fetchStarted = std::time(nullptr);
+  auto arena = std::make_shared<StringArena>();
+  std::vector<JellyfinTimer> fetched;
+  if (!FetchTimers(fetched, *arena))
+    return SyncResult::Failed;
+  
+  std::vector<TunerSource> sources;
+  bool newSources = std::time(nullptr) - m_tunersLoadedAt >= TUNER_REFRESH_SECONDS && FetchTunerSources(sources);
+  
+  bool changed;
+  std::set<std::string> programIds;
+  {
+    std::lock_guard<std::mutex> lock(m_timerMutex);
+    
+    // A local add or delete landed while fetching, so the list may predate
+    // it; the cache already has it
+    if (m_localChanges != localChanges)
+    {
+      if (newSources)
+        m_tunersLoadedAt = 0;
+      return SyncResult::Raced;
+    }
+    
+    // Timers added here but not listed yet; the server's copy takes over
+    // their index when it shows up
+    std::map<unsigned int, JellyfinTimer> pending;
+    for (const auto& timer : m_timers)
+    {
+      if (timer.second.id.empty())
+        pending.insert(timer);
+    }
+    
+    std::map<unsigned int, JellyfinTimer> timers;
+    for (auto& timer : fetched)
+    {
+      timer.index = AssignTimerIndex(timer, pending);
+      timers.emplace(timer.index, std::move(timer));
+    }
+    
+    changed = timers.size() != m_timers.size();
+    for (auto it = timers.begin(), old = m_timers.begin(); !changed && it != timers.end(); ++it, ++old)
+      changed = it->first != old->first || !SameTimer(it->second, old->second);
+    
+    // The old arena keeps the previous timers' views valid for the comparison
+    std::map<unsigned int, JellyfinTimer> previous = std::move(m_timers);
+    std::shared_ptr<StringArena> previousArena = std::move(m_timerArena);
+    m_timers = std::move(timers);
+    m_timerArena = std::move(arena);
+    
+    for (auto it = m_timerIndices.begin(); it != m_timerIndices.end();)
+    {
+      if (m_timers.count(it->second) == 0)
+        it = m_timerIndices.erase(it);
+      else
+        ++it;
+    }
+    
+    if (newSources)
+      m_conflicts.SetSources(sources);
+    changed |= UpdateConflicts(previous, newSources);
+    
+    m_timersLoaded = true;
+    UpdateMemoryUsage();
+    
+    for (const auto& timer : m_timers)
+    {
+      if (!timer.second.programId.empty())
+        programIds.insert(timer.second.programId);
+    }
+    
+    if (changed)
+    {
+      m_timerArena->LogStats("timers");
+      Logger::Log(ADDON_LOG_INFO, "Loaded %d timers, %d in conflict", static_cast<int>(m_timers.size()),
+                  static_cast<int>(m_conflicts.GetConflictCount()));
+    }
+  }
+  
+  // Rules forget the programmes whose timer is gone
+  m_autoRecorder->PruneScheduled(programIds, fetchStarted);
+  
+  if (changed && notify && m_instance)
+    m_instance->TriggerTimerUpdate();
+  return SyncResult::Applied;
+}
+
+unsigned int RecordingManager::AssignTimerIndex(const JellyfinTimer& timer,
+                                                std::map<unsigned int, JellyfinTimer>& pending)
+{
+  auto known = m_timerIndices.find(timer.id);
+  if (known != m_timerIndices.end())
+    return known->second;
+  
+  unsigned int index = 0;
+  for (auto it = pending.begin(); it != pending.end(); ++it)
+  {
+    if (it->second.channelId == timer.channelId && it->second.startTime == timer.startTime)
+    {
+      index = it->first;
+      pending.erase(it);
+      break;
+    }
+  }
+  
+  // Rules take the upper half of the index space
+  if (index == 0)
+  {
+    index = m_nextTimerIndex;
+    m_nextTimerIndex = m_nextTimerIndex + 1 < RULE_INDEX_FLAG ? m_nextTimerIndex + 1 : 1;
+  }
+  
+  m_timerIndices[timer.id] = index;
+  return index;
+}
+
+void RecordingManager::StartTimerSync(int intervalMinutes)
+{
+  StopTimerSync();
+  
+  m_syncRunning = true;
+  m_syncThread = std::thread(&RecordingManager::SyncLoop, this, std::max(intervalMinutes, 0));
+  if (intervalMinutes > 0)
+    Logger::Log(ADDON_LOG_INFO, "Timer sync every %d minutes", intervalMinutes);
+}
+
+void RecordingManager::StopTimerSync()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_syncMutex);
+    m_syncRunning = false;
+  }
+  m_syncCondition.notify_all();
+  
+  if (m_syncThread.joinable())
+    m_syncThread.join();
+}
+
+void RecordingManager::RequestSync()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_syncMutex);
+    m_syncRequested = true;
+  }
+  m_syncCondition.notify_all();
+}
+
+void RecordingManager::SyncLoop(int intervalMinutes)
+{
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(m_syncMutex);
+      auto wake = [this] { return !m_syncRunning || m_syncRequested; };
+      if (intervalMinutes > 0)
+        m_syncCondition.wait_for(lock, std::chrono::minutes(intervalMinutes), wake);
+      else
+        m_syncCondition.wait(lock, wake);
+      if (!m_syncRunning)
+        break;
+      m_syncRequested = false;
+    }
+    
+    SyncTimers(true);
+  }
+}
+
+bool RecordingManager::FetchTunerSources(std::vector<TunerSource>& sources)
+{
+  // The live TV configuration lists the tuner hosts with their tuner counts
+  Json::Value response;
+  m_tunersLoadedAt = std::time(nullptr);
+  if (!m_connection->SendRequest("/System/Configuration/livetv", response))
+  {
+    Logger::Log(ADDON_LOG_WARNING, "Failed to load tuner hosts, timer conflicts are not checked");
+    return false;
+  }
+  
+  const Json::Value& hosts = response["TunerHosts"];
+  for (unsigned int i = 0; i < hosts.size(); i++)
+  {
+    TunerSource source;
+    source.id = hosts[i].get("Id", "").asString();
+    source.deviceId = hosts[i].get("DeviceId", "").asString();
+    source.name = hosts[i].get("FriendlyName", "").asString();
+    if (source.name.empty())
+      source.name = hosts[i].get("Url", source.id).asString();
+    source.tuners = hosts[i].get("TunerCount", 0).asInt();
+    sources.push_back(source);
+    Logger::Log(ADDON_LOG_DEBUG, "Tuner host %s: %d tuner(s)", source.name.c_str(), source.tuners);
+  }
+  
+  return true;
+}
+
+bool RecordingManager::UpdateConflicts(const std::map<unsigned int, JellyfinTimer>& previous, bool rebuild)
+{
+  // Timers that did not change keep their place; only the difference is
+  // applied, so each timer added or removed re-checks just its neighbours
+  auto span = [](const JellyfinTimer& timer) {
+    return std::make_pair(timer.startTime - timer.prePaddingSeconds, timer.endTime + timer.postPaddingSeconds);
+  };
+  
+  std::unordered_map<unsigned int, const JellyfinTimer*> before;
+  if (!rebuild)
+  {
+    for (const auto& timer : previous)
+    {
+      if (timer.second.usesTuner)
+        before[timer.first] = &timer.second;
+    }
+  }
+  
+  bool changed = false;
+  for (const auto& entry : m_timers)
+  {
+    const JellyfinTimer& timer = entry.second;
+    if (!timer.usesTuner)
+      continue;
+    
+    auto old = before.find(entry.first);
+    if (old != before.end())
+    {
+      bool same = span(*old->second) == span(timer) && old->second->externalChannelId == timer.externalChannelId;
+      before.erase(old);
+      if (same)
+        continue;
+    }
+    
+    std::pair<time_t, time_t> times = span(timer);
+    changed |= m_conflicts.Add(entry.first, std::string(timer.externalChannelId), times.first, times.second);
+  }
+  
+  for (const auto& gone : before)
+    changed |= m_conflicts.Remove(gone.first);
+  
+  return changed;
+}
+
+void RecordingManager::UpdateMemoryUsage()
+{
+  size_t bytes = m_recordingBytes +
+                 m_timers.size() * (MAP_NODE_BYTES + sizeof(JellyfinTimer)) +
+                 m_timerIndices.size() * (MAP_NODE_BYTES + sizeof(std::pair<std::string, unsigned int>));
+  for (const auto& timer : m_timers)
+    bytes += 2 * timer.second.id.capacity() + timer.second.programId.capacity();
+  
+  if (m_timerArena)
+    bytes += m_timerArena->MemoryUsage();
+  m_memoryUsage = bytes;
+}
+
 int RecordingManager::GetRecordingCount(bool deleted) const
 {
   // Jellyfin doesn't have a "deleted" state for recordings
@@ -145,13 +556,19 @@ PVR_ERROR RecordingManager::GetRecordings(bool deleted, kodi::addon::PVRRecordin
     kodi::addon::PVRRecording kodiRecording;
     
     kodiRecording.SetRecordingId(recording.id);
-    kodiRecording.SetTitle(recording.title);
+    kodiRecording.SetTitle(std::string(recording.title));
     kodiRecording.SetPlot(recording.plot);
-    kodiRecording.SetChannelName(recording.channelName);
+    kodiRecording.SetChannelName(std::string(recording.channelName));
     kodiRecording.SetRecordingTime(recording.startTime);
     kodiRecording.SetDuration(static_cast<int>(recording.endTime - recording.startTime));
     kodiRecording.SetPlayCount(recording.playCount);
-    kodiRecording.SetDirectory(recording.directory);
+    kodiRecording.SetDirectory(std::string(recording.directory));
+    
+    if (m_artwork)
+    {
+      kodiRecording.SetThumbnailPath(m_artwork->GetImagePath(recording.id, recording.imageTag,
+                                                             ArtworkKind::RecordingThumbnail));
+    }
     
     results.Add(kodiRecording);
   }
@@ -178,30 +595,111 @@ PVR_ERROR RecordingManager::DeleteRecording(const kodi::addon::PVRRecording& rec
 
 int RecordingManager::GetTimerCount() const
 {
-  return m_timers.size();
+  std::lock_guard<std::mutex> lock(m_timerMutex);
+  return static_cast<int>(m_timers.size() + m_autoRecorder->GetRuleCount());
+}
+
+PVR_ERROR RecordingManager::GetTimerTypes(std::vector<kodi::addon::PVRTimerType>& types) const
+{
+  kodi::addon::PVRTimerType manual;
+  manual.SetId(TIMER_TYPE_MANUAL);
+  manual.SetAttributes(PVR_TIMER_TYPE_IS_MANUAL | PVR_TIMER_TYPE_SUPPORTS_CHANNELS |
+                       PVR_TIMER_TYPE_SUPPORTS_START_TIME | PVR_TIMER_TYPE_SUPPORTS_END_TIME);
+  manual.SetDescription("One time (manual)");
+  types.push_back(manual);
+  
+  kodi::addon::PVRTimerType epg;
+  epg.SetId(TIMER_TYPE_EPG);
+  epg.SetAttributes(PVR_TIMER_TYPE_REQUIRES_EPG_TAG_ON_CREATE | PVR_TIMER_TYPE_SUPPORTS_CHANNELS |
+                    PVR_TIMER_TYPE_SUPPORTS_START_TIME | PVR_TIMER_TYPE_SUPPORTS_END_TIME);
+  epg.SetDescription("One time (guide-based)");
+  types.push_back(epg);
+  
+  // Matched locally against the guide; each match becomes a one-time timer
+  kodi::addon::PVRTimerType rule;
+  rule.SetId(TIMER_TYPE_AUTO_RECORD);
+  rule.SetAttributes(PVR_TIMER_TYPE_IS_REPEATING | PVR_TIMER_TYPE_SUPPORTS_ENABLE_DISABLE |
+                     PVR_TIMER_TYPE_SUPPORTS_CHANNELS | PVR_TIMER_TYPE_SUPPORTS_ANY_CHANNEL |
+                     PVR_TIMER_TYPE_SUPPORTS_TITLE_EPG_MATCH | PVR_TIMER_TYPE_SUPPORTS_FULLTEXT_EPG_MATCH |
+                     PVR_TIMER_TYPE_SUPPORTS_START_TIME | PVR_TIMER_TYPE_SUPPORTS_START_ANYTIME |
+                     PVR_TIMER_TYPE_SUPPORTS_END_TIME | PVR_TIMER_TYPE_SUPPORTS_END_ANYTIME |
+                     PVR_TIMER_TYPE_SUPPORTS_WEEKDAYS);
+  rule.SetDescription("Auto-record rule");
+  types.push_back(rule);
+  
+  return PVR_ERROR_NO_ERROR;
 }
 
 PVR_ERROR RecordingManager::GetTimers(kodi::addon::PVRTimersResultSet& results)
 {
-  // Refresh timers
-  if (!LoadTimers())
+  // Only the first call waits for the server; later changes arrive
+  // through the sync
+  bool loaded;
+  {
+    std::lock_guard<std::mutex> lock(m_timerMutex);
+    loaded = m_timersLoaded;
+  }
+  if (!loaded && !SyncTimers(false))
     return PVR_ERROR_SERVER_ERROR;
   
-  for (const auto& timer : m_timers)
+  std::unique_lock<std::mutex> lock(m_timerMutex);
+  for (const auto& entry : m_timers)
   {
+    const JellyfinTimer& timer = entry.second;
     kodi::addon::PVRTimer kodiTimer;
     
-    std::hash<std::string> hasher;
-    unsigned int timerId = static_cast<unsigned int>(hasher(timer.id));
-    
-    kodiTimer.SetClientIndex(timerId);
-    kodiTimer.SetTitle(timer.title);
+    kodiTimer.SetClientIndex(timer.index);
+    kodiTimer.SetTimerType(timer.programId.empty() ? TIMER_TYPE_MANUAL : TIMER_TYPE_EPG);
+    kodiTimer.SetTitle(std::string(timer.title));
     kodiTimer.SetStartTime(timer.startTime);
     kodiTimer.SetEndTime(timer.endTime);
     kodiTimer.SetState(timer.isScheduled ? PVR_TIMER_STATE_SCHEDULED : PVR_TIMER_STATE_RECORDING);
     
-    // Map channel ID to channel UID (simplified - would need proper mapping)
-    kodiTimer.SetClientChannelUid(0);
+    int overlapping;
+    int tuners;
+    std::string source;
+    if (timer.usesTuner && m_conflicts.GetConflict(timer.index, overlapping, tuners, source))
+    {
+      if (timer.isScheduled)
+        kodiTimer.SetState(PVR_TIMER_STATE_CONFLICT_NOK);
+      kodiTimer.SetSummary("Conflict: " + std::to_string(overlapping) + " recordings overlap on " + source +
+                           ", which has " + std::to_string(tuners) + " tuner(s)");
+    }
+    
+    int channelUid = m_channelUidLookup ? m_channelUidLookup(std::string(timer.channelId)) : -1;
+    kodiTimer.SetClientChannelUid(channelUid >= 0 ? channelUid : 0);
+    
+    unsigned int ruleId = timer.programId.empty() ? 0 : m_autoRecorder->GetScheduledRule(timer.programId);
+    if (ruleId != 0)
+      kodiTimer.SetParentClientIndex(RULE_INDEX_FLAG | ruleId);
+    
+    results.Add(kodiTimer);
+  }
+  lock.unlock();
+  
+  for (const auto& rule : m_autoRecorder->GetRules())
+  {
+    kodi::addon::PVRTimer kodiTimer;
+    
+    kodiTimer.SetClientIndex(RULE_INDEX_FLAG | rule.id);
+    kodiTimer.SetTimerType(TIMER_TYPE_AUTO_RECORD);
+    kodiTimer.SetTitle(rule.name);
+    kodiTimer.SetState(rule.enabled ? PVR_TIMER_STATE_SCHEDULED : PVR_TIMER_STATE_DISABLED);
+    
+    bool fullText = rule.title.empty();
+    kodiTimer.SetEPGSearchString(fullText ? rule.keywords : rule.title);
+    kodiTimer.SetFullTextEpgSearch(fullText);
+    
+    int channelUid = rule.channelId.empty() || !m_channelUidLookup ? -1 : m_channelUidLookup(rule.channelId);
+    kodiTimer.SetClientChannelUid(channelUid >= 0 ? channelUid : PVR_TIMER_ANY_CHANNEL);
+    
+    kodiTimer.SetStartAnyTime(rule.startMinuteFrom < 0);
+    if (rule.startMinuteFrom >= 0)
+      kodiTimer.SetStartTime(TodayAtMinute(rule.startMinuteFrom));
+    kodiTimer.SetEndAnyTime(rule.startMinuteTo < 0);
+    if (rule.startMinuteTo >= 0)
+      kodiTimer.SetEndTime(TodayAtMinute(rule.startMinuteTo));
+    kodiTimer.SetWeekdays(rule.weekdays != 0 ? rule.weekdays : PVR_WEEKDAY_ALLDAYS);
     
     results.Add(kodiTimer);
   }
@@ -211,12 +709,34 @@ PVR_ERROR RecordingManager::GetTimers(kodi::addon::PVRTimersResultSet& results)
 
 PVR_ERROR RecordingManager::AddTimer(const kodi::addon::PVRTimer& timer)
 {
+  std::string channelId;
+  if (timer.GetClientChannelUid() != PVR_TIMER_ANY_CHANNEL && m_channelIdLookup)
+    channelId = m_channelIdLookup(timer.GetClientChannelUid());
+  
+  if (timer.GetTimerType() == TIMER_TYPE_AUTO_RECORD)
+  {
+    unsigned int ruleId = m_autoRecorder->AddRule(RuleFromTimer(timer, channelId));
+    if (ruleId == 0)
+    {
+      Logger::Log(ADDON_LOG_ERROR, "Auto-record rule needs a title, keywords or a channel");
+      return PVR_ERROR_INVALID_PARAMETERS;
+    }
+    if (m_instance)
+      m_instance->TriggerTimerUpdate();
+    return PVR_ERROR_NO_ERROR;
+  }
+  
+  if (channelId.empty())
+  {
+    Logger::Log(ADDON_LOG_ERROR, "Channel not found for UID: %d", timer.GetClientChannelUid());
+    return PVR_ERROR_INVALID_PARAMETERS;
+  }
+  
   Json::Value timerData;
   timerData["Name"] = timer.GetTitle();
+  timerData["ChannelId"] = channelId;
   timerData["StartDate"] = Utilities::FormatDateTime(timer.GetStartTime());
   timerData["EndDate"] = Utilities::FormatDateTime(timer.GetEndTime());
-  // Would need to map channel UID to channel ID
-  // timerData["ChannelId"] = ...;
   
   Json::Value response;
   if (!m_connection->SendPostRequest("/LiveTv/Timers", timerData, response))
@@ -226,25 +746,154 @@ PVR_ERROR RecordingManager::AddTimer(const kodi::addon::PVRTimer& timer)
   }
   
   Logger::Log(ADDON_LOG_INFO, "Added timer: %s", timer.GetTitle().c_str());
+  
+  // The server does not return the new timer; show it straight away and
+  // let a sync fill in its ID
+  {
+    std::lock_guard<std::mutex> lock(m_timerMutex);
+    JellyfinTimer added;
+    added.index = m_nextTimerIndex;
+    m_nextTimerIndex = m_nextTimerIndex + 1 < RULE_INDEX_FLAG ? m_nextTimerIndex + 1 : 1;
+    added.title = m_timerArena->Intern(timer.GetTitle());
+    added.channelId = m_timerArena->Intern(channelId);
+    added.startTime = timer.GetStartTime();
+    added.endTime = timer.GetEndTime();
+    added.prePaddingSeconds = 0;
+    added.postPaddingSeconds = 0;
+    added.isScheduled = true;
+    added.usesTuner = true;
+    m_conflicts.Add(added.index, "", added.startTime, added.endTime);
+    m_timers.emplace(added.index, added);
+    m_localChanges++;
+    UpdateMemoryUsage();
+  }
+  
+  if (m_instance)
+    m_instance->TriggerTimerUpdate();
+  RequestSync();
   return PVR_ERROR_NO_ERROR;
 }
 
-PVR_ERROR RecordingManager::DeleteTimer(const kodi::addon::PVRTimer& timer)
+PVR_ERROR RecordingManager::UpdateTimer(const kodi::addon::PVRTimer& timer)
 {
-  // Find timer by client index
-  std::string timerId;
-  std::hash<std::string> hasher;
+  std::string channelId;
+  if (timer.GetClientChannelUid() != PVR_TIMER_ANY_CHANNEL && m_channelIdLookup)
+    channelId = m_channelIdLookup(timer.GetClientChannelUid());
+  
+  if ((timer.GetClientIndex() & RULE_INDEX_FLAG) == 0)
+    return UpdateServerTimer(timer, channelId);
   
-  for (const auto& t : m_timers)
+  if (!m_autoRecorder->UpdateRule(RuleFromTimer(timer, channelId)))
+  {
+    Logger::Log(ADDON_LOG_ERROR, "Auto-record rule %u not found or invalid", timer.GetClientIndex() & ~RULE_INDEX_FLAG);
+    return PVR_ERROR_INVALID_PARAMETERS;
+  }
+  if (m_instance)
+    m_instance->TriggerTimerUpdate();
+  return PVR_ERROR_NO_ERROR;
+}
+
+PVR_ERROR RecordingManager::UpdateServerTimer(const kodi::addon::PVRTimer& timer, const std::string& channelId)
+{
+  if (channelId.empty())
+  {
+    Logger::Log(ADDON_LOG_ERROR, "Channel not found for UID: %d", timer.GetClientChannelUid());
+    return PVR_ERROR_INVALID_PARAMETERS;
+  }
+  
+  std::string timerId = FindTimerId(timer.GetClientIndex());
+  if (timerId.empty())
   {
-    unsigned int id = static_cast<unsigned int>(hasher(t.id));
-    if (id == timer.GetClientIndex())
+    Logger::Log(ADDON_LOG_ERROR, "Timer not found");
+    return PVR_ERROR_INVALID_PARAMETERS;
+  }
+  
+  // The server replaces the whole timer, so its padding, series link and
+  // the rest are read back and sent along unchanged
+  std::ostringstream endpoint;
+  endpoint << "/LiveTv/Timers/" << timerId;
+  
+  Json::Value timerData;
+  if (!m_connection->SendRequest(endpoint.str(), timerData))
+  {
+    Logger::Log(ADDON_LOG_ERROR, "Failed to load timer: %s", timerId.c_str());
+    return PVR_ERROR_SERVER_ERROR;
+  }
+  
+  timerData["Name"] = timer.GetTitle();
+  timerData["ChannelId"] = channelId;
+  timerData["StartDate"] = Utilities::FormatDateTime(timer.GetStartTime());
+  timerData["EndDate"] = Utilities::FormatDateTime(timer.GetEndTime());
+  
+  Json::Value response;
+  if (!m_connection->SendPostRequest(endpoint.str(), timerData, response))
+  {
+    Logger::Log(ADDON_LOG_ERROR, "Failed to update timer: %s", timerId.c_str());
+    return PVR_ERROR_SERVER_ERROR;
+  }
+  
+  Logger::Log(ADDON_LOG_INFO, "Updated timer: %s", timerId.c_str());
+  
+  // Shown straight away, like an added timer; the sync confirms it
+  {
+    std::lock_guard<std::mutex> lock(m_timerMutex);
+    auto found = m_timers.find(timer.GetClientIndex());
+    if (found != m_timers.end())
     {
-      timerId = t.id;
-      break;
+      JellyfinTimer& updated = found->second;
+      updated.title = m_timerArena->Intern(timer.GetTitle());
+      if (updated.channelId != channelId)
+      {
+        // The tuner host of the new channel is known once the sync lists it
+        updated.channelId = m_timerArena->Intern(channelId);
+        updated.externalChannelId = std::string_view();
+      }
+      updated.startTime = timer.GetStartTime();
+      updated.endTime = timer.GetEndTime();
+      
+      if (updated.usesTuner)
+      {
+        m_conflicts.Add(updated.index, std::string(updated.externalChannelId),
+                        updated.startTime - updated.prePaddingSeconds, updated.endTime + updated.postPaddingSeconds);
+      }
+      m_localChanges++;
+      UpdateMemoryUsage();
     }
   }
   
+  if (m_instance)
+    m_instance->TriggerTimerUpdate();
+  RequestSync();
+  return PVR_ERROR_NO_ERROR;
+}
+
+std::string RecordingManager::FindTimerId(unsigned int index)
+{
+  auto lookup = [this](unsigned int index) {
+    std::lock_guard<std::mutex> lock(m_timerMutex);
+    auto found = m_timers.find(index);
+    return found != m_timers.end() ? found->second.id : std::string();
+  };
+  
+  // A timer added here needs its server ID first
+  std::string timerId = lookup(index);
+  if (timerId.empty() && SyncTimers(true))
+    timerId = lookup(index);
+  return timerId;
+}
+
+PVR_ERROR RecordingManager::DeleteTimer(const kodi::addon::PVRTimer& timer)
+{
+  if (timer.GetClientIndex() & RULE_INDEX_FLAG)
+  {
+    if (!m_autoRecorder->DeleteRule(timer.GetClientIndex() & ~RULE_INDEX_FLAG))
+      return PVR_ERROR_INVALID_PARAMETERS;
+    if (m_instance)
+      m_instance->TriggerTimerUpdate();
+    return PVR_ERROR_NO_ERROR;
+  }
+  
+  std::string timerId = FindTimerId(timer.GetClientIndex());
   if (timerId.empty())
   {
     Logger::Log(ADDON_LOG_ERROR, "Timer not found");
@@ -261,9 +910,78 @@ PVR_ERROR RecordingManager::DeleteTimer(const kodi::addon::PVRTimer& timer)
   }
   
   Logger::Log(ADDON_LOG_INFO, "Deleted timer: %s", timerId.c_str());
+  
+  // Timers that overlapped it may no longer conflict
+  {
+    std::lock_guard<std::mutex> lock(m_timerMutex);
+    m_timers.erase(timer.GetClientIndex());
+    m_timerIndices.erase(timerId);
+    m_conflicts.Remove(timer.GetClientIndex());
+    m_localChanges++;
+    UpdateMemoryUsage();
+  }
+  
+  if (m_instance)
+    m_instance->TriggerTimerUpdate();
   return PVR_ERROR_NO_ERROR;
 }
 
+std::vector<size_t> RecordingManager::ScheduleMatches(const std::vector<AutoRecordMatch>& matches)
+{
+  // Programmes that already have a timer, whoever created it, are skipped;
+  // the recorder offers whatever is not handled here again later
+  std::vector<size_t> handled;
+  if (!SyncTimers(true))
+  {
+    Logger::Log(ADDON_LOG_ERROR, "Failed to load timers for auto-record matches");
+    return handled;
+  }
+  
+  std::set<std::string> scheduled;
+  {
+    std::lock_guard<std::mutex> lock(m_timerMutex);
+    for (const auto& timer : m_timers)
+      scheduled.insert(timer.second.programId);
+  }
+  
+  int created = 0;
+  for (size_t i = 0; i < matches.size(); i++)
+  {
+    const AutoRecordMatch& match = matches[i];
+    const std::string& programId = match.programme.itemId;
+    if (!scheduled.insert(programId).second)
+    {
+      handled.push_back(i);
+      continue;
+    }
+    
+    // The server's defaults carry the programme's channel, times and padding
+    Json::Value defaults;
+    if (!m_connection->SendRequest("/LiveTv/Timers/Defaults?programId=" + programId, defaults))
+    {
+      Logger::Log(ADDON_LOG_ERROR, "Failed to get timer defaults for programme %s", programId.c_str());
+      continue;
+    }
+    
+    Json::Value response;
+    if (!m_connection->SendPostRequest("/LiveTv/Timers", defaults, response))
+    {
+      Logger::Log(ADDON_LOG_ERROR, "Failed to add timer for programme %s", programId.c_str());
+      continue;
+    }
+    
+    m_autoRecorder->SetScheduled(programId, match.ruleId);
+    Logger::Log(ADDON_LOG_INFO, "Auto-record rule %u scheduled %s at %s", match.ruleId,
+                match.programme.title.c_str(), Utilities::FormatDateTime(match.programme.startTime).c_str());
+    handled.push_back(i);
+    created++;
+  }
+  
+  if (created > 0)
+    RequestSync();
+  return handled;
+}
+
 PVR_ERROR RecordingManager::GetRecordingStreamProperties(const kodi::addon::PVRRecording& recording,
                                                          std::vector<kodi::addon::PVRStreamProperty>& properties)
 {
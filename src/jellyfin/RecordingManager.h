@@ -1,57 +1,165 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 #include <kodi/addon-instance/PVR.h>
+#include "TimerConflicts.h"
 
 class Connection;
+class ArtworkManager;
+class StringArena;
+class AutoRecorder;
+struct AutoRecordMatch;
+
+// Titles, channel names and series names repeat heavily across recordings
+// and timers, so they are interned in an arena owned by the manager. The
+// views are valid until the next load replaces the arena.
 
 struct JellyfinRecording
 {
   std::string id;
-  std::string title;
-  std::string channelName;
+  std::string_view title;
+  std::string_view channelName;
   std::string plot;
   time_t startTime;
   time_t endTime;
-  std::string directory;
+  std::string_view directory;
+  std::string imageTag;
   int playCount;
 };
 
 struct JellyfinTimer
 {
-  std::string id;
-  std::string title;
-  std::string channelId;
+  unsigned int index;   // Kodi's client index, kept for as long as the timer exists
+  std::string id;       // Empty for a timer added here that the server has not listed yet
+  std::string_view title;
+  std::string_view channelId;
+  std::string_view externalChannelId;
+  std::string programId;
   time_t startTime;
   time_t endTime;
+  int prePaddingSeconds;
+  int postPaddingSeconds;
   bool isScheduled;
+  bool usesTuner;   // Scheduled or recording, as opposed to done or cancelled
 };
 
 class RecordingManager
 {
 public:
-  RecordingManager(Connection* connection, const std::string& userId);
-  ~RecordingManager() = default;
+  RecordingManager(Connection* connection, const std::string& userId,
+                   kodi::addon::CInstancePVRClient* instance, ArtworkManager* artwork);
+  ~RecordingManager();
+  
+  // Map between Kodi channel UIDs and Jellyfin channel IDs; set before use.
+  // The UID lookup returns -1 for channels not in the lineup.
+  void SetChannelIdLookup(std::function<std::string(int)> lookup) { m_channelIdLookup = std::move(lookup); }
+  void SetChannelUidLookup(std::function<int(const std::string&)> lookup) { m_channelUidLookup = std::move(lookup); }
+  
+  // Local auto-record rules; the EPG manager feeds the recorder each guide
+  // it publishes and matches become server timers
+  AutoRecorder* GetAutoRecorder() { return m_autoRecorder.get(); }
 
   int GetRecordingCount(bool deleted) const;
   PVR_ERROR GetRecordings(bool deleted, kodi::addon::PVRRecordingsResultSet& results);
   PVR_ERROR DeleteRecording(const kodi::addon::PVRRecording& recording);
   
+  // Timers are served from a cache. Local adds, edits and deletes are
+  // applied to it once the server accepts them; the sync reconciles it with the
+  // server in the background and tells Kodi when it changed.
   int GetTimerCount() const;
   PVR_ERROR GetTimers(kodi::addon::PVRTimersResultSet& results);
   PVR_ERROR AddTimer(const kodi::addon::PVRTimer& timer);
   PVR_ERROR DeleteTimer(const kodi::addon::PVRTimer& timer);
+  PVR_ERROR UpdateTimer(const kodi::addon::PVRTimer& timer);
+  PVR_ERROR GetTimerTypes(std::vector<kodi::addon::PVRTimerType>& types) const;
+  
+  // Reloads timers from the server; returns false if that failed or the
+  // list could not be applied because local changes kept racing it
+  bool SyncTimers(bool notify);
+  
+  // Background SyncTimers, interval in minutes; with 0 only local changes
+  // trigger one
+  void StartTimerSync(int intervalMinutes);
+  void StopTimerSync();
   
   PVR_ERROR GetRecordingStreamProperties(const kodi::addon::PVRRecording& recording,
                                         std::vector<kodi::addon::PVRStreamProperty>& properties);
+  
+  // Approximate memory held by the recording and timer lists, as of the
+  // last load; safe to call from any thread
+  size_t GetMemoryUsage() const { return m_memoryUsage; }
 
 private:
   Connection* m_connection;
   std::string m_userId;
+  ArtworkManager* m_artwork;
   std::vector<JellyfinRecording> m_recordings;
-  std::vector<JellyfinTimer> m_timers;
+  std::shared_ptr<StringArena> m_recordingArena;
+  std::atomic<size_t> m_recordingBytes;   // Recordings only; the lists are touched by Kodi's thread alone
+  std::atomic<size_t> m_memoryUsage;
+  
+  // Timer cache, keyed by client index
+  mutable std::mutex m_timerMutex;
+  std::map<unsigned int, JellyfinTimer> m_timers;
+  std::unordered_map<std::string, unsigned int> m_timerIndices;   // Server ID -> client index
+  unsigned int m_nextTimerIndex;
+  std::shared_ptr<StringArena> m_timerArena;
+  bool m_timersLoaded;
+  uint64_t m_localChanges;   // Adds and deletes applied here, to spot a sync that raced one
+  
+  kodi::addon::CInstancePVRClient* m_instance;
+  std::function<std::string(int)> m_channelIdLookup;
+  std::function<int(const std::string&)> m_channelUidLookup;
+  
+  // Timers against the server's tuner hosts, updated as timers come and
+  // go; guarded by m_timerMutex
+  TimerConflicts m_conflicts;
+  std::atomic<time_t> m_tunersLoadedAt;
+  
+  std::mutex m_syncTimersMutex;   // Held for a whole sync, fetch to apply
+  std::thread m_syncThread;
+  std::atomic<bool> m_syncRunning;
+  std::mutex m_syncMutex;
+  std::condition_variable m_syncCondition;
+  bool m_syncRequested;
+  
+  std::unique_ptr<AutoRecorder> m_autoRecorder;   // Declared last; its thread calls ScheduleMatches
   
   bool LoadRecordings();
-  bool LoadTimers();
+  bool FetchTimers(std::vector<JellyfinTimer>& timers, StringArena& arena);
+  bool FetchTunerSources(std::vector<TunerSource>& sources);
+  
+  // Raced: a local add or delete landed during the fetch, nothing applied
+  enum class SyncResult
+  {
+    Applied,
+    Failed,
+    Raced
+  };
+  SyncResult TrySyncTimers(bool notify);
+  
+  // Server ID of a cached timer, syncing once if it has none yet
+  std::string FindTimerId(unsigned int index);
+  PVR_ERROR UpdateServerTimer(const kodi::addon::PVRTimer& timer, const std::string& channelId);
+  void SyncLoop(int intervalMinutes);
+  void RequestSync();
+  
+  // Called with m_timerMutex held
+  unsigned int AssignTimerIndex(const JellyfinTimer& timer, std::map<unsigned int, JellyfinTimer>& pending);
+  bool UpdateConflicts(const std::map<unsigned int, JellyfinTimer>& previous, bool rebuild);
+  void UpdateMemoryUsage();
+  
+  // Runs on the recorder's thread; returns the positions of the matches
+  // that have a timer now
+  std::vector<size_t> ScheduleMatches(const std::vector<AutoRecordMatch>& matches);
 };
@@ -0,0 +1,185 @@
+#include "SharedEPGStore.h"
+#include "EPGStoreFile.h"
+#include "../utilities/Logger.h"
+#include <atomic>
+#include <sstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+const uint32_t CONTROL_MAGIC = 0x4C54434A;   // "JCTL"
+const uint32_t CONTROL_VERSION = 1;
+
+// Readers give up on a generation after this many overtaking publishes
+const int MAX_READ_ATTEMPTS = 3;
+
+} // namespace
+
+struct SharedEPGStore::ControlBlock
+{
+  std::atomic<uint32_t> magic;
+  uint32_t version;
+  std::atomic<uint64_t> generation;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "the shared generation counter needs lock-free 64-bit atomics");
+
+SharedEPGStore::SharedEPGStore(const std::string& directory, const std::string& key)
+  : m_key(key)
+  , m_writer(false)
+  , m_lockFd(-1)
+  , m_control(nullptr)
+{
+  std::hash<std::string> hasher;
+  std::ostringstream basePath;
+  basePath << directory << "epg-" << std::hex << hasher(key);
+  m_basePath = basePath.str();
+}
+
+std::string SharedEPGStore::BufferPath(uint64_t generation) const
+{
+  return m_basePath + ((generation & 1) ? ".1.bin" : ".0.bin");
+}
+
+#ifdef _WIN32
+
+SharedEPGStore::~SharedEPGStore() = default;
+
+bool SharedEPGStore::Open()
+{
+  Logger::Log(ADDON_LOG_INFO, "Shared EPG store is not supported on this platform");
+  return false;
+}
+
+bool SharedEPGStore::TryBecomeWriter()
+{
+  return false;
+}
+
+#else
+
+SharedEPGStore::~SharedEPGStore()
+{
+  if (m_control)
+    munmap(m_control, sizeof(ControlBlock));
+  
+  // Closing the descriptor drops the writer lock
+  if (m_lockFd >= 0)
+    close(m_lockFd);
+}
+
+bool SharedEPGStore::Open()
+{
+  std::string controlPath = m_basePath + ".ctl";
+  int fd = open(controlPath.c_str(), O_RDWR | O_CREAT, 0666);
+  if (fd < 0)
+  {
+    Logger::Log(ADDON_LOG_ERROR, "Failed to open shared EPG control file: %s", controlPath.c_str());
+    return false;
+  }
+  
+  // Every instance may race to create the file; growing it to the same
+  // size is harmless and leaves a zeroed (unpublished) block
+  struct stat info;
+  if (fstat(fd, &info) != 0 ||
+      (info.st_size < static_cast<off_t>(sizeof(ControlBlock)) && ftruncate(fd, sizeof(ControlBlock)) != 0))
+  {
+    close(fd);
+    return false;
+  }
+  
+  void* control = mmap(nullptr, sizeof(ControlBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  
+  if (control == MAP_FAILED)
+    return false;
+  
+  m_control = static_cast<ControlBlock*>(control);
+  
+  std::string lockPath = m_basePath + ".lock";
+  m_lockFd = open(lockPath.c_str(), O_RDWR | O_CREAT, 0666);
+  if (m_lockFd < 0)
+  {
+    Logger::Log(ADDON_LOG_ERROR, "Failed to open shared EPG lock file: %s", lockPath.c_str());
+    return false;
+  }
+  
+  return true;
+}
+
+bool SharedEPGStore::TryBecomeWriter()
+{
+  if (m_writer)
+    return true;
+  
+  if (m_lockFd < 0 || !m_control || flock(m_lockFd, LOCK_EX | LOCK_NB) != 0)
+    return false;
+  
+  if (m_control->magic.load(std::memory_order_acquire) != CONTROL_MAGIC)
+  {
+    m_control->version = CONTROL_VERSION;
+    m_control->generation.store(0, std::memory_order_relaxed);
+    m_control->magic.store(CONTROL_MAGIC, std::memory_order_release);
+  }
+  
+  m_writer = true;
+  Logger::Log(ADDON_LOG_INFO, "This instance now refreshes the shared EPG store");
+  return true;
+}
+
+#endif
+
+uint64_t SharedEPGStore::GetGeneration() const
+{
+  if (!m_control || m_control->magic.load(std::memory_order_acquire) != CONTROL_MAGIC ||
+      m_control->version != CONTROL_VERSION)
+    return 0;
+  
+  return m_control->generation.load(std::memory_order_acquire);
+}
+
+bool SharedEPGStore::Publish(const EPGSnapshot& snapshot)
+{
+  if (!m_writer)
+    return false;
+  
+  // The buffer being written is never the one the current generation points
+  // at, so readers opening the current generation always find a whole file
+  uint64_t next = GetGeneration() + 1;
+  if (!EPGStoreFile::Save(BufferPath(next), snapshot, m_key))
+    return false;
+  
+  m_control->generation.store(next, std::memory_order_release);
+  return true;
+}
+
+std::shared_ptr<EPGStoreView> SharedEPGStore::Read(uint64_t& generation) const
+{
+  for (int attempt = 0; attempt < MAX_READ_ATTEMPTS; attempt++)
+  {
+    uint64_t before = GetGeneration();
+    if (before == 0)
+      return nullptr;
+    
+    auto view = std::make_shared<EPGStoreView>();
+    bool opened = view->Open(BufferPath(before), m_key);
+    
+    // A generation published while we were opening may have replaced the file
+    if (opened && GetGeneration() == before)
+    {
+      generation = before;
+      return view;
+    }
+  }
+  
+  return nullptr;
+}
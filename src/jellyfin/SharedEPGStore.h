@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <cstdint>
+
+class EPGStoreView;
+struct EPGSnapshot;
+
+// Guide shared by every instance of the addon on this host that uses the same
+// server and user, e.g. several Kodi profiles. One instance holds the writer
+// lock, refreshes the EPG and publishes it; the others map what it published.
+//
+// Publishing writes one of two store files (double buffer) and then bumps a
+// generation counter in a small shared control file. Readers take no lock:
+// they read the counter, map the buffer it points at and re-check the
+// counter, retrying if a newer generation overtook them.
+class SharedEPGStore
+{
+public:
+  SharedEPGStore(const std::string& directory, const std::string& key);
+  ~SharedEPGStore();
+  
+  SharedEPGStore(const SharedEPGStore&) = delete;
+  SharedEPGStore& operator=(const SharedEPGStore&) = delete;
+  
+  bool Open();
+  
+  // Non-blocking; the lock is kept until this object is destroyed, and is
+  // released by the OS if the writer process dies
+  bool TryBecomeWriter();
+  bool IsWriter() const { return m_writer; }
+  
+  // 0 until something has been published
+  uint64_t GetGeneration() const;
+  
+  bool Publish(const EPGSnapshot& snapshot);
+  
+  // Newest published guide, or nullptr if there is none yet
+  std::shared_ptr<EPGStoreView> Read(uint64_t& generation) const;
+
+private:
+  struct ControlBlock;
+  
+  std::string m_key;
+  std::string m_basePath;
+  bool m_writer;
+  int m_lockFd;
+  ControlBlock* m_control;
+  
+  std::string BufferPath(uint64_t generation) const;
+};
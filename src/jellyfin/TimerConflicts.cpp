@@ -0,0 +1,181 @@
+#include "TimerConflicts.h"
+#include "../utilities/Logger.h"
+#include <algorithm>
+
+void TimerConflicts::SetSources(const std::vector<TunerSource>& sources)
+{
+  m_sources.clear();
+  m_timerSource.clear();
+  m_conflicts.clear();
+  m_reportedUnidentified = false;
+
+  for (const auto& info : sources)
+    m_sources.push_back({info, IntervalTree()});
+
+  // Channel IDs only name some kinds of host; timers whose host cannot be
+  // told apart are checked against the tuners of all hosts together, and
+  // so against every timer, whichever host records it
+  if (sources.size() > 1)
+  {
+    TunerSource pooled;
+    pooled.id = "pooled";
+    pooled.name = "unidentified tuner hosts";
+    for (const auto& info : sources)
+    {
+      if (info.tuners <= 0)
+      {
+        pooled.tuners = 0;
+        break;
+      }
+      pooled.tuners += info.tuners;
+    }
+    m_sources.push_back({pooled, IntervalTree()});
+  }
+}
+
+int TimerConflicts::FindSource(const std::string& externalChannelId) const
+{
+  if (m_sources.size() == 1)
+    return 0;
+
+  // HDHomeRun channel IDs carry the device ID, the others the host's ID
+  for (size_t i = 0; i + 1 < m_sources.size(); i++)
+  {
+    const TunerSource& info = m_sources[i].info;
+    if ((!info.deviceId.empty() && externalChannelId.find(info.deviceId) != std::string::npos) ||
+        (!info.id.empty() && externalChannelId.find(info.id) != std::string::npos))
+      return static_cast<int>(i);
+  }
+  return m_sources.empty() ? -1 : static_cast<int>(m_sources.size() - 1);
+}
+
+int TimerConflicts::PooledSource() const
+{
+  return m_sources.size() > 1 ? static_cast<int>(m_sources.size() - 1) : -1;
+}
+
+bool TimerConflicts::Add(uint64_t key, const std::string& externalChannelId, time_t start, time_t end)
+{
+  bool changed = Remove(key);
+
+  int index = FindSource(externalChannelId);
+  if (index < 0 || m_sources[index].info.tuners <= 0 || start >= end)
+    return changed;
+
+  int pooled = PooledSource();
+  if (index == pooled && !m_reportedUnidentified)
+  {
+    Logger::Log(ADDON_LOG_INFO, "Timer channel %s names none of the %d tuner hosts; such timers are checked against all %d tuners",
+                externalChannelId.c_str(), static_cast<int>(m_sources.size() - 1), m_sources[pooled].info.tuners);
+    m_reportedUnidentified = true;
+  }
+
+  m_sources[index].timers.Insert(key, start, end);
+  m_timerSource[key] = static_cast<size_t>(index);
+  changed = Recheck(static_cast<size_t>(index), start, end) || changed;
+
+  // Timers on a known host still take one of the pooled tuners
+  if (pooled >= 0 && index != pooled && m_sources[pooled].info.tuners > 0)
+  {
+    m_sources[pooled].timers.Insert(key, start, end);
+    changed = Recheck(static_cast<size_t>(pooled), start, end) || changed;
+  }
+  return changed;
+}
+
+bool TimerConflicts::Remove(uint64_t key)
+{
+  auto found = m_timerSource.find(key);
+  if (found == m_timerSource.end())
+    return false;
+
+  size_t index = found->second;
+  m_timerSource.erase(found);
+
+  IntervalTree::Interval interval;
+  m_sources[index].timers.Find(key, interval);
+  m_sources[index].timers.Erase(key);
+
+  bool changed = m_conflicts.erase(key) > 0;
+  changed = Recheck(index, interval.start, interval.end) || changed;
+
+  int pooled = PooledSource();
+  if (pooled >= 0 && index != static_cast<size_t>(pooled) && m_sources[pooled].timers.Erase(key))
+    changed = Recheck(static_cast<size_t>(pooled), interval.start, interval.end) || changed;
+  return changed;
+}
+
+bool TimerConflicts::Recheck(size_t index, time_t start, time_t end)
+{
+  Source& source = m_sources[index];
+
+  // Only timers overlapping the change can have gained or lost a conflict.
+  // Every timer counts towards the pooled tuners, but only those on no
+  // known host are judged by them.
+  std::vector<IntervalTree::Interval> affected;
+  source.timers.FindOverlapping(start, end, affected);
+  if (static_cast<int>(index) == PooledSource())
+  {
+    affected.erase(std::remove_if(affected.begin(), affected.end(),
+                                  [&](const IntervalTree::Interval& timer)
+                                  {
+                                    auto owner = m_timerSource.find(timer.key);
+                                    return owner == m_timerSource.end() || owner->second != index;
+                                  }),
+                   affected.end());
+  }
+  if (affected.empty())
+    return false;
+
+  // One profile over everything they span serves all of them
+  time_t from = start;
+  time_t to = end;
+  for (const auto& timer : affected)
+  {
+    from = std::min(from, timer.start);
+    to = std::max(to, timer.end);
+  }
+  IntervalTree::Profile profile;
+  source.timers.GetProfile(from, to, profile);
+
+  bool changed = false;
+  for (const auto& timer : affected)
+  {
+    int overlapping = IntervalTree::MaxOverlap(profile, timer.start, timer.end);
+    auto conflict = m_conflicts.find(timer.key);
+    if (overlapping > source.info.tuners)
+    {
+      if (conflict == m_conflicts.end())
+      {
+        Logger::Log(ADDON_LOG_WARNING, "Timer conflict: %d recordings overlap on %s, which has %d tuner(s)",
+                    overlapping, source.info.name.c_str(), source.info.tuners);
+        m_conflicts.emplace(timer.key, overlapping);
+        changed = true;
+      }
+      else if (conflict->second != overlapping)
+      {
+        conflict->second = overlapping;
+        changed = true;
+      }
+    }
+    else if (conflict != m_conflicts.end())
+    {
+      m_conflicts.erase(conflict);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+bool TimerConflicts::GetConflict(uint64_t key, int& overlapping, int& tuners, std::string& source) const
+{
+  auto conflict = m_conflicts.find(key);
+  if (conflict == m_conflicts.end())
+    return false;
+
+  const TunerSource& info = m_sources[m_timerSource.at(key)].info;
+  overlapping = conflict->second;
+  tuners = info.tuners;
+  source = info.name;
+  return true;
+}
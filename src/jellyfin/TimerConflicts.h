@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../utilities/IntervalTree.h"
+
+// A tuner host configured on the server
+struct TunerSource
+{
+  std::string id;
+  std::string name;
+  std::string deviceId;
+  int tuners = 0;   // 0 for no limit
+};
+
+// Timers grouped by the tuner source recording them, each group in an
+// interval tree. A timer conflicts when, at some point while it records,
+// more timers overlap on its source than the source has tuners. Adding or
+// removing a timer only re-checks the timers overlapping it.
+//
+// Not thread-safe; the owner serialises access.
+class TimerConflicts
+{
+public:
+  // Drops every timer; the owner adds them again
+  void SetSources(const std::vector<TunerSource>& sources);
+  bool HasSources() const { return !m_sources.empty(); }
+
+  // The channel's external ID, as the server reports it on the timer,
+  // picks the source. Both return true when any timer's state changed.
+  bool Add(uint64_t key, const std::string& externalChannelId, time_t start, time_t end);
+  bool Remove(uint64_t key);
+
+  // Overlapping timers at the worst point of a conflicting timer, with
+  // the source and its tuner count; false if the timer fits
+  bool GetConflict(uint64_t key, int& overlapping, int& tuners, std::string& source) const;
+  size_t GetConflictCount() const { return m_conflicts.size(); }
+
+private:
+  struct Source
+  {
+    TunerSource info;
+    IntervalTree timers;
+  };
+
+  // With several hosts, the last pools them all: it holds every timer, but
+  // only judges those no channel ID names
+  std::vector<Source> m_sources;
+  std::unordered_map<uint64_t, size_t> m_timerSource;   // Key -> host judging the timer
+  std::unordered_map<uint64_t, int> m_conflicts;        // Key -> overlapping timers
+  bool m_reportedUnidentified = false;
+
+  int FindSource(const std::string& externalChannelId) const;
+  int PooledSource() const;   // -1 with a single host
+  bool Recheck(size_t index, time_t start, time_t end);
+};
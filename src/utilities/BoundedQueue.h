@@ -0,0 +1,57 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+// Blocking single-producer/single-consumer style queue with a fixed
+// capacity, used to connect pipeline stages running on separate threads.
+// Push blocks while the queue is full; Pop blocks while it is empty and
+// returns false once the queue has been closed and drained.
+template<typename T>
+class BoundedQueue
+{
+public:
+  explicit BoundedQueue(size_t capacity) : m_capacity(capacity) {}
+
+  bool Push(T item)
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_notFull.wait(lock, [this] { return m_closed || m_items.size() < m_capacity; });
+    if (m_closed)
+      return false;
+    m_items.push_back(std::move(item));
+    m_notEmpty.notify_one();
+    return true;
+  }
+
+  bool Pop(T& item)
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_notEmpty.wait(lock, [this] { return m_closed || !m_items.empty(); });
+    if (m_items.empty())
+      return false;
+    item = std::move(m_items.front());
+    m_items.pop_front();
+    m_notFull.notify_one();
+    return true;
+  }
+
+  // No more items will be pushed; wakes up blocked producers and consumers
+  void Close()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_closed = true;
+    m_notEmpty.notify_all();
+    m_notFull.notify_all();
+  }
+
+private:
+  std::mutex m_mutex;
+  std::condition_variable m_notEmpty;
+  std::condition_variable m_notFull;
+  std::deque<T> m_items;
+  size_t m_capacity;
+  bool m_closed = false;
+};
@@ -0,0 +1,93 @@
+#include "ChannelBitset.h"
+#include <algorithm>
+#include <bitset>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+
+inline unsigned CountTrailingZeros(uint64_t word)
+{
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward64(&index, word);
+  return static_cast<unsigned>(index);
+#else
+  return static_cast<unsigned>(__builtin_ctzll(word));
+#endif
+}
+
+} // namespace
+
+ChannelBitset::ChannelBitset(size_t size)
+{
+  Resize(size);
+}
+
+void ChannelBitset::Resize(size_t size)
+{
+  m_size = size;
+  m_words.resize((size + 63) / 64, 0);
+
+  // Keep bits beyond the logical size clear so Count/Any stay exact
+  if (size % 64 != 0 && !m_words.empty())
+    m_words.back() &= (uint64_t(1) << (size % 64)) - 1;
+}
+
+void ChannelBitset::Set(size_t index)
+{
+  if (index < m_size)
+    m_words[index / 64] |= uint64_t(1) << (index % 64);
+}
+
+void ChannelBitset::Reset(size_t index)
+{
+  if (index < m_size)
+    m_words[index / 64] &= ~(uint64_t(1) << (index % 64));
+}
+
+bool ChannelBitset::Test(size_t index) const
+{
+  if (index >= m_size)
+    return false;
+  return (m_words[index / 64] >> (index % 64)) & 1;
+}
+
+void ChannelBitset::Clear()
+{
+  std::fill(m_words.begin(), m_words.end(), 0);
+}
+
+size_t ChannelBitset::Count() const
+{
+  size_t count = 0;
+  for (uint64_t word : m_words)
+    count += std::bitset<64>(word).count();
+  return count;
+}
+
+bool ChannelBitset::Any() const
+{
+  for (uint64_t word : m_words)
+  {
+    if (word)
+      return true;
+  }
+  return false;
+}
+
+void ChannelBitset::ForEach(const std::function<void(size_t)>& func) const
+{
+  for (size_t i = 0; i < m_words.size(); i++)
+  {
+    uint64_t word = m_words[i];
+    while (word)
+    {
+      func(i * 64 + CountTrailingZeros(word));
+      word &= word - 1;
+    }
+  }
+}
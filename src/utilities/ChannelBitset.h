@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Fixed-size set of dense channel indices, one bit per channel.
+// Used for channel group membership, so a group costs a bit per channel
+// rather than a string per member and its members are walked in order.
+class ChannelBitset
+{
+public:
+  ChannelBitset() = default;
+  explicit ChannelBitset(size_t size);
+
+  void Resize(size_t size);
+  size_t Size() const { return m_size; }
+
+  void Set(size_t index);
+  void Reset(size_t index);
+  bool Test(size_t index) const;
+  void Clear();
+
+  size_t Count() const;
+  bool Any() const;
+
+  // Bits beyond the size are always clear, so the words compare exactly
+  bool operator==(const ChannelBitset& other) const { return m_size == other.m_size && m_words == other.m_words; }
+  bool operator!=(const ChannelBitset& other) const { return !(*this == other); }
+
+  // Calls func for every set index in ascending order
+  void ForEach(const std::function<void(size_t)>& func) const;
+
+  size_t MemoryUsage() const { return m_words.capacity() * sizeof(uint64_t); }
+
+private:
+  std::vector<uint64_t> m_words;
+  size_t m_size = 0;
+};
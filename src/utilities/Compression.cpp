@@ -0,0 +1,160 @@
+#include "Compression.h"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+
+const size_t MIN_MATCH = 4;
+const size_t MAX_OFFSET = 65535;
+const int HASH_BITS = 12;
+
+uint32_t Read32(const char* data)
+{
+  uint32_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+uint32_t Hash(uint32_t sequence)
+{
+  return (sequence * 2654435761U) >> (32 - HASH_BITS);
+}
+
+// Lengths of 15 and more continue in extra bytes of 255 plus a remainder
+void WriteLengthTail(std::string& output, size_t length)
+{
+  length -= 15;
+  while (length >= 255)
+  {
+    output.push_back(static_cast<char>(255));
+    length -= 255;
+  }
+  output.push_back(static_cast<char>(length));
+}
+
+void WriteSequence(std::string& output, const char* literals, size_t literalLength,
+                   size_t offset, size_t matchLength)
+{
+  size_t matchCode = matchLength >= MIN_MATCH ? matchLength - MIN_MATCH : 0;
+  uint8_t token = static_cast<uint8_t>((literalLength < 15 ? literalLength : 15) << 4);
+  token |= static_cast<uint8_t>(matchCode < 15 ? matchCode : 15);
+  output.push_back(static_cast<char>(token));
+  
+  if (literalLength >= 15)
+    WriteLengthTail(output, literalLength);
+  output.append(literals, literalLength);
+  
+  // The final sequence carries literals only
+  if (matchLength == 0)
+    return;
+  
+  output.push_back(static_cast<char>(offset & 0xFF));
+  output.push_back(static_cast<char>(offset >> 8));
+  if (matchCode >= 15)
+    WriteLengthTail(output, matchCode);
+}
+
+bool ReadLengthTail(const uint8_t*& input, const uint8_t* end, size_t& length)
+{
+  uint8_t next;
+  do
+  {
+    if (input >= end)
+      return false;
+    next = *input++;
+    length += next;
+  } while (next == 255);
+  return true;
+}
+
+} // namespace
+
+namespace Compression
+{
+
+std::string Compress(const char* data, size_t size)
+{
+  std::string output;
+  output.reserve(size / 2 + 16);
+  
+  std::vector<int64_t> table(static_cast<size_t>(1) << HASH_BITS, -1);
+  size_t anchor = 0;
+  size_t position = 0;
+  
+  while (position + MIN_MATCH <= size)
+  {
+    uint32_t sequence = Read32(data + position);
+    uint32_t hash = Hash(sequence);
+    int64_t candidate = table[hash];
+    table[hash] = static_cast<int64_t>(position);
+    
+    if (candidate < 0 || position - static_cast<size_t>(candidate) > MAX_OFFSET ||
+        Read32(data + candidate) != sequence)
+    {
+      position++;
+      continue;
+    }
+    
+    size_t match = static_cast<size_t>(candidate);
+    size_t length = MIN_MATCH;
+    while (position + length < size && data[match + length] == data[position + length])
+      length++;
+    
+    WriteSequence(output, data + anchor, position - anchor, position - match, length);
+    position += length;
+    anchor = position;
+  }
+  
+  WriteSequence(output, data + anchor, size - anchor, 0, 0);
+  return output;
+}
+
+bool Decompress(const char* data, size_t size, size_t rawSize, std::string& output)
+{
+  output.clear();
+  output.reserve(rawSize);
+  
+  const uint8_t* input = reinterpret_cast<const uint8_t*>(data);
+  const uint8_t* end = input + size;
+  
+  while (input < end)
+  {
+    uint8_t token = *input++;
+    
+    size_t literalLength = token >> 4;
+    if (literalLength == 15 && !ReadLengthTail(input, end, literalLength))
+      return false;
+    
+    if (literalLength > static_cast<size_t>(end - input) || output.size() + literalLength > rawSize)
+      return false;
+    output.append(reinterpret_cast<const char*>(input), literalLength);
+    input += literalLength;
+    
+    if (input == end)
+      break;
+    
+    if (end - input < 2)
+      return false;
+    size_t offset = input[0] | (static_cast<size_t>(input[1]) << 8);
+    input += 2;
+    
+    size_t matchLength = token & 0x0F;
+    if (matchLength == 15 && !ReadLengthTail(input, end, matchLength))
+      return false;
+    matchLength += MIN_MATCH;
+    
+    if (offset == 0 || offset > output.size() || output.size() + matchLength > rawSize)
+      return false;
+    
+    // Byte by byte, since a match may overlap the bytes it produces
+    size_t from = output.size() - offset;
+    for (size_t i = 0; i < matchLength; i++)
+      output.push_back(output[from + i]);
+  }
+  
+  return output.size() == rawSize;
+}
+
+} // namespace Compression
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Small LZ77 block codec (LZ4-style sequences of literals and back
+// references) used for cold text that is rarely read. Fast to decode and
+// free of external dependencies; not meant for data exchanged with others.
+namespace Compression
+{
+  std::string Compress(const char* data, size_t size);
+  
+  // rawSize is the size passed to Compress; false if the block is malformed
+  bool Decompress(const char* data, size_t size, size_t rawSize, std::string& output);
+}
@@ -0,0 +1,103 @@
+#include "IntervalSet.h"
+#include <algorithm>
+#include <iterator>
+
+void IntervalSet::Add(time_t start, time_t end)
+{
+  if (start >= end)
+    return;
+
+  // Merge with an interval that starts before and reaches the new one
+  auto it = m_intervals.upper_bound(start);
+  if (it != m_intervals.begin())
+  {
+    auto prev = std::prev(it);
+    if (prev->second >= start)
+    {
+      start = prev->first;
+      end = std::max(end, prev->second);
+      it = m_intervals.erase(prev);
+    }
+  }
+
+  // Swallow every interval that starts inside the new one
+  while (it != m_intervals.end() && it->first <= end)
+  {
+    end = std::max(end, it->second);
+    it = m_intervals.erase(it);
+  }
+
+  m_intervals.emplace(start, end);
+}
+
+bool IntervalSet::Contains(time_t start, time_t end) const
+{
+  if (start >= end)
+    return true;
+
+  auto it = m_intervals.upper_bound(start);
+  if (it == m_intervals.begin())
+    return false;
+
+  --it;
+  return it->first <= start && it->second >= end;
+}
+
+std::vector<IntervalSet::Interval> IntervalSet::Gaps(time_t start, time_t end) const
+{
+  std::vector<Interval> gaps;
+  if (start >= end)
+    return gaps;
+
+  time_t cursor = start;
+  auto it = m_intervals.upper_bound(start);
+  if (it != m_intervals.begin())
+    --it;
+
+  for (; it != m_intervals.end() && it->first < end; ++it)
+  {
+    if (it->second <= cursor)
+      continue;
+    if (it->first > cursor)
+      gaps.emplace_back(cursor, it->first);
+    cursor = std::max(cursor, it->second);
+    if (cursor >= end)
+      break;
+  }
+
+  if (cursor < end)
+    gaps.emplace_back(cursor, end);
+
+  return gaps;
+}
+
+void IntervalSet::TrimBefore(time_t time)
+{
+  auto it = m_intervals.begin();
+  while (it != m_intervals.end() && it->first < time)
+  {
+    if (it->second <= time)
+    {
+      it = m_intervals.erase(it);
+    }
+    else
+    {
+      time_t end = it->second;
+      m_intervals.erase(it);
+      m_intervals.emplace(time, end);
+      break;
+    }
+  }
+}
+
+void IntervalSet::TrimAfter(time_t time)
+{
+  m_intervals.erase(m_intervals.lower_bound(time), m_intervals.end());
+  if (!m_intervals.empty() && m_intervals.rbegin()->second > time)
+    m_intervals.rbegin()->second = time;
+}
+
+std::vector<IntervalSet::Interval> IntervalSet::GetIntervals() const
+{
+  return std::vector<Interval>(m_intervals.begin(), m_intervals.end());
+}
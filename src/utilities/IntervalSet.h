@@ -0,0 +1,33 @@
+#pragma once
+
+#include <ctime>
+#include <map>
+#include <utility>
+#include <vector>
+
+// Set of disjoint half-open time intervals [start, end). Adjacent and
+// overlapping intervals are merged on insert. Used to track which parts of
+// the guide have already been fetched.
+class IntervalSet
+{
+public:
+  using Interval = std::pair<time_t, time_t>;
+
+  void Add(time_t start, time_t end);
+  void Clear() { m_intervals.clear(); }
+  bool Empty() const { return m_intervals.empty(); }
+
+  bool Contains(time_t start, time_t end) const;
+
+  // Parts of [start, end) not covered by the set, in ascending order
+  std::vector<Interval> Gaps(time_t start, time_t end) const;
+
+  // Forget coverage before (or after) the given time
+  void TrimBefore(time_t time);
+  void TrimAfter(time_t time);
+
+  std::vector<Interval> GetIntervals() const;
+
+private:
+  std::map<time_t, time_t> m_intervals;   // start -> end
+};
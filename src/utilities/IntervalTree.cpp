@@ -0,0 +1,233 @@
+#include "IntervalTree.h"
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+IntervalTree::IntervalTree()
+  : m_root(-1)
+  , m_seed(0x9E3779B9u)
+{
+}
+
+bool IntervalTree::Less(const Interval& a, const Interval& b)
+{
+  return a.start < b.start || (a.start == b.start && a.key < b.key);
+}
+
+uint32_t IntervalTree::NextPriority()
+{
+  // xorshift32; the treap only needs priorities that look random
+  m_seed ^= m_seed << 13;
+  m_seed ^= m_seed >> 17;
+  m_seed ^= m_seed << 5;
+  return m_seed;
+}
+
+void IntervalTree::Update(int node)
+{
+  Node& n = m_nodes[node];
+  n.maxEnd = n.interval.end;
+  if (n.left >= 0)
+    n.maxEnd = std::max(n.maxEnd, m_nodes[n.left].maxEnd);
+  if (n.right >= 0)
+    n.maxEnd = std::max(n.maxEnd, m_nodes[n.right].maxEnd);
+}
+
+int IntervalTree::RotateLeft(int node)
+{
+  int pivot = m_nodes[node].right;
+  m_nodes[node].right = m_nodes[pivot].left;
+  m_nodes[pivot].left = node;
+  Update(node);
+  Update(pivot);
+  return pivot;
+}
+
+int IntervalTree::RotateRight(int node)
+{
+  int pivot = m_nodes[node].left;
+  m_nodes[node].left = m_nodes[pivot].right;
+  m_nodes[pivot].right = node;
+  Update(node);
+  Update(pivot);
+  return pivot;
+}
+
+void IntervalTree::Insert(uint64_t key, time_t start, time_t end)
+{
+  Erase(key);
+
+  int node;
+  if (!m_freeNodes.empty())
+  {
+    node = m_freeNodes.back();
+    m_freeNodes.pop_back();
+  }
+  else
+  {
+    node = static_cast<int>(m_nodes.size());
+    m_nodes.emplace_back();
+  }
+
+  m_nodes[node] = {{key, start, end}, end, NextPriority(), -1, -1};
+  m_byKey[key] = node;
+  m_root = InsertAt(m_root, node);
+}
+
+int IntervalTree::InsertAt(int root, int node)
+{
+  if (root < 0)
+    return node;
+
+  if (Less(m_nodes[node].interval, m_nodes[root].interval))
+  {
+    m_nodes[root].left = InsertAt(m_nodes[root].left, node);
+    if (m_nodes[m_nodes[root].left].priority > m_nodes[root].priority)
+      return RotateRight(root);
+  }
+  else
+  {
+    m_nodes[root].right = InsertAt(m_nodes[root].right, node);
+    if (m_nodes[m_nodes[root].right].priority > m_nodes[root].priority)
+      return RotateLeft(root);
+  }
+
+  Update(root);
+  return root;
+}
+
+bool IntervalTree::Erase(uint64_t key)
+{
+  auto found = m_byKey.find(key);
+  if (found == m_byKey.end())
+    return false;
+
+  int node = found->second;
+  m_byKey.erase(found);
+  m_root = EraseAt(m_root, m_nodes[node].interval);
+  m_freeNodes.push_back(node);
+  return true;
+}
+
+int IntervalTree::EraseAt(int root, const Interval& interval)
+{
+  Node& n = m_nodes[root];
+  if (n.interval.key == interval.key && n.interval.start == interval.start)
+    return Merge(n.left, n.right);
+
+  if (Less(interval, n.interval))
+    n.left = EraseAt(n.left, interval);
+  else
+    n.right = EraseAt(n.right, interval);
+
+  Update(root);
+  return root;
+}
+
+int IntervalTree::Merge(int left, int right)
+{
+  if (left < 0)
+    return right;
+  if (right < 0)
+    return left;
+
+  if (m_nodes[left].priority > m_nodes[right].priority)
+  {
+    m_nodes[left].right = Merge(m_nodes[left].right, right);
+    Update(left);
+    return left;
+  }
+
+  m_nodes[right].left = Merge(left, m_nodes[right].left);
+  Update(right);
+  return right;
+}
+
+bool IntervalTree::Find(uint64_t key, Interval& interval) const
+{
+  auto found = m_byKey.find(key);
+  if (found == m_byKey.end())
+    return false;
+
+  interval = m_nodes[found->second].interval;
+  return true;
+}
+
+void IntervalTree::FindOverlapping(time_t start, time_t end, std::vector<Interval>& result) const
+{
+  if (start < end)
+    Collect(m_root, start, end, result);
+}
+
+void IntervalTree::Collect(int root, time_t start, time_t end, std::vector<Interval>& result) const
+{
+  // Nothing below ends after start
+  if (root < 0 || m_nodes[root].maxEnd <= start)
+    return;
+
+  const Node& n = m_nodes[root];
+  Collect(n.left, start, end, result);
+
+  // Everything to the right starts at or after this node
+  if (n.interval.start >= end)
+    return;
+
+  if (n.interval.end > start)
+    result.push_back(n.interval);
+  Collect(n.right, start, end, result);
+}
+
+void IntervalTree::GetProfile(time_t start, time_t end, Profile& profile) const
+{
+  profile.clear();
+
+  std::vector<Interval> overlapping;
+  FindOverlapping(start, end, overlapping);
+
+  // Ends sort before starts at the same time, as the intervals are half-open
+  std::vector<std::pair<time_t, int>> events;
+  events.reserve(overlapping.size() * 2);
+  for (const auto& interval : overlapping)
+  {
+    events.emplace_back(std::max(interval.start, start), 1);
+    if (interval.end < end)
+      events.emplace_back(interval.end, -1);
+  }
+  std::sort(events.begin(), events.end());
+
+  int depth = 0;
+  for (const auto& event : events)
+  {
+    depth += event.second;
+    if (!profile.empty() && profile.back().first == event.first)
+      profile.back().second = depth;
+    else
+      profile.emplace_back(event.first, depth);
+  }
+}
+
+int IntervalTree::MaxOverlap(const Profile& profile, time_t start, time_t end)
+{
+  // The count in effect at start is that of the last change at or before it
+  auto it = std::upper_bound(profile.begin(), profile.end(), start,
+                             [](time_t time, const std::pair<time_t, int>& entry) { return time < entry.first; });
+  int deepest = it != profile.begin() ? std::prev(it)->second : 0;
+  for (; it != profile.end() && it->first < end; ++it)
+    deepest = std::max(deepest, it->second);
+  return deepest;
+}
+
+int IntervalTree::MaxOverlap(time_t start, time_t end) const
+{
+  Profile profile;
+  GetProfile(start, end, profile);
+  return MaxOverlap(profile, start, end);
+}
+
+void IntervalTree::Clear()
+{
+  m_nodes.clear();
+  m_freeNodes.clear();
+  m_byKey.clear();
+  m_root = -1;
+}
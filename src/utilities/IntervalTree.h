@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Keyed half-open time intervals [start, end) that may overlap, in a treap
+// ordered by start with the largest end of each subtree kept alongside.
+// Insert and erase are O(log n) expected; an overlap query is O(log n + k)
+// for k results.
+//
+// Not thread-safe; the owner serialises access.
+class IntervalTree
+{
+public:
+  struct Interval
+  {
+    uint64_t key;
+    time_t start;
+    time_t end;
+  };
+
+  IntervalTree();
+
+  // Replaces the interval already held under the key, if any
+  void Insert(uint64_t key, time_t start, time_t end);
+  bool Erase(uint64_t key);
+  bool Find(uint64_t key, Interval& interval) const;
+
+  // Appends every interval overlapping [start, end), in start order
+  void FindOverlapping(time_t start, time_t end, std::vector<Interval>& result) const;
+
+  // How many intervals are in effect across [start, end), as the times at
+  // which the count changes, each with the count from then on. The first
+  // entry is at start unless nothing overlaps.
+  using Profile = std::vector<std::pair<time_t, int>>;
+  void GetProfile(time_t start, time_t end, Profile& profile) const;
+
+  // Most intervals in effect at any one time within [start, end), from a
+  // profile covering that range
+  static int MaxOverlap(const Profile& profile, time_t start, time_t end);
+  int MaxOverlap(time_t start, time_t end) const;
+
+  void Clear();
+  size_t Size() const { return m_byKey.size(); }
+
+private:
+  struct Node
+  {
+    Interval interval;
+    time_t maxEnd;
+    uint32_t priority;
+    int left;
+    int right;
+  };
+
+  std::vector<Node> m_nodes;
+  std::vector<int> m_freeNodes;
+  std::unordered_map<uint64_t, int> m_byKey;
+  int m_root;
+  uint32_t m_seed;
+
+  static bool Less(const Interval& a, const Interval& b);
+  uint32_t NextPriority();
+  void Update(int node);
+  int RotateLeft(int node);
+  int RotateRight(int node);
+  int InsertAt(int root, int node);
+  int EraseAt(int root, const Interval& interval);
+  int Merge(int left, int right);
+  void Collect(int root, time_t start, time_t end, std::vector<Interval>& result) const;
+};
@@ -0,0 +1,93 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+  Close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const std::string& path)
+{
+  Close();
+
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file)
+    return false;
+
+  std::streamsize size = file.tellg();
+  if (size <= 0)
+    return false;
+
+  m_buffer.resize(static_cast<size_t>(size));
+  file.seekg(0);
+  if (!file.read(m_buffer.data(), size))
+  {
+    m_buffer.clear();
+    return false;
+  }
+
+  m_data = m_buffer.data();
+  m_size = m_buffer.size();
+  return true;
+}
+
+void MappedFile::Close()
+{
+  m_buffer.clear();
+  m_buffer.shrink_to_fit();
+  m_data = nullptr;
+  m_size = 0;
+}
+
+#else
+
+bool MappedFile::Open(const std::string& path)
+{
+  Close();
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size <= 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  size_t size = static_cast<size_t>(info.st_size);
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping stays valid after the descriptor is closed
+  close(fd);
+
+  if (data == MAP_FAILED)
+    return false;
+
+  m_data = static_cast<const char*>(data);
+  m_size = size;
+  m_mapped = true;
+  return true;
+}
+
+void MappedFile::Close()
+{
+  if (m_mapped)
+    munmap(const_cast<char*>(m_data), m_size);
+
+  m_mapped = false;
+  m_data = nullptr;
+  m_size = 0;
+}
+
+#endif
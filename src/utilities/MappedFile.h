@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Read-only view of a whole file. Uses mmap where available; on Windows the
+// file is read into memory instead, which keeps the same interface.
+class MappedFile
+{
+public:
+  MappedFile() = default;
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool Open(const std::string& path);
+  void Close();
+
+  const char* Data() const { return m_data; }
+  size_t Size() const { return m_size; }
+
+private:
+  const char* m_data = nullptr;
+  size_t m_size = 0;
+#ifdef _WIN32
+  std::vector<char> m_buffer;
+#else
+  bool m_mapped = false;
+#endif
+};
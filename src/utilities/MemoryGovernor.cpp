@@ -0,0 +1,150 @@
+#include "MemoryGovernor.h"
+#include "Logger.h"
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+
+// A step is released only once usage is this far below the budget, so the
+// data it lets back in does not push usage straight over again
+const size_t RELEASE_PERCENT = 50;
+
+// The accounting goes to the log on the first check and every so many after
+const int STATS_EVERY_CHECKS = 20;
+
+int ToKB(size_t bytes)
+{
+  return static_cast<int>(bytes / 1024);
+}
+
+} // namespace
+
+MemoryGovernor::MemoryGovernor(size_t budgetBytes)
+  : m_budget(budgetBytes)
+  , m_engaged(0)
+  , m_running(false)
+{
+}
+
+MemoryGovernor::~MemoryGovernor()
+{
+  Stop();
+}
+
+void MemoryGovernor::AddConsumer(const std::string& name, UsageFunction usage)
+{
+  m_consumers.push_back({name, std::move(usage)});
+}
+
+void MemoryGovernor::AddShrinkStep(const std::string& name, ShrinkFunction shrink, ShrinkFunction release)
+{
+  m_steps.push_back({name, std::move(shrink), std::move(release)});
+}
+
+void MemoryGovernor::Start(int intervalSeconds)
+{
+  Stop();
+
+  m_running = true;
+  m_thread = std::thread(&MemoryGovernor::CheckLoop, this, std::max(intervalSeconds, 1));
+}
+
+void MemoryGovernor::Stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_threadMutex);
+    m_running = false;
+  }
+  m_threadCondition.notify_all();
+
+  if (m_thread.joinable())
+    m_thread.join();
+}
+
+size_t MemoryGovernor::GetUsage() const
+{
+  size_t usage = 0;
+  for (const auto& consumer : m_consumers)
+    usage += consumer.usage();
+  return usage;
+}
+
+void MemoryGovernor::Check()
+{
+  std::lock_guard<std::mutex> lock(m_checkMutex);
+  if (m_budget == 0)
+    return;
+
+  size_t usage = GetUsage();
+  if (usage > m_budget)
+  {
+    // Caches refill between checks; what was given up stays given up
+    for (int i = 0; i < m_engaged; i++)
+      m_steps[i].shrink();
+    usage = GetUsage();
+
+    bool engagedMore = false;
+    while (usage > m_budget && m_engaged < static_cast<int>(m_steps.size()))
+    {
+      const ShrinkStep& step = m_steps[m_engaged];
+      m_engaged++;
+      step.shrink();
+
+      size_t after = GetUsage();
+      Logger::Log(ADDON_LOG_INFO, "Memory use %d KB over a budget of %d KB: %s freed %d KB",
+                  ToKB(usage), ToKB(m_budget), step.name.c_str(), ToKB(usage > after ? usage - after : 0));
+      usage = after;
+      engagedMore = true;
+    }
+
+    // Said once, not on every check
+    if (usage > m_budget && engagedMore)
+    {
+      Logger::Log(ADDON_LOG_WARNING, "Memory use %d KB still over a budget of %d KB with every cache trimmed",
+                  ToKB(usage), ToKB(m_budget));
+    }
+  }
+  else if (m_engaged > 0 && usage < m_budget / 100 * RELEASE_PERCENT)
+  {
+    m_engaged--;
+    const ShrinkStep& step = m_steps[m_engaged];
+    Logger::Log(ADDON_LOG_INFO, "Memory use down to %d KB of %d KB, releasing %s",
+                ToKB(usage), ToKB(m_budget), step.name.c_str());
+    if (step.release)
+      step.release();
+  }
+}
+
+void MemoryGovernor::LogStats() const
+{
+  std::string breakdown;
+  size_t usage = 0;
+  for (const auto& consumer : m_consumers)
+  {
+    size_t bytes = consumer.usage();
+    usage += bytes;
+    breakdown += (breakdown.empty() ? "" : ", ") + consumer.name + " " + std::to_string(ToKB(bytes)) + " KB";
+  }
+
+  std::string budget = m_budget > 0 ? std::to_string(ToKB(m_budget)) + " KB" : "unlimited";
+  Logger::Log(ADDON_LOG_INFO, "Memory: %d KB of %s (%s)", ToKB(usage), budget.c_str(), breakdown.c_str());
+
+  int engaged = m_engaged;
+  for (int i = 0; i < engaged; i++)
+    Logger::Log(ADDON_LOG_INFO, "Memory: %s trimmed to stay within budget", m_steps[i].name.c_str());
+}
+
+void MemoryGovernor::CheckLoop(int intervalSeconds)
+{
+  int checks = 0;
+  while (m_running)
+  {
+    Check();
+    if (checks++ % STATS_EVERY_CHECKS == 0)
+      LogStats();
+
+    std::unique_lock<std::mutex> lock(m_threadMutex);
+    m_threadCondition.wait_for(lock, std::chrono::seconds(intervalSeconds), [this] { return !m_running; });
+  }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Keeps the addon's in-memory caches within one budget. Each cache reports
+// its usage; under pressure the governor engages shrink steps in the order
+// they were added, so the data that is cheapest to do without goes first.
+//
+// A background thread checks usage periodically. While over budget, every
+// engaged step is applied again (caches refill on refresh) and further
+// steps are engaged until usage fits. Once usage falls well below the
+// budget the last engaged step is released.
+//
+// Usage and shrink callbacks run on the governor's thread and must not
+// call back into it.
+class MemoryGovernor
+{
+public:
+  using UsageFunction = std::function<size_t()>;
+  using ShrinkFunction = std::function<void()>;
+
+  // A budget of 0 only accounts, it never shrinks anything
+  explicit MemoryGovernor(size_t budgetBytes);
+  ~MemoryGovernor();
+
+  // Register everything before Start
+  void AddConsumer(const std::string& name, UsageFunction usage);
+  void AddShrinkStep(const std::string& name, ShrinkFunction shrink, ShrinkFunction release);
+
+  void Start(int intervalSeconds);
+  void Stop();
+
+  // Runs one check on the calling thread
+  void Check();
+
+  size_t GetBudget() const { return m_budget; }
+  size_t GetUsage() const;
+  int GetEngagedSteps() const { return m_engaged; }
+
+  // Usage per consumer and the engaged steps; also logged periodically
+  void LogStats() const;
+
+private:
+  struct Consumer
+  {
+    std::string name;
+    UsageFunction usage;
+  };
+
+  struct ShrinkStep
+  {
+    std::string name;
+    ShrinkFunction shrink;
+    ShrinkFunction release;
+  };
+
+  const size_t m_budget;
+  std::vector<Consumer> m_consumers;
+  std::vector<ShrinkStep> m_steps;
+
+  std::mutex m_checkMutex;   // Serialises Check
+  std::atomic<int> m_engaged;
+
+  std::thread m_thread;
+  std::atomic<bool> m_running;
+  std::mutex m_threadMutex;
+  std::condition_variable m_threadCondition;
+
+  void CheckLoop(int intervalSeconds);
+};
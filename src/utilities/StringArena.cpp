@@ -0,0 +1,71 @@
+#include "StringArena.h"
+#include "Logger.h"
+#include <cstring>
+
+namespace
+{
+
+const size_t CHUNK_SIZE = 64 * 1024;
+
+} // namespace
+
+char* StringArena::Allocate(size_t size)
+{
+  if (size > m_remaining)
+  {
+    // Oversized strings get a chunk of their own
+    size_t chunkSize = size > CHUNK_SIZE ? size : CHUNK_SIZE;
+    m_chunks.emplace_back(new char[chunkSize]);
+    m_chunkBytes += chunkSize;
+    m_next = m_chunks.back().get();
+    m_remaining = chunkSize;
+  }
+  
+  char* result = m_next;
+  m_next += size;
+  m_remaining -= size;
+  return result;
+}
+
+std::string_view StringArena::Intern(std::string_view value)
+{
+  m_lookups++;
+  m_requestedBytes += value.size();
+  
+  if (value.empty())
+  {
+    m_hits++;
+    return std::string_view();
+  }
+  
+  auto it = m_index.find(value);
+  if (it != m_index.end())
+  {
+    m_hits++;
+    return *it;
+  }
+  
+  char* copy = Allocate(value.size());
+  std::memcpy(copy, value.data(), value.size());
+  m_storedBytes += value.size();
+  
+  std::string_view interned(copy, value.size());
+  m_index.insert(interned);
+  return interned;
+}
+
+size_t StringArena::MemoryUsage() const
+{
+  // Hash nodes are roughly a view plus a next pointer and the cached hash
+  return sizeof(*this) + m_chunkBytes + m_index.bucket_count() * sizeof(void*) +
+         m_index.size() * (sizeof(std::string_view) + 2 * sizeof(void*));
+}
+
+void StringArena::LogStats(const char* name) const
+{
+  int hitRatio = m_lookups > 0 ? static_cast<int>(m_hits * 100 / m_lookups) : 0;
+  Logger::Log(ADDON_LOG_DEBUG, "String arena (%s): %llu lookups, %d%% hits, %llu KB stored, %llu KB saved",
+              name, static_cast<unsigned long long>(m_lookups), hitRatio,
+              static_cast<unsigned long long>(m_storedBytes / 1024),
+              static_cast<unsigned long long>((m_requestedBytes - m_storedBytes) / 1024));
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+// Deduplicating string store. Interned strings are bump-allocated into
+// fixed chunks that never move, so the returned string_views stay valid for
+// the arena's lifetime. Equal strings share one copy.
+//
+// Interning is single-writer; views handed out may be read from any thread
+// once they have been published to it.
+class StringArena
+{
+public:
+  StringArena() = default;
+  StringArena(const StringArena&) = delete;
+  StringArena& operator=(const StringArena&) = delete;
+  
+  std::string_view Intern(std::string_view value);
+  
+  uint64_t GetLookups() const { return m_lookups; }
+  uint64_t GetHits() const { return m_hits; }
+  
+  // Bytes callers asked to store, and bytes actually stored
+  uint64_t GetRequestedBytes() const { return m_requestedBytes; }
+  uint64_t GetStoredBytes() const { return m_storedBytes; }
+  
+  size_t MemoryUsage() const;
+  void LogStats(const char* name) const;
+
+private:
+  std::vector<std::unique_ptr<char[]>> m_chunks;
+  char* m_next = nullptr;
+  size_t m_remaining = 0;
+  size_t m_chunkBytes = 0;
+  std::unordered_set<std::string_view> m_index;
+  
+  uint64_t m_lookups = 0;
+  uint64_t m_hits = 0;
+  uint64_t m_requestedBytes = 0;
+  uint64_t m_storedBytes = 0;
+  
+  char* Allocate(size_t size);
+};
@@ -0,0 +1,110 @@
+#include "TimerWheel.h"
+#include <algorithm>
+
+TimerWheel::TimerWheel(time_t now)
+  : m_current(now)
+  , m_size(0)
+{
+}
+
+void TimerWheel::Schedule(time_t when, uint64_t key)
+{
+  Insert({std::max(when, m_current), key});
+  m_size++;
+}
+
+void TimerWheel::Insert(const Timer& timer)
+{
+  time_t delta = timer.when - m_current;
+
+  int level = 0;
+  while (level < LEVELS - 1 && delta >= (static_cast<time_t>(1) << (SLOT_BITS * (level + 1))))
+    level++;
+
+  // Beyond the top level's range the timer is parked one revolution ahead
+  // and re-filed when that slot cascades
+  time_t when = timer.when;
+  time_t range = static_cast<time_t>(1) << (SLOT_BITS * LEVELS);
+  if (delta >= range)
+    when = m_current + range - 1;
+
+  size_t slot = static_cast<size_t>(when >> (SLOT_BITS * level)) & (SLOTS - 1);
+  m_slots[level][slot].push_back(timer);
+}
+
+void TimerWheel::Cascade(int level)
+{
+  size_t slot = static_cast<size_t>(m_current >> (SLOT_BITS * level)) & (SLOTS - 1);
+
+  std::vector<Timer> timers;
+  timers.swap(m_slots[level][slot]);
+  for (const Timer& timer : timers)
+    Insert(timer);
+}
+
+void TimerWheel::Advance(time_t now, std::vector<uint64_t>& expired)
+{
+  // After a long stall (suspend, clock change) re-file everything instead
+  // of stepping through every missed tick
+  time_t range = static_cast<time_t>(1) << (SLOT_BITS * LEVELS);
+  if (now - m_current > range)
+  {
+    std::vector<Timer> timers;
+    for (auto& level : m_slots)
+    {
+      for (auto& slot : level)
+      {
+        timers.insert(timers.end(), slot.begin(), slot.end());
+        slot.clear();
+      }
+    }
+
+    std::sort(timers.begin(), timers.end(),
+              [](const Timer& a, const Timer& b) { return a.when < b.when; });
+
+    m_current = now + 1;
+    for (const Timer& timer : timers)
+    {
+      if (timer.when <= now)
+      {
+        expired.push_back(timer.key);
+        m_size--;
+      }
+      else
+      {
+        Insert(timer);
+      }
+    }
+    return;
+  }
+
+  while (m_current <= now)
+  {
+    // Entering a new block of a level pulls that block's timers down
+    for (int level = 1; level < LEVELS; level++)
+    {
+      if ((m_current & ((static_cast<time_t>(1) << (SLOT_BITS * level)) - 1)) != 0)
+        break;
+      Cascade(level);
+    }
+
+    std::vector<Timer>& slot = m_slots[0][static_cast<size_t>(m_current) & (SLOTS - 1)];
+    for (const Timer& timer : slot)
+      expired.push_back(timer.key);
+    m_size -= slot.size();
+    slot.clear();
+
+    m_current++;
+  }
+}
+
+void TimerWheel::Clear(time_t now)
+{
+  for (auto& level : m_slots)
+  {
+    for (auto& slot : level)
+      slot.clear();
+  }
+  m_current = now;
+  m_size = 0;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <vector>
+
+// Hierarchical timing wheel with one-second ticks. Four levels of 64 slots
+// cover about 194 days; later deadlines wait in the top level and are
+// re-filed as the wheel turns. Scheduling is O(1) and each tick touches one
+// slot, plus a cascade from the level above every 64 ticks.
+//
+// Not thread-safe; the owner serialises access.
+class TimerWheel
+{
+public:
+  explicit TimerWheel(time_t now);
+
+  // Deadlines that have already passed expire on the next Advance
+  void Schedule(time_t when, uint64_t key);
+
+  // Moves the wheel to now and appends the keys of every timer whose
+  // deadline is at or before it, in deadline order
+  void Advance(time_t now, std::vector<uint64_t>& expired);
+
+  void Clear(time_t now);
+  size_t Size() const { return m_size; }
+
+private:
+  static const int LEVELS = 4;
+  static const int SLOT_BITS = 6;
+  static const int SLOTS = 1 << SLOT_BITS;
+
+  struct Timer
+  {
+    time_t when;
+    uint64_t key;
+  };
+
+  std::vector<Timer> m_slots[LEVELS][SLOTS];
+  time_t m_current;   // Next tick to process
+  size_t m_size;
+
+  void Insert(const Timer& timer);
+  void Cascade(int level);
+};
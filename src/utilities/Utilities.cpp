@@ -1,83 +1,448 @@
 #include "Utilities.h"
 #include <sstream>
-#include <iomanip>
 #include <algorithm>
+#include <cstdint>
 #include <ctime>
 
-namespace Utilities
+// Vector kernels for the encoders. On x86 each is compiled for its own
+// instruction set and picked at run time from what the CPU supports; NEON
+// is part of every arm64 CPU.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define UTILITIES_X86
+#define UTILITIES_TARGET(isa) __attribute__((target(isa)))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define UTILITIES_X86
+#define UTILITIES_TARGET(isa)
+#elif (defined(__aarch64__) && defined(__ARM_NEON)) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define UTILITIES_NEON
+#endif
+
+namespace
+{
+
+const int64_t SECONDS_PER_DAY = 24 * 3600;
+
+const char HEX_DIGITS[] = "0123456789ABCDEF";
+const char BASE64_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// RFC 3986 unreserved characters, which UrlEncode leaves as they are
+bool IsUnreserved(unsigned char c)
+{
+  return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ||
+         c == '-' || c == '_' || c == '.' || c == '~';
+}
+
+char* UrlEncodeScalar(const unsigned char* in, size_t size, char* out)
+{
+  for (size_t i = 0; i < size; i++)
+  {
+    unsigned char byte = in[i];
+    if (IsUnreserved(byte))
+    {
+      *out++ = static_cast<char>(byte);
+    }
+    else
+    {
+      out[0] = '%';
+      out[1] = HEX_DIGITS[byte >> 4];
+      out[2] = HEX_DIGITS[byte & 0x0f];
+      out += 3;
+    }
+  }
+  return out;
+}
+
+// Each kernel takes whole blocks from the start of the input and sets done
+// to how much it took; the caller finishes the rest with the scalar loop.
+// UrlEncode kernels copy a block that needs no escaping as it is, since
+// IDs and most names need none, and escape any other block byte by byte.
+// Base64 kernels encode whole 3-byte groups only.
+struct EncodeKernels
+{
+  char* (*urlEncode)(const unsigned char* in, size_t size, size_t& done, char* out);
+  size_t (*base64Encode)(const unsigned char* in, size_t size, char* out);
+};
+
+char* UrlEncodeBlocksScalar(const unsigned char*, size_t, size_t& done, char* out)
+{
+  done = 0;
+  return out;
+}
+
+size_t Base64EncodeBlocksScalar(const unsigned char*, size_t, char*)
+{
+  return 0;
+}
+
+#if defined(UTILITIES_X86)
+
+// Bytes within [low, high], as an unsigned compare: (c - low) <= (high - low)
+UTILITIES_TARGET("sse2")
+inline __m128i InRange(__m128i bytes, char low, char high)
 {
+  __m128i offset = _mm_sub_epi8(bytes, _mm_set1_epi8(low));
+  return _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(static_cast<char>(high - low))), offset);
+}
+
+UTILITIES_TARGET("sse2")
+char* UrlEncodeBlocksSse2(const unsigned char* in, size_t size, size_t& done, char* out)
+{
+  for (done = 0; done + 16 <= size; done += 16)
+  {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + done));
+    __m128i unreserved = _mm_or_si128(_mm_or_si128(InRange(bytes, 'A', 'Z'), InRange(bytes, 'a', 'z')),
+                                      InRange(bytes, '0', '9'));
+    unreserved = _mm_or_si128(unreserved, _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('-')),
+                                                       _mm_cmpeq_epi8(bytes, _mm_set1_epi8('_'))));
+    unreserved = _mm_or_si128(unreserved, _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('.')),
+                                                       _mm_cmpeq_epi8(bytes, _mm_set1_epi8('~'))));
+    if (_mm_movemask_epi8(unreserved) == 0xffff)
+    {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out), bytes);
+      out += 16;
+    }
+    else
+    {
+      out = UrlEncodeScalar(in + done, 16, out);
+    }
+  }
+  return out;
+}
 
-std::string UrlEncode(const std::string& value)
+UTILITIES_TARGET("avx2")
+inline __m256i InRange(__m256i bytes, char low, char high)
 {
-  std::ostringstream escaped;
-  escaped.fill('0');
-  escaped << std::hex;
+  __m256i offset = _mm256_sub_epi8(bytes, _mm256_set1_epi8(low));
+  return _mm256_cmpeq_epi8(_mm256_min_epu8(offset, _mm256_set1_epi8(static_cast<char>(high - low))), offset);
+}
 
-  for (char c : value)
+UTILITIES_TARGET("avx2")
+char* UrlEncodeBlocksAvx2(const unsigned char* in, size_t size, size_t& done, char* out)
+{
+  for (done = 0; done + 32 <= size; done += 32)
   {
-    if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~')
+    __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + done));
+    __m256i unreserved = _mm256_or_si256(_mm256_or_si256(InRange(bytes, 'A', 'Z'), InRange(bytes, 'a', 'z')),
+                                         InRange(bytes, '0', '9'));
+    unreserved = _mm256_or_si256(unreserved, _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('-')),
+                                                             _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('_'))));
+    unreserved = _mm256_or_si256(unreserved, _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('.')),
+                                                             _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('~'))));
+    if (_mm256_movemask_epi8(unreserved) == -1)
     {
-      escaped << c;
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), bytes);
+      out += 32;
     }
     else
     {
-      escaped << std::uppercase;
-      escaped << '%' << std::setw(2) << int((unsigned char)c);
-      escaped << std::nouppercase;
+      out = UrlEncodeScalar(in + done, 32, out);
     }
   }
+  return out;
+}
+
+// 12 input bytes per step, but each load reads 16. Each 32-bit lane gets
+// one 3-byte group as b1 b0 b2 b1, from which the multiplies move the four
+// 6-bit fields into their own bytes. An index becomes a character by
+// adding an offset picked by its range: 0-25 'A', 26-51 'a', 52-61 '0',
+// 62 '+' and 63 '/'.
+UTILITIES_TARGET("ssse3")
+size_t Base64EncodeBlocksSsse3(const unsigned char* in, size_t size, char* out)
+{
+  const __m128i order = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+  const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                        '/' - 63, 'A', 0, 0);
+  
+  size_t done = 0;
+  for (; done + 16 <= size; done += 12, out += 16)
+  {
+    __m128i bytes = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + done)), order);
+    __m128i high = _mm_mulhi_epu16(_mm_and_si128(bytes, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+    __m128i low = _mm_mullo_epi16(_mm_and_si128(bytes, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+    __m128i indices = _mm_or_si128(high, low);
+    
+    __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13)));
+    __m128i encoded = _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), encoded);
+  }
+  return done;
+}
+
+// The SSSE3 steps on two groups of 12 bytes at once, one per 128-bit half
+UTILITIES_TARGET("avx2")
+size_t Base64EncodeBlocksAvx2(const unsigned char* in, size_t size, char* out)
+{
+  const __m256i order = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                        10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+  const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                           '/' - 63, 'A', 0, 0,
+                                           'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                           '/' - 63, 'A', 0, 0);
+  
+  size_t done = 0;
+  for (; done + 28 <= size; done += 24, out += 32)
+  {
+    __m256i bytes = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + done))),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + done + 12)), 1);
+    bytes = _mm256_shuffle_epi8(bytes, order);
+    __m256i high = _mm256_mulhi_epu16(_mm256_and_si256(bytes, _mm256_set1_epi32(0x0fc0fc00)),
+                                      _mm256_set1_epi32(0x04000040));
+    __m256i low = _mm256_mullo_epi16(_mm256_and_si256(bytes, _mm256_set1_epi32(0x003f03f0)),
+                                     _mm256_set1_epi32(0x01000010));
+    __m256i indices = _mm256_or_si256(high, low);
+    
+    __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    range = _mm256_or_si256(range, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices),
+                                                    _mm256_set1_epi8(13)));
+    __m256i encoded = _mm256_add_epi8(_mm256_shuffle_epi8(offsets, range), indices);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), encoded);
+  }
+  return done;
+}
 
-  return escaped.str();
+struct CpuFeatures
+{
+  bool sse2 = false;
+  bool ssse3 = false;
+  bool avx2 = false;   // Including the OS saving the AVX registers
+};
+
+CpuFeatures DetectCpuFeatures()
+{
+  CpuFeatures features;
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  int maxLeaf = info[0];
+  
+  __cpuid(info, 1);
+  features.sse2 = (info[3] & (1 << 26)) != 0;
+  features.ssse3 = (info[2] & (1 << 9)) != 0;
+  bool avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+  if (avx && maxLeaf >= 7)
+  {
+    __cpuidex(info, 7, 0);
+    features.avx2 = (info[1] & (1 << 5)) != 0;
+  }
+#else
+  __builtin_cpu_init();
+  features.sse2 = __builtin_cpu_supports("sse2");
+  features.ssse3 = __builtin_cpu_supports("ssse3");
+  features.avx2 = __builtin_cpu_supports("avx2");
+#endif
+  return features;
 }
 
-std::string Base64Encode(const std::string& input)
+EncodeKernels SelectKernels()
 {
-  static const char base64_chars[] =
-    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-    "abcdefghijklmnopqrstuvwxyz"
-    "0123456789+/";
+  CpuFeatures features = DetectCpuFeatures();
+  EncodeKernels kernels = {UrlEncodeBlocksScalar, Base64EncodeBlocksScalar};
+  if (features.avx2)
+  {
+    kernels = {UrlEncodeBlocksAvx2, Base64EncodeBlocksAvx2};
+  }
+  else
+  {
+    if (features.sse2)
+      kernels.urlEncode = UrlEncodeBlocksSse2;
+    if (features.ssse3)
+      kernels.base64Encode = Base64EncodeBlocksSsse3;
+  }
+  return kernels;
+}
 
-  std::string ret;
-  int i = 0;
-  int j = 0;
-  unsigned char char_array_3[3];
-  unsigned char char_array_4[4];
-  size_t in_len = input.size();
-  const unsigned char* bytes_to_encode = reinterpret_cast<const unsigned char*>(input.c_str());
+#elif defined(UTILITIES_NEON)
 
-  while (in_len--)
+inline uint8x16_t InRange(uint8x16_t bytes, uint8_t low, uint8_t high)
+{
+  return vcleq_u8(vsubq_u8(bytes, vdupq_n_u8(low)), vdupq_n_u8(static_cast<uint8_t>(high - low)));
+}
+
+char* UrlEncodeBlocksNeon(const unsigned char* in, size_t size, size_t& done, char* out)
+{
+  for (done = 0; done + 16 <= size; done += 16)
   {
-    char_array_3[i++] = *(bytes_to_encode++);
-    if (i == 3)
+    uint8x16_t bytes = vld1q_u8(in + done);
+    uint8x16_t unreserved = vorrq_u8(vorrq_u8(InRange(bytes, 'A', 'Z'), InRange(bytes, 'a', 'z')),
+                                     InRange(bytes, '0', '9'));
+    unreserved = vorrq_u8(unreserved, vorrq_u8(vceqq_u8(bytes, vdupq_n_u8('-')), vceqq_u8(bytes, vdupq_n_u8('_'))));
+    unreserved = vorrq_u8(unreserved, vorrq_u8(vceqq_u8(bytes, vdupq_n_u8('.')), vceqq_u8(bytes, vdupq_n_u8('~'))));
+    if (vminvq_u8(unreserved) == 0xff)
+    {
+      vst1q_u8(reinterpret_cast<uint8_t*>(out), bytes);
+      out += 16;
+    }
+    else
     {
-      char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-      char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-      char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-      char_array_4[3] = char_array_3[2] & 0x3f;
-
-      for (i = 0; i < 4; i++)
-        ret += base64_chars[char_array_4[i]];
-      i = 0;
+      out = UrlEncodeScalar(in + done, 16, out);
     }
   }
+  return out;
+}
 
-  if (i)
+// 48 input bytes per step, de-interleaved into the first, second and third
+// byte of each group, and the alphabet looked up 64 entries at a time
+size_t Base64EncodeBlocksNeon(const unsigned char* in, size_t size, char* out)
+{
+  const uint8_t* alphabet = reinterpret_cast<const uint8_t*>(BASE64_ALPHABET);
+  uint8x16x4_t table;
+  table.val[0] = vld1q_u8(alphabet);
+  table.val[1] = vld1q_u8(alphabet + 16);
+  table.val[2] = vld1q_u8(alphabet + 32);
+  table.val[3] = vld1q_u8(alphabet + 48);
+  const uint8x16_t mask = vdupq_n_u8(0x3f);
+  
+  size_t done = 0;
+  for (; done + 48 <= size; done += 48, out += 64)
   {
-    for (j = i; j < 3; j++)
-      char_array_3[j] = '\0';
+    uint8x16x3_t bytes = vld3q_u8(in + done);
+    
+    uint8x16x4_t encoded;
+    encoded.val[0] = vqtbl4q_u8(table, vshrq_n_u8(bytes.val[0], 2));
+    encoded.val[1] = vqtbl4q_u8(table, vandq_u8(vorrq_u8(vshlq_n_u8(bytes.val[0], 4), vshrq_n_u8(bytes.val[1], 4)), mask));
+    encoded.val[2] = vqtbl4q_u8(table, vandq_u8(vorrq_u8(vshlq_n_u8(bytes.val[1], 2), vshrq_n_u8(bytes.val[2], 6)), mask));
+    encoded.val[3] = vqtbl4q_u8(table, vandq_u8(bytes.val[2], mask));
+    vst4q_u8(reinterpret_cast<uint8_t*>(out), encoded);
+  }
+  return done;
+}
+
+EncodeKernels SelectKernels()
+{
+  return {UrlEncodeBlocksNeon, Base64EncodeBlocksNeon};
+}
+
+#else
+
+EncodeKernels SelectKernels()
+{
+  return {UrlEncodeBlocksScalar, Base64EncodeBlocksScalar};
+}
+
+#endif
+
+// Picked once, on first use
+const EncodeKernels& GetEncodeKernels()
+{
+  static const EncodeKernels kernels = SelectKernels();
+  return kernels;
+}
 
-    char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-    char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-    char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
+bool IsDigit(char c)
+{
+  return c >= '0' && c <= '9';
+}
 
-    for (j = 0; j < i + 1; j++)
-      ret += base64_chars[char_array_4[j]];
+// Exactly count decimal digits
+bool ParseDigits(const char* text, int count, int& value)
+{
+  value = 0;
+  for (int i = 0; i < count; i++)
+  {
+    if (!IsDigit(text[i]))
+      return false;
+    value = value * 10 + (text[i] - '0');
+  }
+  return true;
+}
 
-    while (i++ < 3)
-      ret += '=';
+void WriteDigits(char* text, int count, int value)
+{
+  for (int i = count - 1; i >= 0; i--)
+  {
+    text[i] = static_cast<char>('0' + value % 10);
+    value /= 10;
   }
+}
+
+// Days since 1970-01-01 in the proleptic Gregorian calendar, and back
+// (H. Hinnant's civil date algorithms). Days past the end of a month roll
+// into the next one, like timegm.
+int64_t DaysFromCivil(int year, int month, int day)
+{
+  year -= month <= 2;
+  int64_t era = (year >= 0 ? year : year - 399) / 400;
+  int64_t yearOfEra = year - era * 400;
+  int64_t dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int64_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+  return era * 146097 + dayOfEra - 719468;
+}
+
+void CivilFromDays(int64_t days, int& year, int& month, int& day)
+{
+  days += 719468;
+  int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+  int64_t dayOfEra = days - era * 146097;
+  int64_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+  int64_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+  int64_t monthIndex = (5 * dayOfYear + 2) / 153;
+  day = static_cast<int>(dayOfYear - (153 * monthIndex + 2) / 5 + 1);
+  month = static_cast<int>(monthIndex < 10 ? monthIndex + 3 : monthIndex - 9);
+  year = static_cast<int>(yearOfEra + era * 400 + (month <= 2));
+}
+
+} // namespace
+
+namespace Utilities
+{
 
-  return ret;
+std::string UrlEncode(std::string_view value)
+{
+  // Sized for the worst case up front and trimmed once, instead of a
+  // stream write (and manipulator changes) per byte
+  std::string escaped(value.size() * 3, '\0');
+  const unsigned char* in = reinterpret_cast<const unsigned char*>(value.data());
+  size_t done = 0;
+  char* out = GetEncodeKernels().urlEncode(in, value.size(), done, &escaped[0]);
+  
+  out = UrlEncodeScalar(in + done, value.size() - done, out);
+  escaped.resize(out - escaped.data());
+  return escaped;
+}
+
+std::string Base64Encode(std::string_view input)
+{
+  // Whole 3-byte groups straight into a preallocated buffer, as many as
+  // the vector path takes first, then the tail
+  std::string encoded(((input.size() + 2) / 3) * 4, '\0');
+  const unsigned char* in = reinterpret_cast<const unsigned char*>(input.data());
+  char* out = &encoded[0];
+  
+  size_t done = GetEncodeKernels().base64Encode(in, input.size(), out);
+  in += done;
+  out += done / 3 * 4;
+  
+  size_t remaining = input.size() - done;
+  for (; remaining >= 3; remaining -= 3, in += 3, out += 4)
+  {
+    uint32_t group = (static_cast<uint32_t>(in[0]) << 16) | (static_cast<uint32_t>(in[1]) << 8) | in[2];
+    out[0] = BASE64_ALPHABET[group >> 18];
+    out[1] = BASE64_ALPHABET[(group >> 12) & 0x3f];
+    out[2] = BASE64_ALPHABET[(group >> 6) & 0x3f];
+    out[3] = BASE64_ALPHABET[group & 0x3f];
+  }
+  
+  if (remaining > 0)
+  {
+    uint32_t group = static_cast<uint32_t>(in[0]) << 16;
+    if (remaining == 2)
+      group |= static_cast<uint32_t>(in[1]) << 8;
+    
+    out[0] = BASE64_ALPHABET[group >> 18];
+    out[1] = BASE64_ALPHABET[(group >> 12) & 0x3f];
+    out[2] = remaining == 2 ? BASE64_ALPHABET[(group >> 6) & 0x3f] : '=';
+    out[3] = '=';
+  }
+  
+  return encoded;
 }
 
 std::vector<std::string> Split(const std::string& str, char delimiter)
@@ -104,25 +469,94 @@ std::string Join(const std::vector<std::string>& elements, const std::string& de
   return result;
 }
 
-time_t ParseDateTime(const std::string& dateTime)
+time_t ParseDateTime(std::string_view dateTime)
 {
-  // Parse ISO 8601 format: 2023-01-01T12:00:00Z
-  struct tm tm = {};
-  std::istringstream ss(dateTime);
-  ss >> std::get_time(&tm, "%Y-%m-%dT%H:%M:%S");
+  // Hand-rolled rather than std::get_time: this runs for every programme
+  // of every EPG load and must not allocate or touch the locale
+  const char* p = dateTime.data();
+  const char* end = p + dateTime.size();
+  
+  int year, month, day, hour, minute, second;
+  if (end - p < 19 ||
+      !ParseDigits(p, 4, year) || p[4] != '-' ||
+      !ParseDigits(p + 5, 2, month) || p[7] != '-' ||
+      !ParseDigits(p + 8, 2, day) || (p[10] != 'T' && p[10] != 't' && p[10] != ' ') ||
+      !ParseDigits(p + 11, 2, hour) || p[13] != ':' ||
+      !ParseDigits(p + 14, 2, minute) || p[16] != ':' ||
+      !ParseDigits(p + 17, 2, second))
+    return 0;
+  p += 19;
   
-  if (ss.fail())
+  // A leap second is folded into the next minute, as timegm does
+  if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60)
     return 0;
+  
+  // Jellyfin sends seven fractional digits; time_t has no room for them
+  if (p < end && (*p == '.' || *p == ','))
+  {
+    const char* digits = ++p;
+    while (p < end && *p >= '0' && *p <= '9')
+      p++;
+    if (p == digits)
+      return 0;
+  }
+  
+  int offset = 0;
+  if (p < end && (*p == 'Z' || *p == 'z'))
+  {
+    p++;
+  }
+  else if (p < end && (*p == '+' || *p == '-'))
+  {
+    int sign = *p == '-' ? -1 : 1;
+    int offsetHours, offsetMinutes;
+    if (end - p >= 6 && p[3] == ':' && ParseDigits(p + 1, 2, offsetHours) && ParseDigits(p + 4, 2, offsetMinutes))
+      p += 6;
+    else if (end - p >= 5 && ParseDigits(p + 1, 2, offsetHours) && ParseDigits(p + 3, 2, offsetMinutes))
+      p += 5;
+    else if (end - p >= 3 && ParseDigits(p + 1, 2, offsetHours) && (end - p == 3 || !IsDigit(p[3])))
+    {
+      offsetMinutes = 0;
+      p += 3;
+    }
+    else
+      return 0;
     
-  return timegm(&tm);
+    if (offsetHours > 23 || offsetMinutes > 59)
+      return 0;
+    offset = sign * (offsetHours * 3600 + offsetMinutes * 60);
+  }
+  
+  // Anything after the date is ignored, as it always was
+  return static_cast<time_t>(DaysFromCivil(year, month, day)) * SECONDS_PER_DAY +
+         hour * 3600 + minute * 60 + second - offset;
 }
 
 std::string FormatDateTime(time_t time)
 {
-  struct tm* tm = gmtime(&time);
-  char buffer[80];
-  strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%SZ", tm);
-  return std::string(buffer);
+  // Floor division, so times before 1970 land on the right day
+  int64_t days = static_cast<int64_t>(time) / SECONDS_PER_DAY;
+  int64_t seconds = static_cast<int64_t>(time) % SECONDS_PER_DAY;
+  if (seconds < 0)
+  {
+    seconds += SECONDS_PER_DAY;
+    days--;
+  }
+  
+  int year, month, day;
+  CivilFromDays(days, year, month, day);
+  
+  if (year < 0 || year > 9999)
+    return std::string();
+  
+  std::string result("0000-00-00T00:00:00Z");
+  WriteDigits(&result[0], 4, year);
+  WriteDigits(&result[5], 2, month);
+  WriteDigits(&result[8], 2, day);
+  WriteDigits(&result[11], 2, static_cast<int>(seconds / 3600));
+  WriteDigits(&result[14], 2, static_cast<int>(seconds / 60 % 60));
+  WriteDigits(&result[17], 2, static_cast<int>(seconds % 60));
+  return result;
 }
 
 } // namespace Utilities
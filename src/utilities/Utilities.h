@@ -1,14 +1,23 @@
 #pragma once
 
+#include <ctime>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace Utilities
 {
-  std::string UrlEncode(const std::string& value);
-  std::string Base64Encode(const std::string& input);
+  std::string UrlEncode(std::string_view value);
+  std::string Base64Encode(std::string_view input);
   std::vector<std::string> Split(const std::string& str, char delimiter);
   std::string Join(const std::vector<std::string>& elements, const std::string& delimiter);
-  time_t ParseDateTime(const std::string& dateTime);
+  
+  // ISO 8601 as Jellyfin sends it: YYYY-MM-DDTHH:MM:SS with optional
+  // fractional seconds (dropped) and a Z or +hh:mm / +hhmm offset (applied;
+  // none means UTC). Returns 0 if the text is not such a date.
+  time_t ParseDateTime(std::string_view dateTime);
+  
+  // UTC, YYYY-MM-DDTHH:MM:SSZ; safe to call from any thread. Years outside
+  // 0000-9999 give an empty string.
   std::string FormatDateTime(time_t time);
 }